@@ -2,6 +2,17 @@
 //#version 430
 //layout (local_size_x = 1024) in; //to be safe, we limit our local work group size to 1024. That's the minimum a GL 4.3 capable driver must support.
 
+//Orbits are iterated in single precision, unless the host defines DOUBLE_PRECISION (see Helpers::GetPrecisionPreamble).
+//Sample offsets, rejection checks and orbits then use doubles. The last position of a worker is kept as dvec2 as well, which makes
+//individualData 48 bytes instead of 32, so Helpers::WorkerState does not mirror it in this case.
+#ifdef DOUBLE_PRECISION
+#define real double
+#define real2 dvec2
+#else
+#define real float
+#define real2 vec2
+#endif
+
 layout(std430, binding=2) restrict buffer renderedDataRed
 {
     restrict uint counts_SSBO[];
@@ -9,24 +20,83 @@ layout(std430, binding=2) restrict buffer renderedDataRed
 
 struct individualData
 {
-    uint phase;
-    uint orbitNumber;
+    uint phase; //0: start next sample, 1: check if the orbit escapes, 2: draw the orbit, 3: idle, the sample budget is used up.
     uint doneIterations;
-    vec2 lastPosition;
+    uvec2 sampleIndex; //64 bit, low word first. The sample this worker is currently processing.
+    uvec2 sampleEnd; //end of the range of samples this worker has claimed.
+    real2 lastPosition;
 };
 
-layout(packed, binding=5) restrict buffer statusBuffer
+layout(std430, binding=5) restrict buffer statusBuffer
 {
     restrict individualData stateArray[];
 };
 
+//Workers claim contiguous ranges of samples from here. Sample indices are independent of which worker processes them,
+//so the work group sizes have no influence on the sample sequence. When resuming a checkpoint, the unfinished states
+//of the old workers are put into pendingStates, and continued by whichever worker needs new work first.
+//The counters at the end are read back by the host to track progress. 64 bit counters are stored low word first.
+layout(std430, binding=6) restrict buffer sampleQueue
+{
+    uint claimedChunks;
+    uint nextPendingState;
+    uint pendingStateCount;
+    uint acceptedOrbits;
+    uvec2 finishedSamples;
+    uvec2 drawnOrbits;
+    restrict individualData pendingStates[];
+};
+
+//Where the work goes, for tuning. Only compiled in if the host defines COLLECT_PIPELINE_COUNTERS, as the atomics are not free.
+//Indices must match Helpers::PipelineCounter. Every counter is 64 bit, low word first.
+#define COUNTER_STARTED_SAMPLES 0
+#define COUNTER_REJECTED_BY_MAIN_CARDIOID 1
+#define COUNTER_REJECTED_BY_KNOWN_CIRCLE 2
+#define COUNTER_REJECTED_NOT_ESCAPING 3
+#define COUNTER_REJECTED_TOO_SHORT 4
+#define COUNTER_DRAWN 5
+#define COUNTER_ESCAPE_CHECK_ITERATIONS 6
+#define COUNTER_DRAW_ITERATIONS 7
+#define COUNTER_IDLE_ITERATIONS 8
+#define COUNTER_HISTOGRAM_WRITES 9
+#define COUNTER_COUNT 10
+
+#ifdef COLLECT_PIPELINE_COUNTERS
+layout(std430, binding=4) restrict buffer pipelineCounters
+{
+    restrict uvec2 counters[COUNTER_COUNT];
+};
+shared uvec2 groupCounters[COUNTER_COUNT];
+uint invocationCounters[COUNTER_COUNT];
+#define COUNT(counter, value) { invocationCounters[counter] += (value); }
+#else
+#define COUNT(counter, value) {}
+#endif
+
+//Image size and orbit lengths are fixed for a render. Unless the host defines them as constants (see Helpers::GetRenderConstantsPreamble),
+//so the compiler can fold them into the index computations and loop bounds, they are uniforms.
+#ifndef RENDER_CONSTANTS
 uniform uint width;
 uniform uint height;
 
 uniform uvec4 orbitLength;
 
-uniform uint iterationsPerDispatch;
 uniform uint totalIterations;
+#endif
+
+uniform uint iterationsPerDispatch;
+
+uniform uint shardIndex;
+uniform uint shardCount;
+uniform uint randomSeed;
+
+uniform uvec2 sampleIndexBase;
+uniform uint samplesPerChunk;
+uniform uvec2 sampleLimit; //no samples with this or a higher index are claimed.
+//acceptedOrbits only holds the low word of the accepted orbit count. The host keeps the full count and moves the base along,
+//so the limit is the number of orbits that may still be accepted after acceptedOrbits reached acceptedOrbitBase.
+uniform uint acceptedOrbitBase;
+uniform uint acceptedOrbitLimit; //0xFFFFFFFF means no limit.
 
 void addToColorOfCell(uvec2 cell, uvec3 toAdd)
 {
@@ -36,13 +106,13 @@ void addToColorOfCell(uvec2 cell, uvec3 toAdd)
     atomicAdd(counts_SSBO[firstIndex+2],toAdd.z);
 }
 
-uvec2 getCell(vec2 complex)
+uvec2 getCell(real2 complex)
 {
-    vec2 uv = clamp(vec2((complex.x+2.875)/4.025, (abs(complex.y/1.15))),vec2(0.0),vec2(1.0));
+    real2 uv = clamp(real2((complex.x+2.875)/4.025, (abs(complex.y/1.15))),real2(0.0),real2(1.0));
     return uvec2(width * uv.x, height * uv.y);
 }
 
-void addToColorAt(vec2 complex, uvec3 toAdd)
+void addToColorAt(real2 complex, uvec3 toAdd)
 {
     uvec2 cell = getCell(complex);
     addToColorOfCell(cell,toAdd);
@@ -55,18 +125,18 @@ uint intHash(uint x) {
     return x;
 }
 
-float hash1(uint seed, out uint hash)
+real hash1(uint seed, out uint hash)
 {
     hash = intHash(seed);
-    return float(hash)/float(0xffffffffU);
+    return real(hash)/real(0xffffffffU);
 }
 
-vec2 compSqr(in vec2 v)
+real2 compSqr(in real2 v)
 {
-    return vec2(v.x*v.x-v.y*v.y, 2.0*v.x*v.y);
+    return real2(v.x*v.x-v.y*v.y, 2.0*v.x*v.y);
 }
 
-bool isInMainCardioid(vec2 v)
+bool isInMainCardioid(real2 v)
 {
     /*
     The condition that a point c is in the main cardioid is that its orbit has
@@ -121,13 +191,13 @@ bool isInMainCardioid(vec2 v)
 
     And long story short, the result is the following few operations.
     */
-    vec2 z = vec2(1.0,0.0)-4.0*v;
-    float zNormSqr = dot(z,z);
-    float rhsSqrt = 0.5*zNormSqr - z.x;
+    real2 z = real2(1.0,0.0)-4.0*v;
+    real zNormSqr = dot(z,z);
+    real rhsSqrt = 0.5*zNormSqr - z.x;
     return rhsSqrt*rhsSqrt<zNormSqr;
 }
 
-bool isInKnownCircle(vec2 v)
+bool isInKnownCircle(real2 v)
 {
     //this checks if the point is in some known circle that's part of the Mandelbrot set.
     //The first cirlce is at -1 with radius of 1/4. That one can be derived analytically:
@@ -164,15 +234,15 @@ bool isInKnownCircle(vec2 v)
     };
     for(int i=0;i < circles.length();++i)
     {
-        vec2 shifted = vec2(v.x,abs(v.y)) - circles[i].center;
-        float sqrRadius = dot(shifted,shifted);
-        if(sqrRadius < circles[i].radius*circles[i].radius)
+        real2 shifted = real2(v.x,abs(v.y)) - real2(circles[i].center);
+        real sqrRadius = dot(shifted,shifted);
+        if(sqrRadius < real(circles[i].radius)*real(circles[i].radius))
             return true;
     }
     return false;
 }
 
-bool isGoingToBeDrawn(in vec2 offset, in uint totalIterations, inout vec2 lastVal, inout uint iterationsLeftThisFrame, inout uint doneIterations, out bool result)
+bool isGoingToBeDrawn(in real2 offset, in uint totalIterations, inout real2 lastVal, inout uint iterationsLeftThisFrame, inout uint doneIterations, out bool result)
 {
     uint endCount = doneIterations + iterationsLeftThisFrame > totalIterations ? totalIterations : doneIterations + iterationsLeftThisFrame;
     for(uint i = doneIterations; i < endCount;++i)
@@ -192,7 +262,7 @@ bool isGoingToBeDrawn(in vec2 offset, in uint totalIterations, inout vec2 lastVa
     return endCount == totalIterations;
 }
 
-bool drawOrbit(in vec2 offset, in uint totalIterations, inout vec2 lastVal, inout uint iterationsLeftThisFrame, inout uint doneIterations)
+bool drawOrbit(in real2 offset, in uint totalIterations, inout real2 lastVal, inout uint iterationsLeftThisFrame, inout uint doneIterations)
 {
     uint endCount = doneIterations + iterationsLeftThisFrame > totalIterations ? totalIterations : doneIterations + iterationsLeftThisFrame;
     for(uint i = doneIterations; i < endCount;++i)
@@ -207,6 +277,7 @@ bool drawOrbit(in vec2 offset, in uint totalIterations, inout vec2 lastVal, inou
         if(lastVal.x > -2.875 && lastVal.x < 1.15 && lastVal.y > -1.15 && lastVal.y < 1.15)
         {
             addToColorAt(lastVal,uvec3(i < orbitLength.r,i < orbitLength.g,i < orbitLength.b));
+            COUNT(COUNTER_HISTOGRAM_WRITES, 1)
         }
     }
     iterationsLeftThisFrame -= (endCount - doneIterations);
@@ -214,46 +285,138 @@ bool drawOrbit(in vec2 offset, in uint totalIterations, inout vec2 lastVal, inou
     return endCount == totalIterations;
 }
 
-vec2 getCurrentOrbitOffset(const uint orbitNumber, const uint totalWorkers, const uint uniqueWorkerID)
+uvec2 add64(uvec2 a, uvec2 b)
+{
+    uint carry;
+    uint low = uaddCarry(a.x, b.x, carry);
+    return uvec2(low, a.y + b.y + carry);
+}
+
+uvec2 mul64(uvec2 a, uint b)
+{
+    uint high, low;
+    umulExtended(a.x, b, high, low);
+    return uvec2(low, a.y * b + high);
+}
+
+bool less64(uvec2 a, uvec2 b)
+{
+    return a.y < b.y || (a.y == b.y && a.x < b.x);
+}
+
+uvec2 min64(uvec2 a, uvec2 b)
+{
+    return less64(a,b) ? a : b;
+}
+
+//Atomic functions need the buffer variable itself, so this cannot be a function with an inout parameter.
+//Every addition that wraps the low word carries exactly once, so the result is exact even with concurrent additions.
+#define ATOMIC_ADD_64(counter, value) { uint previous = atomicAdd(counter.x, value); if(previous + value < previous) atomicAdd(counter.y, 1); }
+
+real2 getSampleOffset(const uvec2 sampleIndex)
+{
+    //The sample space is shared by all shards, every shard takes every shardCount-th sample.
+    uvec2 globalIndex = add64(mul64(sampleIndex, shardCount), uvec2(shardIndex, 0));
+    uint seed = globalIndex.x ^ intHash(globalIndex.y ^ intHash(randomSeed));
+    real x = hash1(seed,seed);
+    seed = (seed ^ (intHash(globalIndex.y + 0x9e3779b9U)));
+    real y = hash1(seed,seed);
+    real2 random = real2(x,y);
+    return real2(random.x * 4.025-2.875,random.y*1.8);
+}
+
+individualData claimWork()
 {
-    uint seed = orbitNumber * totalWorkers + uniqueWorkerID;
-    float x = hash1(seed,seed);
-    seed = (seed ^ (intHash(orbitNumber+totalWorkers)));
-    float y = hash1(seed,seed);
-    vec2 random = vec2(x,y);
-    return vec2(random.x * 4.025-2.875,random.y*1.8);
+    if(nextPendingState < pendingStateCount)
+    {
+        uint pending = atomicAdd(nextPendingState, 1);
+        if(pending < pendingStateCount)
+            return pendingStates[pending];
+    }
+    individualData state;
+    state.phase = 0;
+    state.doneIterations = 0;
+    state.lastPosition = real2(0);
+    if(acceptedOrbitLimit != 0xFFFFFFFFu && acceptedOrbits - acceptedOrbitBase >= acceptedOrbitLimit)
+    {
+        state.sampleIndex = uvec2(0);
+        state.sampleEnd = uvec2(0);
+        state.phase = 3;
+        return state;
+    }
+    uint chunk = atomicAdd(claimedChunks, 1);
+    state.sampleIndex = add64(sampleIndexBase, mul64(uvec2(chunk, 0), samplesPerChunk));
+    if(!less64(state.sampleIndex, sampleLimit))
+    {
+        state.sampleEnd = state.sampleIndex;
+        state.phase = 3;
+        return state;
+    }
+    state.sampleEnd = min64(add64(state.sampleIndex, uvec2(samplesPerChunk, 0)), sampleLimit);
+    return state;
+}
+
+void finishSample(inout individualData state, inout uint finishedThisDispatch)
+{
+    state.sampleIndex = add64(state.sampleIndex, uvec2(1, 0));
+    state.phase = 0;
+    ++finishedThisDispatch;
 }
 
 void main() {
     //we need to know how many total work groups are running this iteration
     const uvec3 totalWorkersPerDimension = gl_WorkGroupSize * gl_NumWorkGroups;
-    const uint totalWorkers = totalWorkersPerDimension.x*totalWorkersPerDimension.y*totalWorkersPerDimension.z;
 
     const uint uniqueWorkerID = gl_GlobalInvocationID.x + gl_GlobalInvocationID.y*totalWorkersPerDimension.x + gl_GlobalInvocationID.z*(totalWorkersPerDimension.x * totalWorkersPerDimension.y);
 
     individualData state = stateArray[uniqueWorkerID];
 
-    //getIndividualState(in uint CellID, out vec2 offset, out vec2 coordinates, out uint phase, out uint orbitNumber, out uint doneIterations)
     uint iterationsLeftToDo = iterationsPerDispatch;
-    vec2 offset = getCurrentOrbitOffset(state.orbitNumber, totalWorkers, uniqueWorkerID);
+    real2 offset = getSampleOffset(state.sampleIndex);
+    uint finishedThisDispatch = 0;
+    uint drawnThisDispatch = 0;
+#ifdef COLLECT_PIPELINE_COUNTERS
+    for(uint i = 0; i < COUNTER_COUNT; ++i)
+        invocationCounters[i] = 0;
+    if(gl_LocalInvocationIndex == 0)
+    {
+        for(uint i = 0; i < COUNTER_COUNT; ++i)
+            groupCounters[i] = uvec2(0);
+    }
+#endif
 
-    while(iterationsLeftToDo != 0)
+    while(iterationsLeftToDo != 0 && state.phase != 3)
     {
+        if(state.phase == 0 && state.sampleIndex == state.sampleEnd)
+        {
+            //all claimed samples are done (or this is the first dispatch).
+            state = claimWork();
+            if(state.phase == 3)
+                break;
+            offset = getSampleOffset(state.sampleIndex);
+        }
         if(state.phase == 0)
         {
             //new orbit:
             //we know that iterationsLeftToDo is at least 1 by the while condition.
             --iterationsLeftToDo; //count this as 1 iteration.
-            offset = getCurrentOrbitOffset(state.orbitNumber, totalWorkers, uniqueWorkerID);
-            if(isInMainCardioid(offset) || isInKnownCircle(offset))
+            offset = getSampleOffset(state.sampleIndex);
+            COUNT(COUNTER_STARTED_SAMPLES, 1)
+            if(isInMainCardioid(offset))
             {
                 // do not waste time drawing this orbit
-                ++state.orbitNumber;
+                COUNT(COUNTER_REJECTED_BY_MAIN_CARDIOID, 1)
+                finishSample(state, finishedThisDispatch);
+            }
+            else if(isInKnownCircle(offset))
+            {
+                COUNT(COUNTER_REJECTED_BY_KNOWN_CIRCLE, 1)
+                finishSample(state, finishedThisDispatch);
             }
             else
             {
                 //cool orbit!
-                state.lastPosition = vec2(0);
+                state.lastPosition = real2(0);
                 state.phase = 1;
                 state.doneIterations = 0;
             }
@@ -262,31 +425,71 @@ void main() {
         {
             //check if this orbit is going to be drawn
             bool result;
-            if(isGoingToBeDrawn(offset,totalIterations, state.lastPosition, iterationsLeftToDo, state.doneIterations , result))
+            const uint iterationsBeforeCheck = iterationsLeftToDo;
+            const bool checkDone = isGoingToBeDrawn(offset,totalIterations, state.lastPosition, iterationsLeftToDo, state.doneIterations , result);
+            COUNT(COUNTER_ESCAPE_CHECK_ITERATIONS, iterationsBeforeCheck - iterationsLeftToDo)
+            if(checkDone)
             {
+                if(result && acceptedOrbitLimit != 0xFFFFFFFFu && atomicAdd(acceptedOrbits, 1) - acceptedOrbitBase >= acceptedOrbitLimit)
+                {
+                    //enough orbits have been accepted by other workers already. The sample range is kept, so a checkpoint can continue it.
+                    state.phase = 3;
+                    break;
+                }
                 if(result)
                 {
                     //on to step 2: drawing
                     state.phase = 2;
-                    state.lastPosition = vec2(0);
+                    state.lastPosition = real2(0);
                     state.doneIterations = 0;
                 }
                 else
                 {
                     //back to step 0
-                    ++state.orbitNumber;
-                    state.phase = 0;
+                    if(dot(state.lastPosition, state.lastPosition) > 4.0)
+                        COUNT(COUNTER_REJECTED_TOO_SHORT, 1)
+                    else
+                        COUNT(COUNTER_REJECTED_NOT_ESCAPING, 1)
+                    finishSample(state, finishedThisDispatch);
                 }
             }
         }
         if(state.phase == 2)
         {
-            if(drawOrbit(offset, totalIterations, state.lastPosition, iterationsLeftToDo, state.doneIterations))
+            const uint iterationsBeforeDraw = iterationsLeftToDo;
+            const bool drawDone = drawOrbit(offset, totalIterations, state.lastPosition, iterationsLeftToDo, state.doneIterations);
+            COUNT(COUNTER_DRAW_ITERATIONS, iterationsBeforeDraw - iterationsLeftToDo)
+            if(drawDone)
             {
-                ++state.orbitNumber;
-                state.phase = 0;
+                COUNT(COUNTER_DRAWN, 1)
+                finishSample(state, finishedThisDispatch);
+                ++drawnThisDispatch;
             }
         }
     }
+    COUNT(COUNTER_IDLE_ITERATIONS, iterationsLeftToDo)
     stateArray[uniqueWorkerID] = state;
+    if(finishedThisDispatch != 0)
+        ATOMIC_ADD_64(finishedSamples, finishedThisDispatch)
+    if(drawnThisDispatch != 0)
+        ATOMIC_ADD_64(drawnOrbits, drawnThisDispatch)
+#ifdef COLLECT_PIPELINE_COUNTERS
+    //Summing up in shared memory first leaves one global atomic per counter and work group. This is outside of all flow control,
+    //as barrier() has to be reached by all invocations of the group.
+    barrier();
+    for(uint i = 0; i < COUNTER_COUNT; ++i)
+    {
+        if(invocationCounters[i] != 0)
+            ATOMIC_ADD_64(groupCounters[i], invocationCounters[i])
+    }
+    barrier();
+    if(gl_LocalInvocationIndex == 0)
+    {
+        for(uint i = 0; i < COUNTER_COUNT; ++i)
+        {
+            ATOMIC_ADD_64(counters[i], groupCounters[i].x)
+            atomicAdd(counters[i].y, groupCounters[i].y);
+        }
+    }
+#endif
 }
@@ -4,26 +4,43 @@ in vec2 uv;
 
 out vec3 color;
 
-layout(std430, binding=2) restrict readonly buffer renderedDataRed
+//The histogram box filtered to the window size by the preview compute shader.
+layout(std430, binding=3) restrict readonly buffer previewData
 {
         restrict readonly uint counts_SSBO[];
 };
 
+struct channelStatistics
+{
+    uint maxCount;
+    uint nonZeroCount;
+    uvec2 sum;
+    uint percentiles[4];
+    uint bins[256];
+};
+
+//Written by the reduction shader from the preview data right before the preview is drawn.
+layout(std430, binding=7) restrict readonly buffer histogramStatistics
+{
+    restrict readonly channelStatistics channels[3];
+};
+
 uniform uint width;
 uniform uint height;
 
 uvec3 getColorAt(vec2 fragCoord)
 {
-    uint xIndex = uint(max(0.0,(fragCoord.x+1.0)*0.5*width));
-    uint yIndex = uint(max(0.0,abs(fragCoord.y)*height));
+    uint xIndex = min(uint(max(0.0,(fragCoord.x+1.0)*0.5*width)), width-1);
+    uint yIndex = min(uint(max(0.0,abs(fragCoord.y)*height)), height-1);
     uint firstIndex = 3*(xIndex + yIndex * width);
     return uvec3(counts_SSBO[firstIndex],counts_SSBO[firstIndex+1],counts_SSBO[firstIndex+2]);
 }
 
 void main(){
     uvec3 totalCount = getColorAt(uv);
-    uvec3 brightness = getColorAt(vec2(-0.245,0));
+    //The brightest pixels are few and far between, so the 99.9th percentile is a more stable white point than the maximum.
+    uint whitePoint = max(max(channels[0].percentiles[3], channels[1].percentiles[3]), channels[2].percentiles[3]);
 
-    vec3 scaled = vec3(totalCount)/max(length(vec3(brightness)),1.0);
+    vec3 scaled = vec3(totalCount)/max(float(whitePoint),1.0);
     color = scaled;
 }
@@ -0,0 +1,54 @@
+//commented out, added by c-code that loads this shader.
+//#version 430
+//layout (local_size_x = 16, local_size_y = 16) in;
+
+//Box filters the histogram down to the size of the preview window, so the fragment shader only reads one small buffer and does not alias
+//when the image is much larger than the window. Like the histogram, the preview only stores the upper half of the image.
+
+layout(std430, binding=2) restrict readonly buffer renderedDataRed
+{
+    restrict readonly uint counts_SSBO[];
+};
+
+layout(std430, binding=3) restrict writeonly buffer previewData
+{
+    restrict writeonly uint previewCounts[];
+};
+
+uniform uvec2 histogramSize;
+uniform uvec2 previewSize;
+//Boxes differ in size by one row or column if the sizes are not multiples of each other. Sums are scaled to the largest box, so they stay comparable.
+uniform float largestBoxArea;
+
+uvec3 saturatingAdd(uvec3 a, uvec3 b)
+{
+    uvec3 carry;
+    uvec3 sum = uaddCarry(a, b, carry);
+    return sum | (uvec3(0) - carry); //a carry of 1 sets all bits.
+}
+
+void main()
+{
+    uvec2 previewPixel = gl_GlobalInvocationID.xy;
+    if(any(greaterThanEqual(previewPixel, previewSize)))
+        return;
+    //if the window is larger than the image, boxes degenerate to a single pixel.
+    uvec2 boxStart = previewPixel * histogramSize / previewSize;
+    uvec2 boxEnd = max((previewPixel + 1) * histogramSize / previewSize, boxStart + 1);
+    uvec3 sum = uvec3(0);
+    for(uint y = boxStart.y; y < boxEnd.y; ++y)
+    {
+        for(uint x = boxStart.x; x < boxEnd.x; ++x)
+        {
+            uint firstIndex = 3*(x + y * histogramSize.x);
+            sum = saturatingAdd(sum, uvec3(counts_SSBO[firstIndex], counts_SSBO[firstIndex+1], counts_SSBO[firstIndex+2]));
+        }
+    }
+    uvec2 boxSize = boxEnd - boxStart;
+    //4294967295.0 rounds up to 2^32 in single precision, which does not convert to uint. This is the largest float below.
+    vec3 scaled = min(vec3(sum) * (largestBoxArea / float(boxSize.x * boxSize.y)), vec3(4294967040.0));
+    uint firstIndex = 3*(previewPixel.x + previewPixel.y * previewSize.x);
+    previewCounts[firstIndex] = uint(scaled.x);
+    previewCounts[firstIndex+1] = uint(scaled.y);
+    previewCounts[firstIndex+2] = uint(scaled.z);
+}
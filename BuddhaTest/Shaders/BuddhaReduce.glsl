@@ -0,0 +1,146 @@
+//commented out, added by c-code that loads this shader.
+//#version 430
+//layout (local_size_x = 256) in; //must match REDUCTION_GROUP_SIZE.
+
+//Condenses the histogram, or the downsampled preview of it, into a few numbers per color channel, so neither the preview nor the export
+//has to look at every pixel on the CPU. Pass 0 accumulates maximum, sum and a coarse histogram of the values, pass 1 reads the
+//percentiles from the latter.
+
+#define REDUCTION_GROUP_SIZE 256
+#define PERCENTILE_COUNT 4
+#define BIN_COUNT 256
+
+//bound by HistogramReduction::Run to whichever buffer is to be reduced. OpenGL 4.3 only guarantees binding points 0 to 7.
+layout(std430, binding=1) restrict readonly buffer reductionInput
+{
+    restrict readonly uint counts_SSBO[];
+};
+
+struct channelStatistics
+{
+    uint maxCount;
+    uint nonZeroCount;
+    uvec2 sum; //64 bit, low word first.
+    uint percentiles[PERCENTILE_COUNT]; //of the non-zero counts.
+    uint bins[BIN_COUNT];
+};
+
+layout(std430, binding=7) restrict buffer histogramStatistics
+{
+    restrict channelStatistics channels[3];
+};
+
+uniform uint pixelCount;
+uniform uint reductionPass;
+
+//Must match Helpers::StatisticsPercentiles.
+const float percentileFractions[PERCENTILE_COUNT] = float[](0.5, 0.9, 0.99, 0.999);
+
+#define ATOMIC_ADD_64(counter, value) { uint previous = atomicAdd(counter.x, value); if(previous + value < previous) atomicAdd(counter.y, 1); }
+
+shared uint groupMax[3];
+shared uint groupNonZero[3];
+shared uvec2 groupSum[3];
+shared uint groupBins[3*BIN_COUNT];
+
+//Values are binned by their most significant bit and the three bits below it, so a bin covers at most 1/8 of its values.
+uint getBin(uint value)
+{
+    uint exponent = uint(findMSB(value));
+    uint mantissa = exponent >= 3 ? (value >> (exponent - 3)) & 7u : (value << (3 - exponent)) & 7u;
+    return exponent * 8 + mantissa;
+}
+
+uint getBinUpperBound(uint bin)
+{
+    uint exponent = bin / 8;
+    uint mantissa = bin % 8;
+    //below 8 every bin holds a single value.
+    if(exponent < 3)
+        return (8 + mantissa) >> (3 - exponent);
+    //the last bin would overflow.
+    if(exponent == 31 && mantissa == 7)
+        return 0xFFFFFFFFU;
+    return ((9 + mantissa) << (exponent - 3)) - 1;
+}
+
+void accumulate()
+{
+    for(uint i = gl_LocalInvocationIndex; i < 3; i += REDUCTION_GROUP_SIZE)
+    {
+        groupMax[i] = 0;
+        groupNonZero[i] = 0;
+        groupSum[i] = uvec2(0);
+    }
+    for(uint i = gl_LocalInvocationIndex; i < 3*BIN_COUNT; i += REDUCTION_GROUP_SIZE)
+        groupBins[i] = 0;
+    barrier();
+
+    uint localMax[3] = uint[](0, 0, 0);
+    uint localNonZero[3] = uint[](0, 0, 0);
+    uvec2 localSum[3] = uvec2[](uvec2(0), uvec2(0), uvec2(0));
+    for(uint pixel = gl_GlobalInvocationID.x; pixel < pixelCount; pixel += gl_NumWorkGroups.x * REDUCTION_GROUP_SIZE)
+    {
+        for(uint channel = 0; channel < 3; ++channel)
+        {
+            uint value = counts_SSBO[3*pixel + channel];
+            if(value == 0)
+                continue;
+            localMax[channel] = max(localMax[channel], value);
+            ++localNonZero[channel];
+            uint carry;
+            localSum[channel].x = uaddCarry(localSum[channel].x, value, carry);
+            localSum[channel].y += carry;
+            atomicAdd(groupBins[channel * BIN_COUNT + getBin(value)], 1);
+        }
+    }
+    for(uint channel = 0; channel < 3; ++channel)
+    {
+        atomicMax(groupMax[channel], localMax[channel]);
+        atomicAdd(groupNonZero[channel], localNonZero[channel]);
+        ATOMIC_ADD_64(groupSum[channel], localSum[channel].x)
+        atomicAdd(groupSum[channel].y, localSum[channel].y);
+    }
+    barrier();
+
+    //one global atomic per group and value instead of one per pixel.
+    for(uint i = gl_LocalInvocationIndex; i < 3*BIN_COUNT; i += REDUCTION_GROUP_SIZE)
+    {
+        if(groupBins[i] != 0)
+            atomicAdd(channels[i / BIN_COUNT].bins[i % BIN_COUNT], groupBins[i]);
+    }
+    if(gl_LocalInvocationIndex < 3)
+    {
+        uint channel = gl_LocalInvocationIndex;
+        atomicMax(channels[channel].maxCount, groupMax[channel]);
+        atomicAdd(channels[channel].nonZeroCount, groupNonZero[channel]);
+        ATOMIC_ADD_64(channels[channel].sum, groupSum[channel].x)
+        atomicAdd(channels[channel].sum.y, groupSum[channel].y);
+    }
+}
+
+void findPercentiles()
+{
+    if(gl_GlobalInvocationID.x >= 3)
+        return;
+    uint channel = gl_GlobalInvocationID.x;
+    uint nonZero = channels[channel].nonZeroCount;
+    uint seen = 0;
+    uint bin = 0;
+    for(uint percentile = 0; percentile < PERCENTILE_COUNT; ++percentile)
+    {
+        //the percentile lies in the first bin that reaches this many values.
+        uint needed = uint(ceil(percentileFractions[percentile] * float(nonZero)));
+        while(bin < BIN_COUNT && seen + channels[channel].bins[bin] < needed)
+            seen += channels[channel].bins[bin++];
+        channels[channel].percentiles[percentile] = nonZero == 0 ? 0 : min(getBinUpperBound(min(bin, BIN_COUNT - 1)), channels[channel].maxCount);
+    }
+}
+
+void main()
+{
+    if(reductionPass == 0)
+        accumulate();
+    else
+        findPercentiles();
+}
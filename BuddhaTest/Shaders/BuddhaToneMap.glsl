@@ -0,0 +1,84 @@
+//commented out, added by c-code that loads this shader.
+//#version 430
+//layout (local_size_x = 256) in; //must match TONEMAP_GROUP_SIZE.
+
+//Turns the histogram into the finished RGB image, so only that needs to be read back for a png. The lower half of the image
+//is mirrored from the histogram, rows are stored top to bottom and tightly packed, like libpng expects them.
+//Every invocation writes one word, which holds four 8 bit or two 16 bit samples. Words are filled starting at their lowest byte.
+
+#define TONEMAP_GROUP_SIZE 256
+
+layout(std430, binding=2) restrict readonly buffer renderedDataRed
+{
+    restrict readonly uint counts_SSBO[];
+};
+
+struct channelStatistics
+{
+    uint maxCount;
+    uint nonZeroCount;
+    uvec2 sum;
+    uint percentiles[4];
+    uint bins[256];
+};
+
+//Written by the reduction shader, which has to run first.
+layout(std430, binding=7) restrict readonly buffer histogramStatistics
+{
+    restrict readonly channelStatistics channels[3];
+};
+
+layout(std430, binding=0) restrict writeonly buffer toneMappedImage
+{
+    restrict writeonly uint packedImage[];
+};
+
+uniform uint width;
+uniform uint height; //of the histogram, so half the image height.
+uniform uint bitDepth;
+uniform double gamma;
+uniform double colorScale;
+
+//Must give the same results as Helpers::ToneMap. For gamma != 1 the power is only computed in single precision, so the last bit may differ.
+uint toneMap(uint value, uint maxValue, uint maxOutput)
+{
+    if(abs(gamma - 1.0lf) > 0.0001lf || abs(colorScale - 1.0lf) > 0.0001lf)
+    {
+        double scaled = min(1.0lf, colorScale * double(value) / double(maxValue));
+        if(gamma != 1.0lf)
+            scaled = double(pow(float(scaled), float(gamma)));
+        return uint(double(maxOutput) * scaled);
+    }
+    return uint(floor((double(maxOutput) * double(value) + double(maxValue / 2)) / double(maxValue)));
+}
+
+uint getSample(uint sampleIndex, uint maxValue, uint maxOutput)
+{
+    uint imageRow = sampleIndex / (3 * width);
+    uint histogramRow = imageRow < height ? height - imageRow - 1 : imageRow - height;
+    return toneMap(counts_SSBO[3 * width * histogramRow + sampleIndex % (3 * width)], maxValue, maxOutput);
+}
+
+void main()
+{
+    uint maxValue = max(max(max(channels[0].maxCount, channels[1].maxCount), channels[2].maxCount), 1);
+    uint sampleCount = 3 * width * 2 * height;
+    uint samplesPerWord = 32 / bitDepth;
+    uint wordCount = (sampleCount + samplesPerWord - 1) / samplesPerWord;
+    uint maxOutput = (1u << bitDepth) - 1;
+    for(uint word = gl_GlobalInvocationID.x; word < wordCount; word += gl_NumWorkGroups.x * TONEMAP_GROUP_SIZE)
+    {
+        uint packedSamples = 0;
+        for(uint i = 0; i < samplesPerWord; ++i)
+        {
+            uint sampleIndex = word * samplesPerWord + i;
+            if(sampleIndex >= sampleCount)
+                break;
+            uint value = getSample(sampleIndex, maxValue, maxOutput);
+            if(bitDepth == 16)
+                value = (value >> 8) | ((value & 0xFF) << 8); //png wants big endian samples.
+            packedSamples |= value << (i * bitDepth);
+        }
+        packedImage[word] = packedSamples;
+    }
+}
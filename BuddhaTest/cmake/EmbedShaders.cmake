@@ -0,0 +1,28 @@
+# Writes the GLSL files in SHADER_DIR into the C++ source file OUTPUT, as the EmbeddedShaders table declared in EmbeddedShaders.h.
+# Run at build time: cmake -DSHADER_DIR=... -DOUTPUT=... -P EmbedShaders.cmake
+
+file(GLOB SHADER_FILES "${SHADER_DIR}/*.glsl")
+# MSVC limits the length of a single string literal, so long sources are split into several adjacent ones.
+set(CHUNK_LENGTH 8000)
+
+file(WRITE "${OUTPUT}.tmp" "//Generated by EmbedShaders.cmake from the files in Shaders. Do not edit.\n#include \"EmbeddedShaders.h\"\n\nnamespace Helpers\n{\n    const EmbeddedShader EmbeddedShaders[] = {\n")
+set(SHADER_COUNT 0)
+foreach(SHADER_FILE ${SHADER_FILES})
+    get_filename_component(SHADER_NAME "${SHADER_FILE}" NAME)
+    file(READ "${SHADER_FILE}" SHADER_SOURCE)
+    string(LENGTH "${SHADER_SOURCE}" SHADER_LENGTH)
+    file(APPEND "${OUTPUT}.tmp" "        {\"${SHADER_NAME}\",\n")
+    set(OFFSET 0)
+    while(OFFSET LESS SHADER_LENGTH)
+        string(SUBSTRING "${SHADER_SOURCE}" ${OFFSET} ${CHUNK_LENGTH} CHUNK)
+        file(APPEND "${OUTPUT}.tmp" "R\"BUDDHA_GLSL(${CHUNK})BUDDHA_GLSL\"\n")
+        math(EXPR OFFSET "${OFFSET} + ${CHUNK_LENGTH}")
+    endwhile()
+    file(APPEND "${OUTPUT}.tmp" "        },\n")
+    math(EXPR SHADER_COUNT "${SHADER_COUNT} + 1")
+endforeach()
+file(APPEND "${OUTPUT}.tmp" "    };\n    const unsigned int EmbeddedShaderCount = ${SHADER_COUNT};\n}\n")
+
+# only touch the output if it changed, so unrelated builds do not recompile it.
+execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different "${OUTPUT}.tmp" "${OUTPUT}")
+file(REMOVE "${OUTPUT}.tmp")
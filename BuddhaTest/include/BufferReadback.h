@@ -0,0 +1,42 @@
+#pragma once
+#include <glad/glad.h>
+#include <chrono>
+
+namespace Helpers
+{
+    /** Reads back the contents of a buffer without waiting for the GPU. Start() queues a copy into a staging buffer and a fence,
+        TryFinish() checks the fence and only touches the data once the copy has completed. At most one readback is in flight.
+        If GL_ARB_buffer_storage is available, the staging buffer stays persistently mapped, so finishing is a plain memcpy without
+        going through the driver. */
+    class AsyncBufferReadback
+    {
+    public:
+        AsyncBufferReadback() = default;
+        ~AsyncBufferReadback();
+        AsyncBufferReadback(const AsyncBufferReadback&) = delete;
+        AsyncBufferReadback& operator=(const AsyncBufferReadback&) = delete;
+
+        /** Queues a copy of size bytes of sourceBuffer, starting at offset. Returns false if a previous readback has not been finished yet. */
+        bool Start(GLuint sourceBuffer, GLsizeiptr size, GLintptr offset = 0);
+        bool IsPending() const;
+        /** If the copy has completed, writes it to target (which must hold the size passed to Start()) and returns true. Never blocks. */
+        bool TryFinish(void * target);
+        /** Waits for the copy to complete and writes it to target. For when the data is needed right away, for instance on exit. */
+        void Finish(void * target);
+
+        /** How long a synchronous read started at the same time as the last finished readback would at least have blocked: the time
+            from Start() until the last TryFinish() that found the copy still running. */
+        std::chrono::microseconds GetLastAvoidedStall() const;
+    private:
+        void ReadStagingBuffer(void * target);
+
+        GLuint stagingBuffer{0};
+        GLsizeiptr stagingSize{0};
+        GLsizeiptr pendingSize{0};
+        GLsync fence{nullptr};
+        void * mappedStagingBuffer{nullptr};
+        std::chrono::steady_clock::time_point startTime;
+        std::chrono::steady_clock::time_point lastPendingPoll;
+        std::chrono::microseconds lastAvoidedStall{0};
+    };
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <glad/glad.h>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace Helpers
+{
+    /** GPU time of one timed compute dispatch, together with what the ThroughputModel predicted for it. */
+    struct DispatchMeasurement
+    {
+        uint32_t iterations;
+        double predictedNanoseconds; //0 if there was no prediction yet.
+        double measuredNanoseconds;
+    };
+
+    /** Measures compute dispatches with GL_TIME_ELAPSED queries. Results are collected a few frames later, once the GPU has them,
+        so measuring never waits for the GPU. If all queries are still in flight, a dispatch simply stays unmeasured. */
+    class DispatchTimer
+    {
+    public:
+        explicit DispatchTimer(unsigned int maxQueriesInFlight = 4);
+        ~DispatchTimer();
+        DispatchTimer(const DispatchTimer&) = delete;
+        DispatchTimer& operator=(const DispatchTimer&) = delete;
+
+        /** Call right before the dispatch. Returns false if no query is available, in which case End() must not be called. */
+        bool Begin();
+        void End(uint32_t iterations, double predictedNanoseconds);
+        /** Returns the oldest measurement if the GPU has finished it. Never blocks. */
+        bool TryGetResult(DispatchMeasurement& result);
+    private:
+        struct PendingQuery
+        {
+            GLuint query;
+            DispatchMeasurement measurement;
+        };
+        std::vector<GLuint> freeQueries;
+        std::deque<PendingQuery> pendingQueries;
+        std::vector<GLuint> allQueries;
+    };
+
+    /** Models the GPU time of a dispatch as overhead + iterations * timePerIteration. Both are fitted by least squares over the
+        measurements, with older ones fading out, so the model follows changes in throughput (for instance orbits getting longer). */
+    class ThroughputModel
+    {
+    public:
+        void AddMeasurement(uint32_t iterations, double nanoseconds);
+        bool HasEstimate() const;
+        double PredictNanoseconds(uint32_t iterations) const;
+        /** Number of iterations per dispatch expected to take the given time. Grows at most by a factor of 2 relative to the current value,
+            so a bad estimate cannot cause a dispatch long enough to trigger the driver's watchdog. */
+        uint32_t IterationsFor(double nanoseconds, uint32_t currentIterations) const;
+    private:
+        void GetCoefficients(double& overhead, double& timePerIteration) const;
+
+        double weightSum{0.0};
+        double iterationSum{0.0};
+        double timeSum{0.0};
+        double iterationSquaredSum{0.0};
+        double iterationTimeSum{0.0};
+    };
+}
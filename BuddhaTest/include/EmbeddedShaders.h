@@ -0,0 +1,14 @@
+#pragma once
+
+namespace Helpers
+{
+    struct EmbeddedShader
+    {
+        const char * name;
+        const char * source;
+    };
+
+    /** The files in Shaders, compiled into the executable by cmake/EmbedShaders.cmake, so no shader needs to be found at runtime. */
+    extern const EmbeddedShader EmbeddedShaders[];
+    extern const unsigned int EmbeddedShaderCount;
+}
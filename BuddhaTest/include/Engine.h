@@ -0,0 +1,61 @@
+#pragma once
+#include "Helpers.h"
+#include "PipelineCounters.h"
+#include <memory>
+#include <string>
+#include <cstdint>
+
+namespace Helpers
+{
+    /** Read access to the histogram of an engine, without copying it where the engine can avoid that: three counts per cell (red, green, blue), cells row by row. Only the upper
+        half of the image is stored, the lower half is its mirror image. Valid until the engine is configured or run again, or destroyed. counts is null if the histogram
+        could not be read. */
+    struct HistogramView
+    {
+        const uint32_t * counts;
+        unsigned int width;
+        unsigned int bufferHeight;
+    };
+
+    struct EngineProgress
+    {
+        uint64_t samples;
+        uint64_t acceptedOrbits;
+        uint64_t iterations;
+        //points added to the histogram, each counting towards up to three colors. The GL engine only counts these if settings.pipelineCountersFilename is set, else it reports 0.
+        uint64_t histogramWrites;
+    };
+
+    /** Renders a buddhabrot sample by sample. The sample sequence only depends on seed and shard, so every engine draws the same orbits,
+        and a render split into several RunSamples() calls gives the same histogram as one call with the sum. Up to rounding differences
+        of the respective hardware the engines give the same result. */
+    class Engine
+    {
+    public:
+        virtual ~Engine() = default;
+
+        /** Starts a new render with an empty histogram. Image size, orbit lengths, precision, seed and shard are taken from the settings, the GL engine
+            also uses the work group sizes. Budgets, outputs and everything else concerning the frontend are up to the caller. */
+        virtual bool Configure(const RenderSettings& settings) = 0;
+        /** Draws the next sampleCount samples, and returns once they are done. */
+        virtual bool RunSamples(uint64_t sampleCount) = 0;
+        virtual EngineProgress GetProgress() const = 0;
+        /** Totals since Configure() of where the work went. Returns false if the engine does not count them. */
+        virtual bool GetPipelineCounters(PipelineCounters& counters) const;
+        virtual HistogramView Snapshot() = 0;
+
+        /** Writes the histogram to settings.histogramFilename and/or the image to settings.pngFilename of the configured settings.
+            Returns false if one of them could not be written. */
+        bool Export();
+    protected:
+        RenderSettings settings;
+    };
+
+    /** Renders with the compute shader, see GlEngine. Needs a current OpenGL 4.3 context for its whole lifetime. */
+    std::unique_ptr<Engine> CreateGlEngine();
+    /** Renders on threadCount threads of the CPU, or on as many as there are cores if it is 0. Also supports settings.exponent other than 2,
+        and settings.precision doubledouble. */
+    std::unique_ptr<Engine> CreateCpuEngine(unsigned int threadCount);
+    /** "gl" or "cpu". Returns null for other names. */
+    std::unique_ptr<Engine> CreateEngine(const std::string& name, unsigned int threadCount);
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include "Engine.h"
+#include "HistogramReduction.h"
+#include "GpuToneMapper.h"
+#include "PreviewDownsampler.h"
+#include <glad/glad.h>
+#include <map>
+#include <memory>
+#include <string>
+
+namespace Helpers
+{
+    /** A shader storage buffer that is only reallocated if a render needs more space than all earlier ones did. */
+    class ReusableBuffer
+    {
+    public:
+        ReusableBuffer() = default;
+        ~ReusableBuffer();
+        ReusableBuffer(const ReusableBuffer&) = delete;
+        ReusableBuffer& operator=(const ReusableBuffer&) = delete;
+
+        /** Returns the buffer, grown to at least size bytes. Its content is undefined. */
+        GLuint Reserve(GLsizeiptr size);
+        GLuint Get() const;
+    private:
+        GLuint buffer{0};
+        GLsizeiptr capacity{0};
+    };
+
+    /** Renders with the compute shader. Needs a current OpenGL 4.3 context for its whole lifetime. Programs and buffers are kept from one
+        render to the next, so the jobs of a --batch or --daemon only pay for them once.
+        Besides running a number of samples synchronously, a render can be driven one dispatch at a time, which is how BuddhaShader renders:
+        Step() until it returns false or the caller wants to stop, DrawPreview() whenever a window should show the progress, then Finish().
+        That way the GPU never waits for the CPU, and the budgets, --targetNoise, checkpoints, snapshots, outputs and --benchmark of the
+        settings are taken care of. */
+    class GlEngine : public Engine
+    {
+    public:
+        /** withPreview also loads the shaders that draw the preview, which needs a context with a window. */
+        explicit GlEngine(bool withPreview = false);
+        ~GlEngine() override;
+        GlEngine(const GlEngine&) = delete;
+        GlEngine& operator=(const GlEngine&) = delete;
+
+        /** Loads the shaders that every render uses. Configure() does this if it has not been done yet. */
+        bool Init(const RenderSettings& settings);
+
+        /** Also continues from settings.resumeFilename, if it is set. */
+        bool Configure(const RenderSettings& settings) override;
+        /** After resuming, the first call also finishes the samples the checkpoint left unfinished, even where those are more than sampleCount. */
+        bool RunSamples(uint64_t sampleCount) override;
+        /** While driven by Step() these are the counters read back last, which lag a frame or two behind. */
+        EngineProgress GetProgress() const override;
+        /** Only counted if settings.pipelineCountersFilename is set, as counting costs throughput. With --benchmarkWarmup, Step() restarts them once it is over. */
+        bool GetPipelineCounters(PipelineCounters& counters) const override;
+        HistogramView Snapshot() override;
+
+        /** Takes care of whatever the previous dispatch and the readbacks brought, and unless the render is done, dispatches the next iterations,
+            as many as fit into the target dispatch time. Waits for the GPU only to keep at most two dispatches in flight. Returns false once
+            a budget is used up, --targetNoise is reached or the --benchmark time is over. */
+        bool Step();
+        /** Draws the histogram, downsampled to the framebuffer size, into the current framebuffer. Needs withPreview. */
+        void DrawPreview(unsigned int framebufferWidth, unsigned int framebufferHeight);
+        /** Ends a render driven by Step(): waits for the GPU, writes the outputs and the final checkpoint, pipeline counters and --benchmark results.
+            Returns false if the png, the histogram or the checkpoint could not be written. */
+        bool Finish();
+    private:
+        struct RenderState;
+
+        GLuint GetComputeProgram(const std::string& preamble);
+        void Dispatch();
+        void MeasureDispatch();
+        void UpdateReadbacks();
+        bool IsDone() const;
+        void RebaseAcceptedOrbitLimit();
+        void ReportPipelineCounters(double seconds);
+        void Unmap();
+
+        const bool withPreview;
+        bool initialized{false};
+        std::map<std::string, GLuint> computePrograms;
+        GLuint computeProgram{0};
+
+        //max, sum and percentiles of the histogram, for the preview's white point and for the export.
+        HistogramReduction histogramReduction;
+        GpuToneMapper toneMapper;
+        //The preview is box filtered to the window size first, and gets its own statistics of that.
+        PreviewDownsampler previewDownsampler;
+        HistogramReduction previewReduction;
+        GLuint vertexAndFragmentShaders{0};
+        GLint previewWidthHandle{-1};
+        GLint previewHeightHandle{-1};
+        GLuint vertexArray{0};
+        GLuint vertexBuffer{0};
+
+        ReusableBuffer drawBuffer;
+        ReusableBuffer stateBuffer;
+        ReusableBuffer sampleQueueBuffer;
+        ReusableBuffer pipelineCountersBuffer;
+        const uint32_t * mappedCounts{nullptr};
+
+        //everything that only lives as long as one render.
+        std::unique_ptr<RenderState> render;
+    };
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <glad/glad.h>
+#include <cstdint>
+#include <string>
+
+namespace Helpers
+{
+    /** Tone maps the histogram into a packed 8 or 16 bit RGB image on the GPU, so a png export reads back the finished image instead
+        of the raw counts, and the CPU does not have to touch every count. The image is normalized by the maximum that HistogramReduction
+        found, so the reduction has to run right before. */
+    class GpuToneMapper
+    {
+    public:
+        GpuToneMapper() = default;
+        ~GpuToneMapper();
+        GpuToneMapper(const GpuToneMapper&) = delete;
+        GpuToneMapper& operator=(const GpuToneMapper&) = delete;
+
+        /** Loads the shader. The histogram is read from binding point 2, the statistics from binding point 7. The image buffer only gets
+            its storage on the first Run(), so renders that never export a png do not pay for it. */
+        bool Init(const std::string& shaderName, unsigned int width, unsigned int bufferHeight, unsigned int bitDepth);
+        /** Switches to another histogram size or bit depth. The image buffer only grows, once Run() needs more. */
+        void Resize(unsigned int width, unsigned int bufferHeight, unsigned int bitDepth);
+        void Run(double gamma, double colorScale);
+        GLuint GetBuffer() const;
+        /** Size of the image in bytes, without the padding at the end of the buffer. */
+        size_t GetImageSize() const;
+    private:
+        GLuint program{0};
+        GLuint imageBuffer{0};
+        GLint gammaHandle{-1};
+        GLint colorScaleHandle{-1};
+        size_t imageSize{0};
+        size_t bufferCapacity{0};
+        GLuint groupCount{1};
+    };
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <glad/glad.h>
+
+namespace Helpers
+{
+    /** An OpenGL 4.3 core context without any window, created through EGL. Tries Mesa's surfaceless platform first (which also covers
+        software rendering), then the first EGL device, then the default display. If the display cannot make a context current without
+        a surface, a 1x1 pbuffer is used. Only available if the build found EGL, otherwise Create() fails. */
+    class HeadlessContext
+    {
+    public:
+        HeadlessContext() = default;
+        ~HeadlessContext();
+        HeadlessContext(const HeadlessContext&) = delete;
+        HeadlessContext& operator=(const HeadlessContext&) = delete;
+
+        /** Creates the context and makes it current on the calling thread. */
+        bool Create();
+        /** Suitable for gladLoadGLLoader. */
+        static void * GetProcAddress(const char * name);
+    private:
+        void * display{nullptr};
+        void * context{nullptr};
+        void * surface{nullptr};
+    };
+}
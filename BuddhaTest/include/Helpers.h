@@ -1,20 +1,49 @@
 #pragma once
 #include <glad/glad.h>
-#include <GLFW/glfw3.h>
 #include <vector>
 #include <stdio.h> //includes FILE typedef
 #include <string>
+#include <cstdint>
 
 namespace Helpers
 {
-    GLuint LoadShaders(const std::string &vertex_file_path, const std::string &fragment_file_path);
-    GLuint LoadComputeShader(const std::string &compute_file_path, unsigned int localSizeX, unsigned int localSizeY, unsigned int localSizeZ);
-
-    bool DoesFileExist(const std::string& path);
-
-    void WriteOutputPNG(const std::string& path, const std::vector<uint32_t>& data, unsigned int width, unsigned int bufferHeight, double gamma, double colorScale);
-
-    void PrintBenchmarkScore(const std::vector<uint32_t>& data);
+    /** Shaders are referred to by their file name in Shaders, for instance BuddhaCompute.glsl. */
+    GLuint LoadShaders(const std::string &vertex_shader_name, const std::string &fragment_shader_name);
+    /** preamble is inserted between the version and layout declarations and the shader source, for instance to add #defines. */
+    GLuint LoadComputeShader(const std::string &compute_shader_name, unsigned int localSizeX, unsigned int localSizeY, unsigned int localSizeZ, const std::string &preamble = "");
+
+    struct RenderSettings;
+    /** Defines width, height, orbitLength and totalIterations of the compute shader as constants, to be passed as preamble to LoadComputeShader.
+        Every combination is a program of its own, which the program cache stores separately. */
+    std::string GetRenderConstantsPreamble(const RenderSettings& settings);
+    /** Makes the compute shader iterate in double precision if settings.precision asks for it, to be passed as preamble to LoadComputeShader. Empty otherwise. */
+    std::string GetPrecisionPreamble(const RenderSettings& settings);
+    /** Bytes per entry of the compute shader's state buffer. Only the single precision layout is mirrored by WorkerState. */
+    size_t GetWorkerStateSize(const RenderSettings& settings);
+
+    /** Makes GetShaderSource read the shaders from the files in this directory instead of using the ones embedded at build time. Empty restores the latter. */
+    void SetShaderDirectory(const std::string& directory);
+    bool GetShaderSource(const std::string& name, std::string& source);
+
+    /** Quotes a command line argument for std::system, so it is passed on unchanged. */
+    std::string QuoteShellArgument(const std::string& argument);
+    /** Runs a command line made of QuoteShellArgument()ed parts through the shell and waits for it. Returns the exit status of the
+        command, the plain result of std::system on Windows, and -1 if no shell could be started. */
+    int RunChildProcess(const std::string& command);
+
+    /** Moves temporaryPath over path, replacing an existing file in one step, so readers see either the old or the new file. Returns false on failure. */
+    bool ReplaceFile(const std::string& temporaryPath, const std::string& path);
+
+    /** Writes an image that has already been tone mapped, for instance by GpuToneMapper. Rows are stored top to bottom, 16 bit samples big endian. */
+    bool WritePackedPNG(const std::string& path, const std::vector<uint8_t>& image, unsigned int width, unsigned int height, unsigned int bitDepth);
+    /** Tone maps a histogram in memory (the upper half of the image, 3 counts per pixel) on the CPU and writes it as png. */
+    bool WriteHistogramPNG(const std::string& path, const uint32_t * counts, unsigned int width, unsigned int bufferHeight, double gamma, double colorScale, unsigned int bitDepth);
+    /** Streams a histogram file into a png, so the histogram does not need to fit into memory. If maxValue is 0 it is determined with an additional pass over the file. */
+    bool WriteOutputPNG(const std::string& path, const std::string& histogramPath, uint64_t maxValue, double gamma, double colorScale, unsigned int bitDepth);
+
+    /** Estimates the relative RMS noise of the current histogram from how much it changed since an earlier snapshot of the same render.
+        The result is the one of the noisiest color channel. Returns infinity if nothing was added in between. */
+    double EstimateRelativeNoise(const std::vector<uint32_t>& previous, const std::vector<uint32_t>& current);
 
     /** Wraps around a C file descriptor. Libpng could be taught to use C++ streams, but I'm too lazy and rather wrap this ugly thing up, so it gets cleaned... */
     class ScopedCFileDescriptor
@@ -50,41 +79,72 @@ namespace Helpers
         unsigned int globalWorkGroupSizeZ = 1;
 
         unsigned int targetFrameRate = 60;
+        unsigned int previewRate = 10;
+        double targetDispatchTime = 0.0;
+        std::string dispatchLogFilename = "";
+
+        unsigned int headless = 0;
 
         std::string pngFilename = "";
         double pngGamma = 1.0;
         double pngColorScale = 2.0;
+        unsigned int pngBitDepth = 8;
 
         unsigned int ignoreMaxBufferSize = 0;
         unsigned int printDebugOutput = 0;
 
         unsigned int benchmarkTime = 0;
+        unsigned int benchmarkWarmup = 0;
+        std::string benchmarkOutputFilename = "";
 
-        bool CheckValidity();
-        bool ParseCommandLine(int argc, char * argv[]);
-    };
+        double targetNoise = 0.0;
+        unsigned int noiseCheckInterval = 10;
 
-    template<typename ValueType, typename TimeType>
-    class PIDController
-    {
-    public:
-        PIDController(ValueType prop, ValueType diff, ValueType integral) : propFactor(prop), diffFactor(diff), intFactor(integral) {}
+        uint64_t sampleBudget = 0;
+        uint64_t acceptedOrbitBudget = 0;
 
-        ValueType Update(TimeType dT, ValueType Error)
-        {
-            errorSum += Error * dT;
-            const auto differential{(Error - lastError)/dT};
-            lastError = Error;
-            return Error * propFactor + errorSum * intFactor + differential * diffFactor;
-        }
+        std::string shard = "";
+        unsigned int shardIndex = 0;
+        unsigned int shardCount = 1;
+        unsigned int localShards = 0;
+        unsigned int randomSeed = 0;
 
-    protected:
-        ValueType propFactor{};
-        ValueType diffFactor{};
-        ValueType intFactor{};
+        std::string histogramFilename = "";
 
-    private:
-        ValueType errorSum{};
-        ValueType lastError{};
+        std::string checkpointFilename = "";
+        unsigned int checkpointInterval = 600;
+        std::string resumeFilename = "";
+
+        unsigned int snapshotInterval = 0;
+
+        std::string pipelineCountersFilename = "";
+
+        unsigned int autotuneTime = 0;
+        std::string workgroupCacheFilename = "";
+        /** Set if the command line contains any of the work group sizes. Otherwise the ones found by --autotune are used. */
+        bool workgroupSizesGiven = false;
+
+        unsigned int specializeShader = 1;
+        std::string shaderDirectory = "";
+
+        unsigned int programCache = 1;
+        std::string programCacheDirectory = "";
+
+        std::string batchFilename = "";
+        std::string daemonSocket = "";
+        unsigned int daemonQueueLimit = 16;
+
+        std::string engine = "";
+        unsigned int threadCount = 0;
+        unsigned int exponent = 2;
+        std::string precision = "float";
+        std::string cpuKernel = "specialized";
+
+        bool CheckValidity();
+        bool ParseCommandLine(int argc, char * argv[]);
+
+        /** The budgets apply to all shards together. These return the part of them this shard has to render. Only meaningful if the respective budget is not 0. */
+        uint64_t GetShardSampleBudget() const;
+        uint64_t GetShardAcceptedOrbitBudget() const;
     };
 }
@@ -0,0 +1,141 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <fstream>
+
+namespace Helpers
+{
+    /** The part of the complex plane covered by the histogram. The compute and fragment shaders have these values hard-coded. */
+    const double ViewportRealMin = -2.875;
+    const double ViewportRealMax = 1.15;
+    const double ViewportImagMax = 1.15;
+
+    /** Mirrors struct individualData in the compute shader (std430 layout). The shader stores 64 bit values as uvec2 with the low word first. */
+    struct WorkerState
+    {
+        uint32_t phase;
+        uint32_t doneIterations;
+        uint64_t sampleIndex;
+        uint64_t sampleEnd;
+        float lastPositionX;
+        float lastPositionY;
+    };
+    static_assert(sizeof(WorkerState) == 32, "WorkerState must match the std430 layout of individualData");
+
+    /** Mirrors the fixed part of the sampleQueue buffer in the compute shader. The pending WorkerStates follow directly. */
+    struct SampleQueueHeader
+    {
+        uint32_t claimedChunks;
+        uint32_t nextPendingState;
+        uint32_t pendingStateCount;
+        uint32_t acceptedOrbits; //low word of the number of orbits that passed the escape check, including ones that are still being drawn.
+        uint64_t finishedSamples;
+        uint64_t drawnOrbits;
+    };
+    static_assert(sizeof(SampleQueueHeader) == 32, "SampleQueueHeader must match the std430 layout of sampleQueue");
+
+    /** Fixed size header at the start of every histogram file. All values are stored in host byte order. */
+    struct HistogramFileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t bytesPerCount;
+        uint32_t width;
+        uint32_t bufferHeight;
+        uint32_t orbitLengthSkip;
+        uint32_t orbitLengthRed;
+        uint32_t orbitLengthGreen;
+        uint32_t orbitLengthBlue;
+        uint32_t workerCount; //number of WorkerState entries following the histogram. 0 if this is not a checkpoint.
+        uint32_t shardIndex;
+        uint32_t shardCount; //1 if the whole sample space was rendered, 0 for merged histograms.
+        uint32_t randomSeed;
+        uint32_t exponent; //of z = z^exponent + c
+        uint32_t precision; //of the orbits: 0 for float, 1 for double, 2 for doubledouble
+        double viewportRealMin;
+        double viewportRealMax;
+        double viewportImagMax;
+        uint64_t sampleCount; //number of candidate orbits that have been fully processed
+        uint64_t iterationCount; //number of iterations dispatched, summed over all workers
+        uint64_t claimedSampleCount; //samples with a lower index have been handed out to workers. Unfinished ones are in the worker states.
+        uint64_t acceptedOrbitCount; //number of orbits that have been drawn completely
+    };
+    static_assert(sizeof(HistogramFileHeader) == 120, "HistogramFileHeader must not contain implicit padding");
+
+    /** A histogram (only the upper half of the image, 3 counts per pixel) and optionally the worker states needed to continue rendering it. */
+    struct HistogramFile
+    {
+        HistogramFileHeader header;
+        std::vector<uint32_t> counts;
+        std::vector<WorkerState> workerStates;
+    };
+
+    HistogramFileHeader MakeHistogramFileHeader(unsigned int width, unsigned int bufferHeight, unsigned int orbitLengthSkip, unsigned int orbitLengthRed, unsigned int orbitLengthGreen, unsigned int orbitLengthBlue, unsigned int shardIndex, unsigned int shardCount, unsigned int randomSeed, unsigned int exponent, const std::string& precision);
+
+    bool WriteHistogramFile(const std::string& path, const HistogramFile& file, bool withWorkerStates = true);
+    /** Reads a complete histogram file into memory. Only 32 bit counts are supported, as this is what the GPU renders. */
+    bool ReadHistogramFile(const std::string& path, HistogramFile& file);
+
+    /** Random access to the counts of a histogram file without loading it into memory. Supports 32 and 64 bit counts. */
+    class HistogramFileReader
+    {
+    public:
+        bool Open(const std::string& path);
+        const HistogramFileHeader& GetHeader() const;
+        uint64_t GetCountNumber() const;
+        bool ReadCounts(uint64_t firstCount, size_t countNumber, uint64_t * target);
+    private:
+        std::string path;
+        std::ifstream stream;
+        HistogramFileHeader header{};
+        std::vector<char> readBuffer;
+    };
+
+    /** Sums up any number of histogram files with matching image size, viewport, orbit lengths, exponent and precision into a file with 64 bit counts.
+        Works on chunks in parallel, so the inputs do not need to fit into memory. Sample and iteration counts of the inputs are added up as well.
+        The result is written next to outputPath and only replaces it when complete, outputPath must not be one of the inputs.
+        On success maxValue contains the largest count in the result. */
+    bool MergeHistogramFiles(const std::vector<std::string>& inputPaths, const std::string& outputPath, unsigned int threadCount, uint64_t& maxValue);
+
+    /** Writes histogram files, and optionally the png made from them, on a background thread. At most one write is in flight; Submit waits
+        for the previous write to finish, so callers that must not block check IsBusy() first. Files are first written to a temporary name and then renamed, so an interrupted
+        write never destroys the previous checkpoint or snapshot. */
+    class AsyncHistogramWriter
+    {
+    public:
+        AsyncHistogramWriter();
+        ~AsyncHistogramWriter();
+        AsyncHistogramWriter(const AsyncHistogramWriter&) = delete;
+        AsyncHistogramWriter& operator=(const AsyncHistogramWriter&) = delete;
+
+        bool IsBusy();
+        /** Writes the histogram including the worker states to path. */
+        void Submit(const std::string& path, HistogramFile&& file);
+        /** Writes the histogram without worker states to histogramPath and/or the already tone mapped image to a png at pngPath. Empty paths are skipped. */
+        void SubmitSnapshot(const std::string& histogramPath, const std::string& pngPath, unsigned int bitDepth, HistogramFile&& file, std::vector<uint8_t>&& image);
+        void WaitUntilIdle();
+    private:
+        struct Job
+        {
+            std::string histogramPath;
+            bool withWorkerStates;
+            std::string pngPath;
+            unsigned int bitDepth;
+            HistogramFile data;
+            std::vector<uint8_t> image;
+        };
+        void SubmitJob(Job&& job);
+        void WorkerLoop();
+
+        std::mutex mutex;
+        std::condition_variable condition;
+        bool hasJob{false};
+        bool shutdown{false};
+        Job job;
+        std::thread worker;
+    };
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <glad/glad.h>
+#include <cstdint>
+#include <string>
+
+namespace Helpers
+{
+    /** The percentiles the reduction shader determines, as fractions of the non-zero counts of a channel. Must match percentileFractions in BuddhaReduce.glsl. */
+    const double StatisticsPercentiles[] = {0.5, 0.9, 0.99, 0.999};
+    const unsigned int StatisticsPercentileCount = sizeof(StatisticsPercentiles)/sizeof(StatisticsPercentiles[0]);
+    const unsigned int StatisticsBinCount = 256;
+
+    /** Mirrors struct channelStatistics in the reduction shader (std430 layout). */
+    struct ChannelStatistics
+    {
+        uint32_t maxCount;
+        uint32_t nonZeroCount;
+        uint64_t sum;
+        /** Upper bounds of the bins the percentiles fall into, so they may be up to 1/8 too high. Never larger than maxCount. */
+        uint32_t percentiles[StatisticsPercentileCount];
+        /** Number of counts per bin. Bins are indexed by the position of the most significant bit times 8, plus the three bits below it. */
+        uint32_t bins[StatisticsBinCount];
+    };
+    static_assert(sizeof(ChannelStatistics) == 1056, "ChannelStatistics must match the std430 layout of channelStatistics");
+
+    struct HistogramStatistics
+    {
+        ChannelStatistics channels[3];
+
+        /** The largest count of all channels, but at least 1, so it can be divided by. */
+        uint32_t GetMaxCount() const;
+    };
+
+    /** Computes HistogramStatistics of a buffer of counts on the GPU. Run() only queues two small dispatches, so it can be called every frame.
+        The result stays in a buffer that Run() binds to binding point 7, where the preview and the tone mapper read it, and can be read back
+        with any buffer readback. */
+    class HistogramReduction
+    {
+    public:
+        HistogramReduction() = default;
+        ~HistogramReduction();
+        HistogramReduction(const HistogramReduction&) = delete;
+        HistogramReduction& operator=(const HistogramReduction&) = delete;
+
+        /** Loads the shader and creates the statistics buffer. */
+        bool Init(const std::string& shaderName);
+        /** Reduces pixelCount RGB pixels of sourceBuffer. */
+        void Run(GLuint sourceBuffer, unsigned int pixelCount);
+        GLuint GetBuffer() const;
+    private:
+        GLuint program{0};
+        GLuint statisticsBuffer{0};
+        GLint reductionPassHandle{-1};
+        GLint pixelCountHandle{-1};
+    };
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include "Helpers.h"
+
+namespace Helpers
+{
+    /** Renders settings.localShards shards as child processes of this executable, passing on all command line options except the output related ones.
+        Afterwards the shard histograms are merged into settings.histogramFilename and/or settings.pngFilename. Returns the exit code for main(). */
+    int RunLocalShards(const RenderSettings& settings, int argc, char * argv[]);
+}
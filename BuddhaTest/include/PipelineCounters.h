@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+namespace Helpers
+{
+    /** Indices of the counters in the pipelineCounters buffer of the compute shader. Must match the COUNTER_ defines there. */
+    enum PipelineCounter
+    {
+        StartedSamples,
+        RejectedByMainCardioid,
+        RejectedByKnownCircle,
+        RejectedNotEscaping,
+        RejectedTooShort,
+        DrawnOrbits,
+        EscapeCheckIterations,
+        DrawIterations,
+        IdleIterations, //iterations a worker had left when it ran out of samples.
+        HistogramWrites, //pixels an orbit point was added to, each takes an atomic add per color channel.
+        PipelineCounterCount
+    };
+
+    /** Mirrors the pipelineCounters buffer. Counts are totals since rendering started in this process. */
+    struct PipelineCounters
+    {
+        uint64_t values[PipelineCounterCount];
+    };
+
+    /** The preprocessor definition that compiles the counters into the compute shader. */
+    const std::string PipelineCountersDefine = "#define COLLECT_PIPELINE_COUNTERS\n";
+
+    /** Rates derived from the counters, all per second. */
+    struct PipelineThroughput
+    {
+        double candidates; //samples started
+        double acceptedOrbits; //orbits drawn completely
+        double iterations; //iterations actually computed, without idle ones
+        double histogramWrites; //NaN if they were not counted.
+    };
+    PipelineThroughput GetPipelineThroughput(const PipelineCounters& counters, double seconds);
+
+    void PrintPipelineCounters(const PipelineCounters& counters, double seconds);
+    void PrintPipelineThroughput(const PipelineThroughput& throughput);
+    /** Writes the result of --benchmark as JSON, with the rates named like the metrics of buddha-bench. */
+    bool WritePipelineThroughput(const std::string& path, const PipelineThroughput& throughput);
+    /** Reads a file written by WritePipelineThroughput. */
+    bool ReadPipelineThroughput(const std::string& path, PipelineThroughput& throughput);
+    bool WritePipelineCounters(const std::string& path, const PipelineCounters& counters, double seconds);
+    /** Reads a file written by WritePipelineCounters. */
+    bool ReadPipelineCounters(const std::string& path, PipelineCounters& counters, double& seconds);
+}
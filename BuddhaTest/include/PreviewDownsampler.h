@@ -0,0 +1,40 @@
+#pragma once
+#include <glad/glad.h>
+#include <string>
+
+namespace Helpers
+{
+    /** Box filters the histogram to the resolution of the preview window. Like the histogram it only holds the upper half of the image,
+        3 counts per pixel. The buffer is bound to binding point 3, where the fragment shader reads it. Every Run() reads the whole
+        histogram, as every dispatch may have changed any part of it; --previewRate limits how often that happens. */
+    class PreviewDownsampler
+    {
+    public:
+        PreviewDownsampler() = default;
+        ~PreviewDownsampler();
+        PreviewDownsampler(const PreviewDownsampler&) = delete;
+        PreviewDownsampler& operator=(const PreviewDownsampler&) = delete;
+
+        /** Loads the shader. The histogram is read from binding point 2. */
+        bool Init(const std::string& shaderName, unsigned int histogramWidth, unsigned int histogramBufferHeight);
+        /** Switches to a histogram of another size. The next Resize() then reports a change. */
+        void SetHistogramSize(unsigned int histogramWidth, unsigned int histogramBufferHeight);
+        /** Adapts the preview buffer to the given window size. Returns true if the size changed. */
+        bool Resize(unsigned int windowWidth, unsigned int windowHeight);
+        void Run();
+
+        GLuint GetBuffer() const;
+        unsigned int GetWidth() const;
+        unsigned int GetBufferHeight() const;
+        unsigned int GetPixelCount() const;
+    private:
+        GLuint program{0};
+        GLuint previewBuffer{0};
+        GLint previewSizeHandle{-1};
+        GLint largestBoxAreaHandle{-1};
+        unsigned int histogramWidth{0};
+        unsigned int histogramBufferHeight{0};
+        unsigned int width{0};
+        unsigned int bufferHeight{0};
+    };
+}
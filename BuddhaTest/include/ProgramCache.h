@@ -0,0 +1,27 @@
+#pragma once
+#include <glad/glad.h>
+#include <string>
+#include <vector>
+
+namespace Helpers
+{
+    /** Linked programs are stored with glGetProgramBinary, so later launches do not need to compile them again. Entries are keyed by the
+        complete shader sources, including the injected version, layout and preamble lines, and by vendor, renderer and version of the driver.
+        If the driver rejects a cached binary anyhow, the program is compiled from source and the entry replaced.
+        Needs a current context. An empty directory, the default, disables the cache, as does a driver without binary formats. */
+    void SetProgramCacheDirectory(const std::string& directory);
+    /** $XDG_CACHE_HOME/BuddhaShader, ~/.cache/BuddhaShader or %LOCALAPPDATA%\BuddhaShader. */
+    std::string GetDefaultProgramCacheDirectory();
+
+    /** Creates a program from the cached binary for these sources. Returns 0 if there is none, or if the driver does not accept it. */
+    GLuint LoadCachedProgram(const std::vector<std::string>& sources);
+    /** Stores the binary of a successfully linked program, which needs to have been linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT. */
+    void StoreCachedProgram(const std::vector<std::string>& sources, GLuint program);
+
+    struct ProgramCacheStatistics
+    {
+        unsigned int hits;
+        unsigned int misses;
+    };
+    ProgramCacheStatistics GetProgramCacheStatistics();
+}
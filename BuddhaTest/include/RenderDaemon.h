@@ -0,0 +1,104 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
+#include <cstdint>
+
+namespace Helpers
+{
+    /** How far a running job got, as reported by the render loop. */
+    struct JobProgress
+    {
+        double seconds;
+        uint64_t samples;
+        uint64_t acceptedOrbits;
+        //samples or accepted orbits, whichever the job's budget counts. Both 0 if it has none.
+        uint64_t budgetDone;
+        uint64_t budgetTotal;
+    };
+
+    enum class JobState
+    {
+        Queued,
+        Running,
+        Finished,
+        Failed,
+        Cancelled
+    };
+
+    struct DaemonJob
+    {
+        unsigned int id;
+        int priority;
+        /** The options of the job, in the same form as on the command line. */
+        std::vector<std::string> arguments;
+    };
+
+    /** Accepts render jobs on a Unix domain socket and queues them, so one process with a warm context renders them one after another.
+        Every connection sends one request as a single line of JSON and gets one line of JSON back. Requests are
+            {"command": "submit", "priority": 1, "imageWidth": 2048, "sampleBudget": 100000000, "output": "a.png"}
+            {"command": "status", "job": 3}    or without "job" for all jobs
+            {"command": "cancel", "job": 3}
+            {"command": "shutdown"}            finishes the running job, and drops the queued ones
+        All members of a submit besides command and priority are options in command line form, without the leading --.
+        Higher priorities run first, jobs of equal priority in the order they were submitted. Of the jobs that have ended, only the most recent
+        ones are kept for status requests. Only the owner may connect, and a request has to arrive within two seconds. The requests are served
+        on a thread of their own, the jobs are taken from the queue by the thread that owns the context. */
+    class RenderDaemon
+    {
+    public:
+        /** Is called for the options of every submitted job, so invalid ones are rejected right away instead of once they are taken from the queue. */
+        using JobValidator = std::function<bool(const std::vector<std::string>&)>;
+
+        RenderDaemon() = default;
+        ~RenderDaemon();
+        RenderDaemon(const RenderDaemon&) = delete;
+        RenderDaemon& operator=(const RenderDaemon&) = delete;
+
+        /** Creates the socket and starts serving requests. Submissions are refused while queueLimit jobs are waiting. */
+        bool Start(const std::string& socketPath, unsigned int queueLimit, JobValidator validator);
+
+        /** Takes the queued job with the highest priority and marks it as running. Returns false if none arrived within timeout. */
+        bool WaitForJob(DaemonJob& job, std::chrono::milliseconds timeout);
+        /** Stores the progress of the running job. Returns false once the job has been cancelled. */
+        bool ReportProgress(unsigned int id, const JobProgress& progress);
+        /** Returns the final state of the job: Failed unless succeeded, which includes outputs that could not be written, else Cancelled if it was cancelled while running. */
+        JobState FinishJob(unsigned int id, bool succeeded);
+
+        bool IsShutdownRequested() const;
+    private:
+        struct JobRecord
+        {
+            DaemonJob job;
+            JobState state;
+            JobProgress progress;
+            bool cancelRequested;
+        };
+
+        void Serve();
+        std::string HandleRequest(const std::string& request);
+        std::string DescribeJob(const JobRecord& record) const;
+        /** Forgets the oldest jobs that are no longer queued or running, beyond a fixed number. Expects mutex to be locked. */
+        void PruneEndedJobs();
+
+        std::string socketPath;
+        int listenSocket{-1};
+        unsigned int queueLimit{0};
+        JobValidator validator;
+        std::thread serverThread;
+        std::atomic<bool> stopServer{false};
+
+        mutable std::mutex mutex;
+        std::condition_variable jobQueued;
+        //ordered by id, which is the order of submission.
+        std::map<unsigned int, JobRecord> jobs;
+        unsigned int nextJobId{1};
+        bool shutdownRequested{false};
+    };
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "Helpers.h"
+#include <string>
+
+namespace Helpers
+{
+    struct WorkgroupSizes
+    {
+        unsigned int localX;
+        unsigned int localY;
+        unsigned int localZ;
+        unsigned int globalX;
+        unsigned int globalY;
+        unsigned int globalZ;
+    };
+
+    /** Vendor, renderer and version string of the current context. The tuned work group sizes are stored per identifier. */
+    std::string GetDeviceIdentifier();
+
+    /** settings.workgroupCacheFilename, or a file in the home directory if that is empty. */
+    std::string GetWorkgroupCachePath(const RenderSettings& settings);
+
+    /** Looks up the work group sizes --autotune found for this device. Returns false if there are none. */
+    bool ReadCachedWorkgroupSizes(const std::string& path, const std::string& device, WorkgroupSizes& sizes);
+    /** Stores the work group sizes for this device, replacing earlier ones. Entries of other devices are kept. */
+    bool WriteCachedWorkgroupSizes(const std::string& path, const std::string& device, const WorkgroupSizes& sizes);
+
+    /** Uses the cached work group sizes for the current context, unless the command line set any of them. Needs a current context. */
+    void ApplyCachedWorkgroupSizes(RenderSettings& settings);
+
+    /** Renders short benchmarks with different work group sizes as child processes of this executable, and stores the fastest in the cache.
+        First the local size is chosen with the total number of workers kept, then the number of workers. Needs a current context to query
+        the limits of the device. Returns the exit code for main(). */
+    int RunWorkgroupAutotune(const RenderSettings& settings, int argc, char * argv[]);
+}
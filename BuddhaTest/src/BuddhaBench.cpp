@@ -0,0 +1,405 @@
+#include <Helpers.h>
+#include <PipelineCounters.h>
+#include <Engine.h>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+
+namespace
+{
+    struct Configuration
+    {
+        std::string backend;
+        unsigned int width;
+        unsigned int height;
+        unsigned int orbitLengthRed;
+        unsigned int orbitLengthGreen;
+        unsigned int orbitLengthBlue;
+        unsigned int localWorkgroupSizeX;
+        unsigned int localWorkgroupSizeY;
+        unsigned int globalWorkgroupSizeX;
+        unsigned int globalWorkgroupSizeY;
+        std::string precision;
+        //only meaningful for the cpu backend, which has no work groups.
+        std::string kernel;
+        unsigned int exponent;
+    };
+
+    /** The configurations every benchmark run measures. Keep this fixed, so results of different versions and machines stay comparable.
+        All work group layouts have the same total number of workers. */
+    std::vector<Configuration> GetConfigurations()
+    {
+        struct Resolution { unsigned int width, height; };
+        struct OrbitLengths { unsigned int red, green, blue; };
+        struct Workgroups { unsigned int localX, localY, globalX, globalY; };
+        const Resolution resolutions[] = {{1024, 576}, {3840, 2160}};
+        const OrbitLengths orbitLengths[] = {{10, 100, 1000}, {100, 1000, 10000}};
+        const Workgroups workgroups[] = {{4, 4, 64, 64}, {8, 8, 32, 32}, {16, 16, 16, 16}};
+
+        std::vector<Configuration> configurations;
+        for(const auto& resolution : resolutions)
+            for(const auto& lengths : orbitLengths)
+                for(const auto& workgroup : workgroups)
+                    configurations.push_back({"gl", resolution.width, resolution.height, lengths.red, lengths.green, lengths.blue, workgroup.localX, workgroup.localY, workgroup.globalX, workgroup.globalY, "float", "", 2});
+        //the cost of double precision, for one resolution and layout.
+        for(const auto& lengths : orbitLengths)
+            configurations.push_back({"gl", 1024, 576, lengths.red, lengths.green, lengths.blue, 8, 8, 32, 32, "double", "", 2});
+
+        //The CPU engine compares its specialized kernels with the generic one, and the precisions. Equal orbit lengths use the monochrome histogram.
+        const OrbitLengths cpuOrbitLengths[] = {{10, 100, 1000}, {100, 1000, 10000}, {1000, 1000, 1000}};
+        const unsigned int exponents[] = {2, 3};
+        const char * const kernels[] = {"generic", "specialized"};
+        for(const auto& lengths : cpuOrbitLengths)
+            for(auto exponent : exponents)
+                for(auto kernel : kernels)
+                    configurations.push_back({"cpu", 1024, 576, lengths.red, lengths.green, lengths.blue, 0, 0, 0, 0, "float", kernel, exponent});
+        const char * const cpuPrecisions[] = {"double", "doubledouble"};
+        for(const auto& lengths : cpuOrbitLengths)
+            for(auto precision : cpuPrecisions)
+                configurations.push_back({"cpu", 1024, 576, lengths.red, lengths.green, lengths.blue, 0, 0, 0, 0, precision, "specialized", 2});
+        return configurations;
+    }
+
+    const unsigned int MetricCount = 4;
+    const char * const MetricNames[MetricCount] = {"candidatesPerSecond", "acceptedOrbitsPerSecond", "iterationsPerSecond", "histogramWritesPerSecond"};
+
+    double GetMetric(const Helpers::PipelineThroughput& throughput, unsigned int metric)
+    {
+        const double metrics[MetricCount] = {throughput.candidates, throughput.acceptedOrbits, throughput.iterations, throughput.histogramWrites};
+        return metrics[metric];
+    }
+
+    struct Estimate
+    {
+        double mean;
+        double confidence95; //half width of the 95% confidence interval of the mean.
+    };
+
+    Estimate EstimateMean(const std::vector<double>& samples)
+    {
+        //two sided 95% quantiles of Student's t distribution, by degrees of freedom.
+        const double tQuantiles[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131,
+                                     2.120, 2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+        double sum{0.0};
+        for(auto sample : samples)
+            sum += sample;
+        const double mean{sum / samples.size()};
+        if(samples.size() < 2)
+            return {mean, 0.0};
+        double squaredDeviations{0.0};
+        for(auto sample : samples)
+            squaredDeviations += (sample - mean) * (sample - mean);
+        const size_t degreesOfFreedom{samples.size() - 1};
+        const double t{degreesOfFreedom <= 30 ? tQuantiles[degreesOfFreedom - 1] : 1.96};
+        return {mean, t * std::sqrt(squaredDeviations / degreesOfFreedom / samples.size())};
+    }
+
+    struct Result
+    {
+        Configuration configuration;
+        std::vector<double> samples[MetricCount];
+    };
+
+    struct BenchSettings
+    {
+        std::string rendererPath = "";
+        std::string csvFilename = "";
+        std::string jsonFilename = "";
+        unsigned int duration = 10;
+        unsigned int warmup = 3;
+        unsigned int repetitions = 3;
+        std::string backend = "";
+        unsigned int threadCount = 0;
+
+        bool ParseCommandLine(int argc, char * argv[])
+        {
+            for(int i=1; i < argc;++i)
+            {
+                std::string argAsString(argv[i]);
+                if(argAsString == "--help")
+                {
+                    std::cout << "Usage: buddha-bench [options]" << std::endl <<
+                                 "Measures the throughput of BuddhaShader for a fixed set of image sizes, orbit lengths and work group sizes, and of the CPU engine for a fixed set of orbit lengths, exponents, kernels and precisions. Every configuration is rendered headless several times." << std::endl <<
+                                 "Supported options are:" << std::endl << std::endl <<
+                                 "--renderer [path] : The BuddhaShader executable. By default the one next to buddha-bench." << std::endl <<
+                                 "--csv [path] : File to write the results to as CSV." << std::endl <<
+                                 "--json [path] : File to write the results to as JSON, including all individual measurements." << std::endl <<
+                                 "--duration [integer] : Seconds measured per run. 10 by default." << std::endl <<
+                                 "--warmup [integer] : Seconds rendered before the measurement starts, so the dispatch size can settle. 3 by default." << std::endl <<
+                                 "--repetitions [integer] : Runs per configuration. The confidence intervals get narrower with more runs. 3 by default." << std::endl <<
+                                 "--backend [gl,cpu] : Only benchmark this backend. Empty by default, meaning both." << std::endl <<
+                                 "--threads [integer] : Threads of the cpu backend. 0 by default, meaning one per core." << std::endl;
+                    return false;
+                }
+                if(i+1 >= argc)
+                {
+                    std::cerr << "Missing value for option " << argAsString << ". See --help for usage." << std::endl;
+                    return false;
+                }
+                std::string valueAsString(argv[++i]);
+                if(argAsString == "--renderer")
+                    rendererPath = valueAsString;
+                else if(argAsString == "--csv")
+                    csvFilename = valueAsString;
+                else if(argAsString == "--json")
+                    jsonFilename = valueAsString;
+                else if(argAsString == "--duration")
+                    duration = std::stoi(valueAsString);
+                else if(argAsString == "--warmup")
+                    warmup = std::stoi(valueAsString);
+                else if(argAsString == "--repetitions")
+                    repetitions = std::stoi(valueAsString);
+                else if(argAsString == "--backend")
+                    backend = valueAsString;
+                else if(argAsString == "--threads")
+                    threadCount = std::stoi(valueAsString);
+                else
+                {
+                    std::cerr << "Unknown option: " << argAsString << std::endl;
+                    return false;
+                }
+            }
+            if(duration == 0 || repetitions == 0)
+            {
+                std::cerr << "--duration and --repetitions have to be at least 1." << std::endl;
+                return false;
+            }
+            if(!backend.empty() && backend != "gl" && backend != "cpu")
+            {
+                std::cerr << "Unknown backend " << backend << ". Supported are gl and cpu." << std::endl;
+                return false;
+            }
+            if(rendererPath.empty())
+            {
+                const std::string ownPath(argv[0]);
+                const auto separator = ownPath.find_last_of("/\\");
+#if defined _WIN32 || defined __CYGWIN__
+                rendererPath = (separator == std::string::npos ? std::string() : ownPath.substr(0, separator + 1)) + "BuddhaShader.exe";
+#else
+                rendererPath = (separator == std::string::npos ? std::string("./") : ownPath.substr(0, separator + 1)) + "BuddhaShader";
+#endif
+            }
+            return true;
+        }
+    };
+
+    /** Renders with BuddhaShader. It measures without pipeline counters, so histogram writes are not measured for the gl backend. */
+    bool RunConfiguration(const BenchSettings& settings, const Configuration& configuration, const std::string& resultPath, Helpers::PipelineThroughput& throughput)
+    {
+        const std::string command = Helpers::QuoteShellArgument(settings.rendererPath) +
+                " --headless 1" +
+                " --benchmark " + std::to_string(settings.warmup + settings.duration) +
+                " --benchmarkWarmup " + std::to_string(settings.warmup) +
+                " --benchmarkOutput " + Helpers::QuoteShellArgument(resultPath) +
+                " --imageWidth " + std::to_string(configuration.width) +
+                " --imageHeight " + std::to_string(configuration.height) +
+                " --orbitLengthRed " + std::to_string(configuration.orbitLengthRed) +
+                " --orbitLengthGreen " + std::to_string(configuration.orbitLengthGreen) +
+                " --orbitLengthBlue " + std::to_string(configuration.orbitLengthBlue) +
+                " --localWorkgroupSizeX " + std::to_string(configuration.localWorkgroupSizeX) +
+                " --localWorkgroupSizeY " + std::to_string(configuration.localWorkgroupSizeY) +
+                " --globalWorkgroupSizeX " + std::to_string(configuration.globalWorkgroupSizeX) +
+                " --globalWorkgroupSizeY " + std::to_string(configuration.globalWorkgroupSizeY) +
+                " --precision " + configuration.precision;
+        std::remove(resultPath.c_str());
+        const int exitCode = Helpers::RunChildProcess(command);
+        if(exitCode != 0)
+        {
+            std::cerr << "The renderer failed with exit status " << exitCode << "." << std::endl;
+            return false;
+        }
+        if(!Helpers::ReadPipelineThroughput(resultPath, throughput))
+            return false;
+        std::remove(resultPath.c_str());
+        return true;
+    }
+
+    /** Runs the CPU engine in this process, in steps of about a tenth of a second. */
+    bool RunCpuConfiguration(const BenchSettings& settings, const Configuration& configuration, Helpers::PipelineThroughput& throughput)
+    {
+        Helpers::RenderSettings renderSettings;
+        renderSettings.imageWidth = configuration.width;
+        renderSettings.imageHeight = configuration.height;
+        renderSettings.orbitLengthRed = configuration.orbitLengthRed;
+        renderSettings.orbitLengthGreen = configuration.orbitLengthGreen;
+        renderSettings.orbitLengthBlue = configuration.orbitLengthBlue;
+        renderSettings.exponent = configuration.exponent;
+        renderSettings.cpuKernel = configuration.kernel;
+        renderSettings.precision = configuration.precision;
+        auto engine = Helpers::CreateCpuEngine(settings.threadCount);
+        if(!engine->Configure(renderSettings))
+            return false;
+
+        const auto runFor = [&engine](unsigned int seconds){
+            uint64_t samplesPerStep{1 << 12};
+            const auto start{std::chrono::high_resolution_clock::now()};
+            while(std::chrono::high_resolution_clock::now() - start < std::chrono::seconds(seconds))
+            {
+                const auto stepStart{std::chrono::high_resolution_clock::now()};
+                engine->RunSamples(samplesPerStep);
+                const double stepSeconds{std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - stepStart).count()};
+                samplesPerStep = std::max<uint64_t>(1024, static_cast<uint64_t>(samplesPerStep * std::min(2.0, std::max(0.5, 0.1 / std::max(stepSeconds, 1e-4)))));
+            }
+        };
+        runFor(settings.warmup);
+        const Helpers::EngineProgress before{engine->GetProgress()};
+        const auto measureStart{std::chrono::high_resolution_clock::now()};
+        runFor(settings.duration);
+        const double seconds{std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - measureStart).count()};
+        const Helpers::EngineProgress after{engine->GetProgress()};
+        throughput.candidates = (after.samples - before.samples) / seconds;
+        throughput.acceptedOrbits = (after.acceptedOrbits - before.acceptedOrbits) / seconds;
+        throughput.iterations = (after.iterations - before.iterations) / seconds;
+        throughput.histogramWrites = (after.histogramWrites - before.histogramWrites) / seconds;
+        return true;
+    }
+
+    std::string DescribeConfiguration(const Configuration& configuration)
+    {
+        if(configuration.backend == "cpu")
+            return configuration.backend + " " + std::to_string(configuration.width) + "x" + std::to_string(configuration.height) +
+                    ", orbits " + std::to_string(configuration.orbitLengthRed) + "/" + std::to_string(configuration.orbitLengthGreen) + "/" + std::to_string(configuration.orbitLengthBlue) +
+                    ", exponent " + std::to_string(configuration.exponent) + ", " + configuration.kernel + " kernel, " + configuration.precision;
+        return configuration.backend + " " + std::to_string(configuration.width) + "x" + std::to_string(configuration.height) +
+                ", orbits " + std::to_string(configuration.orbitLengthRed) + "/" + std::to_string(configuration.orbitLengthGreen) + "/" + std::to_string(configuration.orbitLengthBlue) +
+                ", local " + std::to_string(configuration.localWorkgroupSizeX) + "x" + std::to_string(configuration.localWorkgroupSizeY) +
+                ", global " + std::to_string(configuration.globalWorkgroupSizeX) + "x" + std::to_string(configuration.globalWorkgroupSizeY) + ", " + configuration.precision;
+    }
+
+    bool WriteCSV(const std::string& path, const std::vector<Result>& results)
+    {
+        std::ofstream file(path, std::ios::out | std::ios::trunc);
+        if(!file.is_open())
+        {
+            std::cerr << "Failed to open " << path << " for writing." << std::endl;
+            return false;
+        }
+        file << "backend,width,height,orbitLengthRed,orbitLengthGreen,orbitLengthBlue,localWorkgroupSizeX,localWorkgroupSizeY,globalWorkgroupSizeX,globalWorkgroupSizeY,precision,kernel,exponent,repetitions";
+        for(auto name : MetricNames)
+            file << "," << name << "," << name << "Confidence95";
+        file << "\n" << std::setprecision(10);
+        for(const auto& result : results)
+        {
+            const auto& c = result.configuration;
+            file << c.backend << "," << c.width << "," << c.height << "," << c.orbitLengthRed << "," << c.orbitLengthGreen << "," << c.orbitLengthBlue << "," <<
+                    c.localWorkgroupSizeX << "," << c.localWorkgroupSizeY << "," << c.globalWorkgroupSizeX << "," << c.globalWorkgroupSizeY << "," << c.precision << "," << c.kernel << "," << c.exponent << "," << result.samples[0].size();
+            for(unsigned int metric = 0; metric < MetricCount; ++metric)
+            {
+                //metrics a backend does not measure are left empty.
+                const Estimate estimate = EstimateMean(result.samples[metric]);
+                if(std::isnan(estimate.mean))
+                    file << ",,";
+                else
+                    file << "," << estimate.mean << "," << estimate.confidence95;
+            }
+            file << "\n";
+        }
+        return file.good();
+    }
+
+    bool WriteJSON(const std::string& path, const BenchSettings& settings, const std::vector<Result>& results)
+    {
+        std::ofstream file(path, std::ios::out | std::ios::trunc);
+        if(!file.is_open())
+        {
+            std::cerr << "Failed to open " << path << " for writing." << std::endl;
+            return false;
+        }
+        file << std::setprecision(10) << "{\n    \"duration\": " << settings.duration << ",\n    \"warmup\": " << settings.warmup << ",\n    \"results\": [";
+        for(size_t i = 0; i < results.size(); ++i)
+        {
+            const auto& c = results[i].configuration;
+            file << (i == 0 ? "\n" : ",\n") <<
+                    "        {\n" <<
+                    "            \"backend\": \"" << c.backend << "\",\n" <<
+                    "            \"width\": " << c.width << ",\n" <<
+                    "            \"height\": " << c.height << ",\n" <<
+                    "            \"orbitLengthRed\": " << c.orbitLengthRed << ",\n" <<
+                    "            \"orbitLengthGreen\": " << c.orbitLengthGreen << ",\n" <<
+                    "            \"orbitLengthBlue\": " << c.orbitLengthBlue << ",\n" <<
+                    "            \"localWorkgroupSizeX\": " << c.localWorkgroupSizeX << ",\n" <<
+                    "            \"localWorkgroupSizeY\": " << c.localWorkgroupSizeY << ",\n" <<
+                    "            \"globalWorkgroupSizeX\": " << c.globalWorkgroupSizeX << ",\n" <<
+                    "            \"globalWorkgroupSizeY\": " << c.globalWorkgroupSizeY << ",\n" <<
+                    "            \"precision\": \"" << c.precision << "\",\n" <<
+                    "            \"kernel\": \"" << c.kernel << "\",\n" <<
+                    "            \"exponent\": " << c.exponent;
+            for(unsigned int metric = 0; metric < MetricCount; ++metric)
+            {
+                const auto& samples = results[i].samples[metric];
+                const Estimate estimate = EstimateMean(samples);
+                if(std::isnan(estimate.mean))
+                {
+                    file << ",\n            \"" << MetricNames[metric] << "\": null";
+                    continue;
+                }
+                file << ",\n            \"" << MetricNames[metric] << "\": { \"mean\": " << estimate.mean << ", \"confidence95\": " << estimate.confidence95 << ", \"samples\": [";
+                for(size_t j = 0; j < samples.size(); ++j)
+                    file << (j == 0 ? "" : ", ") << samples[j];
+                file << "] }";
+            }
+            file << "\n        }";
+        }
+        file << "\n    ]\n}\n";
+        return file.good();
+    }
+}
+
+int main(int argc, char * argv[])
+{
+    BenchSettings settings;
+    if(!settings.ParseCommandLine(argc, argv))
+        return 2;
+
+    const std::string resultPath = (settings.jsonFilename.empty() ? (settings.csvFilename.empty() ? std::string("buddha-bench") : settings.csvFilename) : settings.jsonFilename) + ".result.tmp";
+    const auto configurations = GetConfigurations();
+    std::vector<Result> results;
+    bool allSucceeded{true};
+    for(const auto& configuration : configurations)
+    {
+        if(!settings.backend.empty() && configuration.backend != settings.backend)
+            continue;
+        std::cout << "Benchmarking " << DescribeConfiguration(configuration) << std::endl;
+        Result result{configuration, {}};
+        for(unsigned int repetition = 0; repetition < settings.repetitions; ++repetition)
+        {
+            Helpers::PipelineThroughput throughput;
+            const bool succeeded = configuration.backend == "cpu" ? RunCpuConfiguration(settings, configuration, throughput) : RunConfiguration(settings, configuration, resultPath, throughput);
+            if(!succeeded)
+            {
+                allSucceeded = false;
+                break;
+            }
+            for(unsigned int metric = 0; metric < MetricCount; ++metric)
+                result.samples[metric].push_back(GetMetric(throughput, metric));
+        }
+        if(result.samples[0].size() != settings.repetitions)
+        {
+            std::cerr << "Skipping " << DescribeConfiguration(configuration) << ", not all runs succeeded." << std::endl;
+            continue;
+        }
+        for(unsigned int metric = 0; metric < MetricCount; ++metric)
+        {
+            const Estimate estimate = EstimateMean(result.samples[metric]);
+            if(std::isnan(estimate.mean))
+            {
+                std::cout << "  " << MetricNames[metric] << ": not measured" << std::endl;
+                continue;
+            }
+            std::cout << "  " << MetricNames[metric] << ": " << std::fixed << std::setprecision(0) << estimate.mean << " +- " << estimate.confidence95 << std::defaultfloat << std::setprecision(6) << std::endl;
+        }
+        results.push_back(std::move(result));
+    }
+
+    if(!settings.csvFilename.empty() && !WriteCSV(settings.csvFilename, results))
+        allSucceeded = false;
+    if(!settings.jsonFilename.empty() && !WriteJSON(settings.jsonFilename, settings, results))
+        allSucceeded = false;
+    return allSucceeded ? 0 : 1;
+}
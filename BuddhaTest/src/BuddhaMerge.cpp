@@ -0,0 +1,110 @@
+#include <Helpers.h>
+#include <HistogramFile.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <cstdio>
+#include <algorithm>
+
+namespace
+{
+    struct MergeSettings
+    {
+        std::vector<std::string> inputFilenames;
+        std::string histogramFilename = "";
+        std::string pngFilename = "";
+        double pngGamma = 1.0;
+        double pngColorScale = 2.0;
+        unsigned int pngBitDepth = 8;
+        unsigned int threadCount = 0;
+
+        bool ParseCommandLine(int argc, char * argv[])
+        {
+            for(int i=1; i < argc;++i)
+            {
+                std::string argAsString(argv[i]);
+                if(argAsString == "--help")
+                {
+                    std::cout << "Usage: buddha-merge [options] histogram1 histogram2 ..." << std::endl <<
+                                 "Sums up histograms written by BuddhaShader's --histogramOutput or --checkpoint. All inputs must have the same image size and orbit lengths." << std::endl <<
+                                 "Supported options are:" << std::endl << std::endl <<
+                                 "--histogramOutput [path] : File to write the merged histogram to. It uses 64 bit counts." << std::endl <<
+                                 "--output [path] : Png file to write the merged image to." << std::endl <<
+                                 "--imageGamma [float] : Gamma to use when writing the image. 1.0 by default." << std::endl <<
+                                 "--imageColorScale [float] : Image brightness is scaled by the brightest pixel. The result is multiplied by this value. 2.0 by default." << std::endl <<
+                                 "--imageBitDepth [8,16] : Bits per color channel of the written image. 8 by default." << std::endl <<
+                                 "--threads [integer] : Number of threads to merge with. 0 by default, meaning one per hardware thread." << std::endl;
+                    return false;
+                }
+                if(argAsString.compare(0, 2, "--") != 0)
+                {
+                    inputFilenames.push_back(argAsString);
+                    continue;
+                }
+                if(i+1 >= argc)
+                {
+                    std::cerr << "Missing value for option " << argAsString << ". See --help for usage." << std::endl;
+                    return false;
+                }
+                std::string valueAsString(argv[++i]);
+                if(argAsString == "--histogramOutput")
+                    histogramFilename = valueAsString;
+                else if(argAsString == "--output")
+                    pngFilename = valueAsString;
+                else if(argAsString == "--imageGamma")
+                    pngGamma = std::stod(valueAsString);
+                else if(argAsString == "--imageColorScale")
+                    pngColorScale = std::stod(valueAsString);
+                else if(argAsString == "--imageBitDepth")
+                    pngBitDepth = std::stoi(valueAsString);
+                else if(argAsString == "--threads")
+                    threadCount = std::stoi(valueAsString);
+                else
+                {
+                    std::cerr << "Unknown option: " << argAsString << std::endl;
+                    return false;
+                }
+            }
+            if(inputFilenames.empty() || (histogramFilename.empty() && pngFilename.empty()))
+            {
+                std::cerr << "Need at least one input and either --histogramOutput or --output. See --help for usage." << std::endl;
+                return false;
+            }
+            if(pngBitDepth != 8 && pngBitDepth != 16)
+            {
+                std::cerr << "Invalid image bit depth " << pngBitDepth << ". Only 8 and 16 are supported." << std::endl;
+                return false;
+            }
+            if(threadCount == 0)
+                threadCount = std::max(1u, std::thread::hardware_concurrency());
+            return true;
+        }
+    };
+}
+
+int main(int argc, char * argv[])
+{
+    MergeSettings settings;
+    if(!settings.ParseCommandLine(argc, argv))
+        return 2;
+
+    //without --histogramOutput the merged histogram only lives on disk until the png is written.
+    const bool keepHistogram{!settings.histogramFilename.empty()};
+    const std::string mergedPath = keepHistogram ? settings.histogramFilename : settings.pngFilename + ".histogram.tmp";
+
+    uint64_t maxValue{0};
+    if(!Helpers::MergeHistogramFiles(settings.inputFilenames, mergedPath, settings.threadCount, maxValue))
+    {
+        if(!keepHistogram)
+            std::remove(mergedPath.c_str());
+        return 1;
+    }
+
+    bool success{true};
+    if(!settings.pngFilename.empty())
+        success = Helpers::WriteOutputPNG(settings.pngFilename, mergedPath, std::max(maxValue, UINT64_C(1)), settings.pngGamma, settings.pngColorScale, settings.pngBitDepth);
+    if(!keepHistogram)
+        std::remove(mergedPath.c_str());
+    return success ? 0 : 1;
+}
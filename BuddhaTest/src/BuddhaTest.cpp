@@ -1,11 +1,32 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <Helpers.h>
+#include <LocalShards.h>
+#include <HeadlessContext.h>
+#include <PipelineCounters.h>
+#include <WorkgroupAutotune.h>
+#include <ProgramCache.h>
+#include <RenderDaemon.h>
+#include <GlEngine.h>
 #include <iostream>
 #include <vector>
 #include <chrono>
 #include <iomanip>
 #include <algorithm>
+#include <csignal>
+#include <fstream>
+#include <cstring>
+#include <cctype>
+#include <functional>
+#include <limits>
+
+//set on SIGINT/SIGTERM, so a render without a window can still be stopped with its results written.
+volatile std::sig_atomic_t stopRequested{0};
+
+void stop_signal_handler(int)
+{
+    stopRequested = 1;
+}
 
 void error_callback(int error, const char* description)
 {
@@ -17,237 +38,449 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
     glViewport(0, 0, width, height);
 }
 
-int main(int argc, char * argv[])
+/** How much a render got done, for the --batch log. */
+struct RenderStatistics
 {
-    Helpers::RenderSettings settings;
+    double seconds;
+    uint64_t samples;
+    uint64_t acceptedOrbits;
+    uint64_t iterations;
+};
+
+/** Renders one image with the given settings, until the window is closed or one of the stop conditions is met, and writes the outputs.
+    If reportProgress is set, it is called after every frame with the progress counters read back last, and the render stops once it returns false.
+    Returns the exit code for main(), which is not 0 if one of the outputs could not be written. */
+int Render(Helpers::RenderSettings settings, Helpers::GlEngine& engine, GLFWwindow* window, RenderStatistics& renderStatistics, const std::function<bool(const Helpers::JobProgress&)>& reportProgress = nullptr)
+{
+    const bool headless{window == nullptr};
+    Helpers::ApplyCachedWorkgroupSizes(settings);
+    if(!engine.Configure(settings))
+    {
+        return 1;
+    }
 
-    if(!settings.ParseCommandLine(argc,argv))
+    const bool hasSampleBudget{settings.sampleBudget != 0};
+    const bool hasAcceptedOrbitBudget{settings.acceptedOrbitBudget != 0};
+    const uint64_t budgetTotal{hasAcceptedOrbitBudget ? settings.GetShardAcceptedOrbitBudget() : (hasSampleBudget ? settings.GetShardSampleBudget() : 0)};
+    auto getJobProgress = [&](const Helpers::EngineProgress& progress, const Helpers::EngineProgress& progressAtStart, double seconds){
+        const uint64_t done{std::min(hasAcceptedOrbitBudget ? progress.acceptedOrbits : progress.samples, budgetTotal)};
+        return Helpers::JobProgress{seconds, progress.samples - progressAtStart.samples, progress.acceptedOrbits - progressAtStart.acceptedOrbits, done, budgetTotal};
+    };
+
+    bool cancelled{false};
+    const std::chrono::microseconds previewInterval{settings.previewRate != 0 ? 1000000 / settings.previewRate : 0};
+    const Helpers::EngineProgress progressAtStart{engine.GetProgress()};
+    const auto startTime{std::chrono::high_resolution_clock::now()};
+    auto lastPreview{startTime - previewInterval};
+    /* Loop until the user closes the window */
+    while ((headless || !glfwWindowShouldClose(window)) && stopRequested == 0 && !cancelled && engine.Step())
     {
-        return 2;
+        const auto frameStart{std::chrono::high_resolution_clock::now()};
+        int framebufferWidth{0};
+        int framebufferHeight{0};
+        if(!headless)
+            glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        //nothing to draw into while the window is minimized.
+        if(!headless && framebufferWidth > 0 && framebufferHeight > 0 && frameStart - lastPreview >= previewInterval)
+        {
+            lastPreview = frameStart;
+            engine.DrawPreview(framebufferWidth, framebufferHeight);
+            /* Swap front and back buffers */
+            glfwSwapBuffers(window);
+        }
+        if(!headless)
+        {
+            /* Poll for and process events */
+            glfwPollEvents();
+        }
+        if(reportProgress)
+            cancelled = !reportProgress(getJobProgress(engine.GetProgress(), progressAtStart, std::chrono::duration<double>(frameStart-startTime).count()));
     }
+    const bool outputsWritten{engine.Finish()};
+
+    const Helpers::EngineProgress progressAtEnd{engine.GetProgress()};
+    renderStatistics.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now()-startTime).count();
+    renderStatistics.samples = progressAtEnd.samples - progressAtStart.samples;
+    renderStatistics.acceptedOrbits = progressAtEnd.acceptedOrbits - progressAtStart.acceptedOrbits;
+    renderStatistics.iterations = progressAtEnd.iterations - progressAtStart.iterations;
+    if(reportProgress)
+        reportProgress(getJobProgress(progressAtEnd, progressAtStart, renderStatistics.seconds));
+    return outputsWritten ? 0 : 1;
+}
 
-    unsigned int bufferHeight = settings.imageHeight/2;
+/** Renders through the Engine interface of the library, in steps of about a second, until the sample budget is used up, the benchmark
+    time is over or SIGINT/SIGTERM arrive. Returns the exit code for main(). */
+int RenderWithEngine(Helpers::RenderSettings settings)
+{
+    if(settings.engine == "gl")
+        Helpers::ApplyCachedWorkgroupSizes(settings);
+    auto engine = Helpers::CreateEngine(settings.engine, settings.threadCount);
+    if(!engine || !engine->Configure(settings))
+        return 1;
 
-    GLFWwindow* window;
+    const bool hasSampleBudget{settings.sampleBudget != 0};
+    const uint64_t sampleLimit{hasSampleBudget ? settings.GetShardSampleBudget() : UINT64_MAX};
+    uint64_t samplesPerStep{1 << 16};
+    const auto startTime{std::chrono::high_resolution_clock::now()};
+    auto lastProgressMessage{startTime};
+    auto measureStart{startTime};
+    Helpers::EngineProgress measureStartProgress{0, 0, 0, 0};
+    bool warmingUp{settings.benchmarkWarmup != 0};
+    while(stopRequested == 0 && engine->GetProgress().samples < sampleLimit)
+    {
+        const auto stepStart{std::chrono::high_resolution_clock::now()};
+        if(settings.benchmarkTime != 0 && std::chrono::duration_cast<std::chrono::seconds>(stepStart-startTime).count() >= settings.benchmarkTime)
+            break;
+        if(warmingUp && std::chrono::duration_cast<std::chrono::seconds>(stepStart-startTime).count() >= settings.benchmarkWarmup)
+        {
+            warmingUp = false;
+            measureStart = stepStart;
+            measureStartProgress = engine->GetProgress();
+        }
+        if(!engine->RunSamples(std::min(samplesPerStep, sampleLimit - engine->GetProgress().samples)))
+            return 1;
+        const auto stepStop{std::chrono::high_resolution_clock::now()};
+        //steps of about a second keep stopping responsive without costing throughput.
+        const double stepSeconds{std::chrono::duration<double>(stepStop-stepStart).count()};
+        samplesPerStep = static_cast<uint64_t>(samplesPerStep * std::min(2.0, std::max(0.5, 1.0 / std::max(stepSeconds, 1e-3))));
+        samplesPerStep = std::max<uint64_t>(samplesPerStep, 1024);
+
+        if(hasSampleBudget && (std::chrono::duration_cast<std::chrono::seconds>(stepStop-lastProgressMessage).count() >= 5 || engine->GetProgress().samples >= sampleLimit))
+        {
+            lastProgressMessage = stepStop;
+            const uint64_t done{engine->GetProgress().samples};
+            const double rate{done / std::chrono::duration<double>(stepStop-startTime).count()};
+            const auto ctime = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+            std::cout << std::put_time(std::localtime(&ctime),"%X") << ": " << done << "/" << sampleLimit << " samples (" << std::fixed << std::setprecision(1) << 100.0 * done / sampleLimit << "%), " <<
+                         std::setprecision(0) << rate << " per second";
+            if(rate > 0.0)
+                std::cout << ", ETA " << (sampleLimit - done) / rate << " s";
+            std::cout << std::defaultfloat << std::setprecision(6) << std::endl;
+        }
+    }
 
-    /* Initialize the library */
-    if (!glfwInit())
-        return -1;
+    if(settings.benchmarkTime != 0 || settings.printDebugOutput != 0)
+    {
+        const Helpers::EngineProgress progress{engine->GetProgress()};
+        const double seconds{std::chrono::duration<double>(std::chrono::high_resolution_clock::now()-measureStart).count()};
+        std::cout << settings.engine << " engine: " << (progress.samples - measureStartProgress.samples) / seconds << " samples, " << (progress.acceptedOrbits - measureStartProgress.acceptedOrbits) / seconds <<
+                     " accepted orbits and " << (progress.iterations - measureStartProgress.iterations) / seconds << " iterations per second." << std::endl;
+        if(settings.benchmarkTime != 0 && !settings.benchmarkOutputFilename.empty())
+        {
+            Helpers::PipelineCounters counters;
+            const bool countsHistogramWrites{engine->GetPipelineCounters(counters)};
+            Helpers::WritePipelineThroughput(settings.benchmarkOutputFilename, {(progress.samples - measureStartProgress.samples) / seconds, (progress.acceptedOrbits - measureStartProgress.acceptedOrbits) / seconds,
+                                                                                (progress.iterations - measureStartProgress.iterations) / seconds,
+                                                                                countsHistogramWrites ? (progress.histogramWrites - measureStartProgress.histogramWrites) / seconds : std::numeric_limits<double>::quiet_NaN()});
+        }
+    }
+    if(!settings.pipelineCountersFilename.empty())
+    {
+        Helpers::PipelineCounters counters;
+        const double seconds{std::chrono::duration<double>(std::chrono::high_resolution_clock::now()-startTime).count()};
+        if(!engine->GetPipelineCounters(counters))
+            std::cerr << "The " << settings.engine << " engine does not collect pipeline counters." << std::endl;
+        else
+        {
+            if(settings.printDebugOutput != 0)
+                Helpers::PrintPipelineCounters(counters, seconds);
+            Helpers::WritePipelineCounters(settings.pipelineCountersFilename, counters, seconds);
+        }
+    }
+    return engine->Export() ? 0 : 1;
+}
 
-    glfwSetErrorCallback(error_callback);
+/** Splits a line of a batch file into arguments. Arguments are separated by whitespace, double quotes group one containing spaces. */
+std::vector<std::string> SplitBatchLine(const std::string& line)
+{
+    std::vector<std::string> arguments;
+    std::string current;
+    bool inArgument{false};
+    bool quoted{false};
+    for(char c : line)
+    {
+        if(c == '"')
+        {
+            quoted = !quoted;
+            inArgument = true;
+        }
+        else if(!quoted && std::isspace(static_cast<unsigned char>(c)))
+        {
+            if(inArgument)
+                arguments.push_back(current);
+            current.clear();
+            inArgument = false;
+        }
+        else
+        {
+            current.push_back(c);
+            inArgument = true;
+        }
+    }
+    if(inArgument)
+        arguments.push_back(current);
+    return arguments;
+}
 
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+void PrintRenderStatistics(const RenderStatistics& statistics)
+{
+    std::cout << statistics.seconds << " s, " << statistics.samples << " samples (" << statistics.samples / statistics.seconds << " per second), " <<
+                 statistics.acceptedOrbits << " accepted orbits (" << statistics.acceptedOrbits / statistics.seconds << " per second), " <<
+                 statistics.iterations / statistics.seconds << " iterations per second." << std::endl;
+}
 
-    /* Create a windowed mode window and its OpenGL context */
-    window = glfwCreateWindow(settings.windowWidth, settings.windowHeight, "Buddhabrot", NULL, NULL);
-    if (!window)
+/** The command line without the given option and its value. The options of a job are appended to these, so they override them. */
+std::vector<std::string> GetBaseArguments(int argc, char * argv[], const char * jobSourceOption)
+{
+    std::vector<std::string> baseArguments;
+    for(int i = 0; i < argc; ++i)
     {
-        std::cerr << "Failed to create OpenGL 4.3 core context. We do not support compatibility contexts." << std::endl;
-        glfwTerminate();
-        return -1;
+        if(i % 2 == 1 && i + 1 < argc && std::strcmp(argv[i], jobSourceOption) == 0)
+            ++i;
+        else
+            baseArguments.emplace_back(argv[i]);
     }
+    return baseArguments;
+}
+
+/** Parses the options of a --batch or --daemon job on top of the command line. Rejects options that would need another context. */
+bool ParseJobSettings(const Helpers::RenderSettings& baseSettings, const std::vector<std::string>& baseArguments, const std::vector<std::string>& jobArguments, Helpers::RenderSettings& settings)
+{
+    std::vector<std::string> arguments{baseArguments};
+    arguments.insert(arguments.end(), jobArguments.begin(), jobArguments.end());
+    std::vector<char *> jobArgv;
+    for(auto& argument : arguments)
+        jobArgv.push_back(&argument[0]);
 
-    //register callback on window resize:
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    try
+    {
+        if(!settings.ParseCommandLine(static_cast<int>(jobArgv.size()), jobArgv.data()))
+            return false;
+    }
+    catch(const std::exception&)
+    {
+        std::cerr << "Invalid value in the options of a job." << std::endl;
+        return false;
+    }
+    if(settings.headless != baseSettings.headless || settings.windowWidth != baseSettings.windowWidth || settings.windowHeight != baseSettings.windowHeight ||
+       settings.shaderDirectory != baseSettings.shaderDirectory || settings.programCache != baseSettings.programCache || settings.programCacheDirectory != baseSettings.programCacheDirectory)
+    {
+        std::cerr << "--headless, the window size, --shaderDirectory and the program cache options concern the context, and can only be given on the command line." << std::endl;
+        return false;
+    }
+    if(settings.localShards != 0 || settings.autotuneTime != 0 || !settings.batchFilename.empty() || !settings.daemonSocket.empty())
+    {
+        std::cerr << "Jobs cannot use --localShards, --autotune, --batch or --daemon." << std::endl;
+        return false;
+    }
+    return true;
+}
 
-    /* Make the window's context current */
-    glfwMakeContextCurrent(window);
-    gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
+/** Renders the jobs of the --batch file one after another with the same context and engine. Returns the exit code for main(). */
+int RunBatch(const Helpers::RenderSettings& baseSettings, int argc, char * argv[], Helpers::GlEngine& engine, GLFWwindow* window)
+{
+    std::ifstream batchFile(baseSettings.batchFilename);
+    if(!batchFile.is_open())
+    {
+        std::cerr << "Failed to open batch file " << baseSettings.batchFilename << std::endl;
+        return 1;
+    }
 
-    //disable vsync
-    glfwSwapInterval(0);
+    const std::vector<std::string> baseArguments = GetBaseArguments(argc, argv, "--batch");
 
-    //we have a context. Let's check if input is sane.
-    //calcualte buffer size, and make sure it's allowed by the driver.
-    const unsigned int pixelCount{(settings.imageWidth * bufferHeight)};
-    if(!settings.CheckValidity())
+    unsigned int jobCount{0};
+    unsigned int failedJobs{0};
+    RenderStatistics totals{0.0, 0, 0, 0};
+    std::string line;
+    for(unsigned int lineNumber = 1; std::getline(batchFile, line); ++lineNumber)
     {
-        glfwTerminate();
+        const auto firstCharacter = line.find_first_not_of(" \t\r");
+        if(firstCharacter == std::string::npos || line[firstCharacter] == '#')
+            continue;
+        if(stopRequested != 0 || (window != nullptr && glfwWindowShouldClose(window)))
+            break;
+        ++jobCount;
+
+        Helpers::RenderSettings settings;
+        const bool valid{ParseJobSettings(baseSettings, baseArguments, SplitBatchLine(line), settings)};
+        RenderStatistics statistics{0.0, 0, 0, 0};
+        if(!valid || Render(settings, engine, window, statistics) != 0)
+        {
+            std::cout << "Job " << jobCount << " (line " << lineNumber << ") failed." << std::endl;
+            ++failedJobs;
+            continue;
+        }
+        std::cout << "Job " << jobCount << " (line " << lineNumber << "): ";
+        PrintRenderStatistics(statistics);
+        totals.seconds += statistics.seconds;
+        totals.samples += statistics.samples;
+        totals.acceptedOrbits += statistics.acceptedOrbits;
+        totals.iterations += statistics.iterations;
+    }
+
+    std::cout << "Rendered " << jobCount - failedJobs << " of " << jobCount << " jobs in " << totals.seconds << " s";
+    if(totals.seconds > 0.0)
+        std::cout << ", " << totals.samples / totals.seconds << " samples and " << totals.iterations / totals.seconds << " iterations per second";
+    std::cout << "." << std::endl;
+    return failedJobs != 0 ? 1 : 0;
+}
+
+/** Serves jobs submitted on the --daemon socket until a shutdown request, SIGINT/SIGTERM or closing the window. Returns the exit code for main(). */
+int RunDaemon(const Helpers::RenderSettings& baseSettings, int argc, char * argv[], Helpers::GlEngine& engine, GLFWwindow* window)
+{
+    const std::vector<std::string> baseArguments = GetBaseArguments(argc, argv, "--daemon");
+    Helpers::RenderDaemon daemon;
+    auto validateJob = [&baseSettings, &baseArguments](const std::vector<std::string>& jobArguments){
+        Helpers::RenderSettings settings;
+        return ParseJobSettings(baseSettings, baseArguments, jobArguments, settings);
+    };
+    if(!daemon.Start(baseSettings.daemonSocket, baseSettings.daemonQueueLimit, validateJob))
         return 1;
+    std::cout << "Waiting for jobs on " << baseSettings.daemonSocket << std::endl;
+
+    while(stopRequested == 0 && !daemon.IsShutdownRequested() && (window == nullptr || !glfwWindowShouldClose(window)))
+    {
+        Helpers::DaemonJob job;
+        if(!daemon.WaitForJob(job, std::chrono::milliseconds(200)))
+        {
+            //keeps the idle window responsive.
+            if(window != nullptr)
+                glfwPollEvents();
+            continue;
+        }
+        Helpers::RenderSettings settings;
+        RenderStatistics statistics{0.0, 0, 0, 0};
+        auto reportProgress = [&daemon, &job](const Helpers::JobProgress& progress){
+            return daemon.ReportProgress(job.id, progress);
+        };
+        //Render() fails if the outputs of the job could not be written, so the job is not reported as finished without them.
+        const bool succeeded{ParseJobSettings(baseSettings, baseArguments, job.arguments, settings) && Render(settings, engine, window, statistics, reportProgress) == 0};
+        const Helpers::JobState state{daemon.FinishJob(job.id, succeeded)};
+        std::cout << "Job " << job.id << " (priority " << job.priority << ")";
+        if(succeeded)
+        {
+            std::cout << (state == Helpers::JobState::Cancelled ? " cancelled after " : ": ");
+            PrintRenderStatistics(statistics);
+        }
+        else
+            std::cout << " failed." << std::endl;
     }
+    return 0;
+}
 
-    // Create and compile our GLSL program from the shaders
-    std::string vertexPath("Shaders/BuddhaVertex.glsl");
-    std::string fragmentPath("Shaders/BuddhaFragment.glsl");
-    std::string computePath("Shaders/BuddhaCompute.glsl");
+int main(int argc, char * argv[])
+{
+    Helpers::RenderSettings settings;
 
-    if(!Helpers::DoesFileExist(vertexPath))
+    if(!settings.ParseCommandLine(argc,argv))
     {
-#if defined _WIN32 || defined __CYGWIN__
-        std::string separator("\\");
-#else
-        std::string separator("/");
-#endif
-        vertexPath = INSTALL_PREFIX + separator + "share" + separator + "BuddhaShader" + separator + vertexPath;
-        fragmentPath = INSTALL_PREFIX + separator + "share" + separator + "BuddhaShader" + separator + fragmentPath;
-        computePath = INSTALL_PREFIX + separator + "share" + separator + "BuddhaShader" + separator + computePath;
+        return 2;
     }
 
-    GLuint VertexAndFragmentShaders = Helpers::LoadShaders(vertexPath, fragmentPath);
-    //Do the same for the compute shader:
-    GLuint ComputeShader = Helpers::LoadComputeShader(computePath, settings.localWorkgroupSizeX, settings.localWorkgroupSizeY, settings.localWorkgroupSizeZ);
-    if(VertexAndFragmentShaders == 0 || ComputeShader == 0)
+    //the coordinator only starts other processes, it does not need a context of its own.
+    if(settings.localShards != 0)
     {
-        std::cerr << "Something went wrong with loading the shaders. Abort." << std::endl;
-        glfwTerminate();
-        return 1;
+        return Helpers::RunLocalShards(settings, argc, argv);
     }
 
-    GLuint VertexArrayID;
-    glGenVertexArrays(1, &VertexArrayID);
-    glBindVertexArray(VertexArrayID);
+    std::signal(SIGINT, stop_signal_handler);
+    std::signal(SIGTERM, stop_signal_handler);
 
-    const GLfloat g_vertex_buffer_data[] = {
-        -1.0f, -1.0f, 0.0f,
-        1.0f, -1.0f, 0.0f,
-        -1.0f,  1.0f, 0.0f,
-        1.0f, 1.0f, 0.0f
-    };
+    //the cpu engine needs no context at all.
+    if(settings.engine == "cpu")
+    {
+        return RenderWithEngine(settings);
+    }
 
-    GLuint vertexbuffer;
-    glGenBuffers(1, &vertexbuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(g_vertex_buffer_data), g_vertex_buffer_data, GL_STATIC_DRAW);
-
-
-    GLuint drawBuffer;
-    glGenBuffers(1, &drawBuffer);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawBuffer);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, 4 *3* pixelCount, nullptr, GL_DYNAMIC_COPY);
-    glClearBufferData(GL_SHADER_STORAGE_BUFFER,GL_R8,GL_RED,GL_UNSIGNED_INT,nullptr);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, drawBuffer);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-
-    //the state buffer is special. While making each entry 8 bytes large and using std430 layout, the data is never read back,
-    //so we can get away with being more lenient and allowing the compiler to choose layout without much extra work.
-    //We need to query the size for allocation though.
-    GLuint stateBufferIndex = glGetProgramResourceIndex(ComputeShader,GL_SHADER_STORAGE_BLOCK,"statusBuffer");
-    GLint bufferAlignment;
-    GLenum t = GL_BUFFER_DATA_SIZE;
-    glGetProgramResourceiv(ComputeShader,GL_SHADER_STORAGE_BLOCK,stateBufferIndex,1,&t,1,nullptr,&bufferAlignment);
-    GLuint stateStructIndex = glGetProgramResourceIndex(ComputeShader,GL_BUFFER_VARIABLE,"stateArray[0].phase");
-    GLint requiredStateBufferSizePerWorker;
-    t = GL_TOP_LEVEL_ARRAY_STRIDE;
-    glGetProgramResourceiv(ComputeShader,GL_BUFFER_VARIABLE,stateStructIndex,1,&t,1,nullptr,&requiredStateBufferSizePerWorker);
-
-    const uint32_t workersPerFrame = settings.globalWorkGroupSizeX*settings.globalWorkGroupSizeY*settings.globalWorkGroupSizeZ*settings.localWorkgroupSizeX*settings.localWorkgroupSizeY*settings.localWorkgroupSizeZ;
-    auto requiredStateMemory = ((requiredStateBufferSizePerWorker*workersPerFrame + bufferAlignment -1)/bufferAlignment) * bufferAlignment;
-    GLuint stateBuffer;
-    glGenBuffers(1,&stateBuffer);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER,stateBuffer);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, (requiredStateMemory),nullptr,GL_DYNAMIC_COPY);
-    glClearBufferData(GL_SHADER_STORAGE_BUFFER,GL_R8,GL_RED,GL_UNSIGNED_INT,nullptr);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, stateBuffer);
-
-    glUseProgram(ComputeShader);
-    GLint orbitLengthUniformHandle = glGetUniformLocation(ComputeShader, "orbitLength");
-    GLint totalIterationsUniformHandle = glGetUniformLocation(ComputeShader, "totalIterations");
-    GLint widthUniformComputeHandle = glGetUniformLocation(ComputeShader, "width");
-    GLint heightUniformComputeHandle = glGetUniformLocation(ComputeShader, "height");
-    GLint iterationsPerDispatchHandle = glGetUniformLocation(ComputeShader, "iterationsPerDispatch");
-    glUniform4ui(orbitLengthUniformHandle,settings.orbitLengthRed,settings.orbitLengthGreen,settings.orbitLengthBlue,settings.orbitLengthSkip);
-    glUniform1ui(widthUniformComputeHandle, settings.imageWidth);
-    glUniform1ui(heightUniformComputeHandle, bufferHeight);
-
-    const uint32_t maxOrbitlength = std::max(std::max(settings.orbitLengthBlue,settings.orbitLengthGreen),settings.orbitLengthRed);
-    glUniform1ui(totalIterationsUniformHandle, maxOrbitlength);
-
-    glUseProgram(VertexAndFragmentShaders);
-    GLint widthUniformFragmentHandle = glGetUniformLocation(VertexAndFragmentShaders, "width");
-    GLint heightUniformFragmentHandle = glGetUniformLocation(VertexAndFragmentShaders, "height");
-    glUniform1ui(widthUniformFragmentHandle, settings.imageWidth);
-    glUniform1ui(heightUniformFragmentHandle, bufferHeight);
-    glClearColor(0.0f, 0.0f, 0.4f, 0.0f);
-
-    uint32_t iterationsPerFrame = 1;
-
-    Helpers::PIDController<float, std::chrono::high_resolution_clock::time_point::rep> pid{0.0f,0.0f,1e-4f};
-    const uint32_t targetFrameDuration{1000000/settings.targetFrameRate};
-
-    uint64_t totalIterationCount{0};
-    uint64_t lastMessage{0};
+    //without a window there is no preview, and no glfw at all. glfwTerminate() is safe to call anyhow.
+    GLFWwindow* window{nullptr};
+    Helpers::HeadlessContext headlessContext;
+    const bool headless{settings.headless != 0};
 
-    const auto startTime{std::chrono::high_resolution_clock::now()};
-    auto frameStop{startTime};
-    /* Loop until the user closes the window */
-    while (!glfwWindowShouldClose(window) && (settings.benchmarkTime == 0 || std::chrono::duration_cast<std::chrono::seconds>(frameStop-startTime).count() < settings.benchmarkTime))
-    {
-        auto frameStart{std::chrono::high_resolution_clock::now()};
-        totalIterationCount += iterationsPerFrame;
-        //let the compute shader do something
-        glUseProgram(ComputeShader);
-        glUniform1ui(iterationsPerDispatchHandle, iterationsPerFrame);
-        glDispatchCompute(settings.globalWorkGroupSizeX, settings.globalWorkGroupSizeY, settings.globalWorkGroupSizeZ);
-
-        //before reading the values in the ssbo, we need a memory barrier:
-        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT); //I hope this is the correct (and only required) bit
-
-        /* Render here */
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glUseProgram(VertexAndFragmentShaders);
-
-        glEnableVertexAttribArray(0);
-        glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-        glVertexAttribPointer(
-                    0,                  // attribute 0. No particular reason for 0, but must match the layout in the shader.
-                    3,                  // size
-                    GL_FLOAT,           // type
-                    GL_FALSE,           // normalized?
-                    0,                  // stride
-                    (void*)0            // array buffer offset
-                    );
-        // Draw the triangle strip!
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4); // Triangle strip with 4 vertices -> quad.
-        glDisableVertexAttribArray(0);
-
-        /* Swap front and back buffers */
-        glfwSwapBuffers(window);
-
-        /* Poll for and process events */
-        glfwPollEvents();
-        frameStop = std::chrono::high_resolution_clock::now();
-        const auto dur{std::chrono::duration_cast<std::chrono::microseconds>(frameStop-frameStart)};
-        auto frameDuration{dur.count()};
-        if(frameDuration > 0)
-        {
-            const auto error{targetFrameDuration - frameDuration};
-            const auto pidOutput{pid.Update(1,float(error))};
-            iterationsPerFrame = std::max(1,static_cast<int>(pidOutput));
+    if(headless)
+    {
+        if(!headlessContext.Create())
+            return -1;
+        gladLoadGLLoader(Helpers::HeadlessContext::GetProcAddress);
+    }
+    else
+    {
+        /* Initialize the library */
+        if (!glfwInit())
+            return -1;
 
-            //std::cout << iterationsPerFrame << " " << pidOutput << std::endl;
-        }
-        if(settings.printDebugOutput != 0 && totalIterationCount/maxOrbitlength > lastMessage)
+        glfwSetErrorCallback(error_callback);
+
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+        /* Create a windowed mode window and its OpenGL context */
+        window = glfwCreateWindow(settings.windowWidth, settings.windowHeight, "Buddhabrot", NULL, NULL);
+        if (!window)
         {
-            lastMessage = totalIterationCount/maxOrbitlength;
-            const auto ctime = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-            std::cout << "Iteration count next frame: " << iterationsPerFrame << std::endl;
-            std::cout << std::put_time(std::localtime(&ctime),"%X") << ": Iteration count per worker higher than: " << lastMessage*maxOrbitlength << std::endl;
-            std::cout << std::put_time(std::localtime(&ctime),"%X") << ": Total iteration count higher than: " << lastMessage*maxOrbitlength*workersPerFrame << std::endl;
+            std::cerr << "Failed to create OpenGL 4.3 core context. We do not support compatibility contexts." << std::endl;
+            glfwTerminate();
+            return -1;
         }
+
+        //register callback on window resize:
+        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+
+        /* Make the window's context current */
+        glfwMakeContextCurrent(window);
+        gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
+
+        //disable vsync
+        glfwSwapInterval(0);
     }
 
-    //settings.pngFilename = "Don'tForgetToRemoveThisLine.png";
-    if(!settings.pngFilename.empty() || settings.benchmarkTime != 0)
+    //the limits and the identity of the device are only known with a context.
+    if(settings.autotuneTime != 0)
     {
-        glMemoryBarrier(GL_ALL_BARRIER_BITS);
-        std::vector<uint32_t> readBackBuffer(pixelCount*3);
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawBuffer);
-        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER,0,4 *3* pixelCount,readBackBuffer.data());
-
-        if(settings.benchmarkTime != 0)
-            Helpers::PrintBenchmarkScore(readBackBuffer);
+        const int exitCode = Helpers::RunWorkgroupAutotune(settings, argc, argv);
+        glfwTerminate();
+        return exitCode;
+    }
 
-        if(!settings.pngFilename.empty())
-            Helpers::WriteOutputPNG(settings.pngFilename,readBackBuffer,settings.imageWidth,bufferHeight, settings.pngGamma, settings.pngColorScale);
+    Helpers::SetShaderDirectory(settings.shaderDirectory);
+    const auto shaderLoadStart{std::chrono::high_resolution_clock::now()};
+    if(settings.programCache != 0)
+        Helpers::SetProgramCacheDirectory(settings.programCacheDirectory.empty() ? Helpers::GetDefaultProgramCacheDirectory() : settings.programCacheDirectory);
+    if(!settings.engine.empty())
+    {
+        const int exitCode = RenderWithEngine(settings);
+        glfwTerminate();
+        return exitCode;
     }
 
-    //a bit of cleanup
-    glDeleteBuffers(1,&vertexbuffer);
-    glDeleteBuffers(1,&drawBuffer);
-    glDeleteBuffers(1,&stateBuffer);
+    int exitCode{0};
+    {
+        //the engine needs the context, so it has to be gone before it is.
+        Helpers::GlEngine engine(!headless);
+        if(!engine.Init(settings))
+        {
+            std::cerr << "Something went wrong with loading the shaders. Abort." << std::endl;
+            exitCode = 1;
+        }
+        else
+        {
+            if(settings.printDebugOutput != 0)
+            {
+                const auto cacheStatistics = Helpers::GetProgramCacheStatistics();
+                std::cout << "Loading the shaders took " << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - shaderLoadStart).count() << " ms, " <<
+                             cacheStatistics.hits << " of " << cacheStatistics.hits + cacheStatistics.misses << " programs came from the cache." << std::endl;
+            }
+            RenderStatistics statistics;
+            if(!settings.daemonSocket.empty())
+                exitCode = RunDaemon(settings, argc, argv, engine, window);
+            else if(!settings.batchFilename.empty())
+                exitCode = RunBatch(settings, argc, argv, engine, window);
+            else
+                exitCode = Render(settings, engine, window, statistics);
+        }
+    }
 
     glfwTerminate();
-    return 0;
+    return exitCode;
 }
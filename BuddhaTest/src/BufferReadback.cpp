@@ -0,0 +1,101 @@
+#include "BufferReadback.h"
+#include <cstring>
+
+namespace Helpers
+{
+    AsyncBufferReadback::~AsyncBufferReadback()
+    {
+        if(fence != nullptr)
+            glDeleteSync(fence);
+        if(stagingBuffer != 0)
+            glDeleteBuffers(1, &stagingBuffer);
+    }
+
+    bool AsyncBufferReadback::Start(GLuint sourceBuffer, GLsizeiptr size, GLintptr offset)
+    {
+        if(IsPending())
+            return false;
+        if(size > stagingSize)
+        {
+            //immutable storage cannot be resized, so the staging buffer is replaced. Deleting it also unmaps it.
+            if(stagingBuffer != 0)
+                glDeleteBuffers(1, &stagingBuffer);
+            glGenBuffers(1, &stagingBuffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, stagingBuffer);
+            if(GLAD_GL_ARB_buffer_storage)
+            {
+                const GLbitfield flags{GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT};
+                glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags);
+                mappedStagingBuffer = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+            }
+            else
+                glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STREAM_READ);
+            stagingSize = size;
+        }
+        else
+            glBindBuffer(GL_COPY_WRITE_BUFFER, stagingBuffer);
+        //shader writes to the source have to be visible to the copy.
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        glBindBuffer(GL_COPY_READ_BUFFER, sourceBuffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset, 0, size);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        //without a flush the fence might never reach the GPU, and would never be signaled.
+        glFlush();
+        pendingSize = size;
+        startTime = std::chrono::steady_clock::now();
+        lastPendingPoll = startTime;
+        return true;
+    }
+
+    bool AsyncBufferReadback::IsPending() const
+    {
+        return fence != nullptr;
+    }
+
+    bool AsyncBufferReadback::TryFinish(void *target)
+    {
+        if(!IsPending())
+            return false;
+        const auto pollTime = std::chrono::steady_clock::now();
+        const GLenum status = glClientWaitSync(fence, 0, 0);
+        if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        {
+            lastPendingPoll = pollTime;
+            return false;
+        }
+        lastAvoidedStall = std::chrono::duration_cast<std::chrono::microseconds>(lastPendingPoll - startTime);
+        ReadStagingBuffer(target);
+        return true;
+    }
+
+    void AsyncBufferReadback::Finish(void *target)
+    {
+        if(!IsPending())
+            return;
+        glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        lastAvoidedStall = std::chrono::microseconds{0};
+        ReadStagingBuffer(target);
+    }
+
+    std::chrono::microseconds AsyncBufferReadback::GetLastAvoidedStall() const
+    {
+        return lastAvoidedStall;
+    }
+
+    void AsyncBufferReadback::ReadStagingBuffer(void *target)
+    {
+        glDeleteSync(fence);
+        fence = nullptr;
+        if(mappedStagingBuffer != nullptr)
+        {
+            //the mapping is coherent, and the fence guarantees the copy has landed.
+            memcpy(target, mappedStagingBuffer, pendingSize);
+            return;
+        }
+        glBindBuffer(GL_COPY_READ_BUFFER, stagingBuffer);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, pendingSize, target);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+}
@@ -0,0 +1,522 @@
+#include "Engine.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+
+namespace Helpers
+{
+    namespace
+    {
+        //The sampling and orbit code mirrors BuddhaCompute.glsl. In single precision and for exponent 2 both engines draw the same orbits.
+        const uint32_t SamplesPerChunk = 4096;
+
+        uint32_t IntHash(uint32_t x)
+        {
+            x = ((x >> 16) ^ x) * 0x45d9f3bU;
+            x = ((x >> 16) ^ x) * 0x45d9f3bU;
+            x = (x >> 16) ^ x;
+            return x;
+        }
+
+        /** A number as the unevaluated sum of two doubles, hi + lo with |lo| <= ulp(hi)/2, which gives about 106 significant bits.
+            Only what the orbit loops need is implemented, with the algorithms of Hida, Li and Bailey's QD library. */
+        class DoubleDouble
+        {
+        public:
+            DoubleDouble() = default;
+            DoubleDouble(double value) : hi(value), lo(0.0) {}
+
+            explicit operator double() const
+            {
+                return hi;
+            }
+
+            friend DoubleDouble operator+(const DoubleDouble& a, const DoubleDouble& b)
+            {
+                double sumLo;
+                const double sumHi = TwoSum(a.hi, b.hi, sumLo);
+                double carryLo;
+                const double carryHi = TwoSum(a.lo, b.lo, carryLo);
+                sumLo += carryHi;
+                double hi = QuickTwoSum(sumHi, sumLo, sumLo);
+                sumLo += carryLo;
+                DoubleDouble result;
+                result.hi = QuickTwoSum(hi, sumLo, result.lo);
+                return result;
+            }
+
+            friend DoubleDouble operator-(const DoubleDouble& a, const DoubleDouble& b)
+            {
+                return a + DoubleDouble(-b.hi, -b.lo);
+            }
+
+            friend DoubleDouble operator*(const DoubleDouble& a, const DoubleDouble& b)
+            {
+                double productLo;
+                const double productHi = TwoProduct(a.hi, b.hi, productLo);
+                productLo += a.hi*b.lo + a.lo*b.hi;
+                DoubleDouble result;
+                result.hi = QuickTwoSum(productHi, productLo, result.lo);
+                return result;
+            }
+
+            DoubleDouble& operator+=(const DoubleDouble& other)
+            {
+                return *this = *this + other;
+            }
+
+            friend bool operator>(const DoubleDouble& a, const DoubleDouble& b)
+            {
+                return a.hi > b.hi || (a.hi == b.hi && a.lo > b.lo);
+            }
+        private:
+            DoubleDouble(double high, double low) : hi(high), lo(low) {}
+
+            /** a + b = sum + error exactly. */
+            static double TwoSum(double a, double b, double& error)
+            {
+                const double sum = a + b;
+                const double b2 = sum - a;
+                error = (a - (sum - b2)) + (b - b2);
+                return sum;
+            }
+
+            /** Like TwoSum, but only valid if |a| >= |b|. */
+            static double QuickTwoSum(double a, double b, double& error)
+            {
+                const double sum = a + b;
+                error = b - (sum - a);
+                return sum;
+            }
+
+            /** a * b = product + error exactly. Without a fast fma, Dekker's splitting into 26 bit halves does the same. */
+            static double TwoProduct(double a, double b, double& error)
+            {
+                const double product = a * b;
+#ifdef FP_FAST_FMA
+                error = std::fma(a, b, -product);
+#else
+                double aHi, aLo, bHi, bLo;
+                Split(a, aHi, aLo);
+                Split(b, bHi, bLo);
+                error = ((aHi*bHi - product) + aHi*bLo + aLo*bHi) + aLo*bLo;
+#endif
+                return product;
+            }
+
+            static void Split(double a, double& high, double& low)
+            {
+                const double scaled = 134217729.0 * a; //2^27 + 1
+                high = scaled - (scaled - a);
+                low = a - high;
+            }
+
+            double hi;
+            double lo;
+        };
+
+        /** Sample offsets, rejection checks and histogram cells are computed in this type, only the orbits themselves in Scalar.
+            Double-double samples are those of double precision, which resolve the 32 bit random numbers completely anyhow. */
+        template<typename Scalar> struct CoordinateOf { using Type = Scalar; };
+        template<> struct CoordinateOf<DoubleDouble> { using Type = double; };
+
+        template<typename Scalar>
+        Scalar Hash1(uint32_t seed, uint32_t& hash)
+        {
+            hash = IntHash(seed);
+            return static_cast<Scalar>(hash)/static_cast<Scalar>(0xffffffffU);
+        }
+
+        template<typename Scalar>
+        bool IsInMainCardioid(Scalar x, Scalar y)
+        {
+            //see isInMainCardioid() in BuddhaCompute.glsl for the derivation.
+            const Scalar zx = Scalar(1) - Scalar(4)*x;
+            const Scalar zy = Scalar(-4)*y;
+            const Scalar zNormSqr = zx*zx + zy*zy;
+            const Scalar rhsSqrt = Scalar(0.5)*zNormSqr - zx;
+            return rhsSqrt*rhsSqrt < zNormSqr;
+        }
+
+        template<typename Scalar>
+        bool IsInKnownCircle(Scalar x, Scalar y)
+        {
+            struct Circle
+            {
+                float centerX;
+                float centerY;
+                float radius;
+            };
+            static const Circle circles[] =
+            {
+                {-1.0f, 0.0f, 0.24999f},
+                {-0.124866818f, 0.74396884f, 0.09452088f*0.98f},
+                {0.281058181f, 0.531069896f, 0.043999991f*0.98f},
+                {0.37926948f, 0.33593786f, 0.0237270f*0.98f},
+                {0.38912506f, 0.216548077f, 0.01415882f*0.98f},
+                {0.376222674f, 0.145200726f, 0.00909100f*0.98f},
+                {0.35924728f, 0.101225755f, 0.00616879f*0.98f},
+                {0.34339510f, 0.073032700f, 0.00437060f*0.98f},
+                {0.32985010f, 0.054264593f, 0.00320580f*0.98f},
+                {0.31860462f, 0.0413441289f, 0.002419144f*0.98f},
+                {0.30933816f, 0.032184347f, 0.001869337f*0.98f}
+            };
+            for(const Circle& circle : circles)
+            {
+                const Scalar shiftedX = x - circle.centerX;
+                const Scalar shiftedY = std::fabs(y) - circle.centerY;
+                if(shiftedX*shiftedX + shiftedY*shiftedY < Scalar(circle.radius)*Scalar(circle.radius))
+                    return true;
+            }
+            return false;
+        }
+
+        /** z = z^exponent + c. For exponent 2 this gives the same values as the shader's x*x - y*y, 2*x*y. */
+        template<typename Scalar>
+        void Iterate(Scalar& x, Scalar& y, Scalar offsetX, Scalar offsetY, unsigned int exponent)
+        {
+            const Scalar baseX = x;
+            const Scalar baseY = y;
+            for(unsigned int power = 1; power < exponent; ++power)
+            {
+                const Scalar newX = x*baseX - y*baseY;
+                y = x*baseY + y*baseX;
+                x = newX;
+            }
+            x += offsetX;
+            y += offsetY;
+        }
+
+        /** Everything a kernel needs to know about the render. Fixed from Configure() on. */
+        struct KernelContext
+        {
+            std::atomic<uint32_t> * histogram;
+            unsigned int width;
+            unsigned int bufferHeight;
+            //1 if all orbit lengths are equal. The histogram then has only one count per cell, which stands for all three colors.
+            unsigned int channels;
+            uint32_t orbitLengthRed;
+            uint32_t orbitLengthGreen;
+            uint32_t orbitLengthBlue;
+            uint32_t orbitLengthSkip;
+            uint32_t totalIterations;
+            unsigned int exponent;
+            unsigned int shardIndex;
+            unsigned int shardCount;
+            unsigned int randomSeed;
+        };
+
+        /** Where the work went, like the pipeline counters of the compute shader. Counting is a few additions per orbit, so it is always on. */
+        struct KernelTotals
+        {
+            uint64_t rejectedByMainCardioid;
+            uint64_t rejectedByKnownCircle;
+            uint64_t rejectedNotEscaping;
+            uint64_t rejectedTooShort;
+            uint64_t acceptedOrbits;
+            uint64_t escapeCheckIterations;
+            uint64_t drawIterations;
+            uint64_t histogramWrites;
+        };
+
+        void AddTotals(KernelTotals& sum, const KernelTotals& part)
+        {
+            sum.rejectedByMainCardioid += part.rejectedByMainCardioid;
+            sum.rejectedByKnownCircle += part.rejectedByKnownCircle;
+            sum.rejectedNotEscaping += part.rejectedNotEscaping;
+            sum.rejectedTooShort += part.rejectedTooShort;
+            sum.acceptedOrbits += part.acceptedOrbits;
+            sum.escapeCheckIterations += part.escapeCheckIterations;
+            sum.drawIterations += part.drawIterations;
+            sum.histogramWrites += part.histogramWrites;
+        }
+
+        /** Processes one sample. Channels and Exponent of 0 mean the values of the context are used at runtime, with Skip false the
+            orbit length skip is known to be 0 and not checked. So ProcessSample<Scalar, 0, 0, true> is the generic kernel that
+            handles every render, all others are specializations for the common cases. */
+        template<typename Scalar, unsigned int Channels, unsigned int Exponent, bool Skip>
+        void ProcessSample(const KernelContext& context, uint64_t sampleIndex, KernelTotals& totals)
+        {
+            using Coordinate = typename CoordinateOf<Scalar>::Type;
+            const unsigned int exponent{Exponent != 0 ? Exponent : context.exponent};
+            const unsigned int channels{Channels != 0 ? Channels : context.channels};
+
+            //The sample space is shared by all shards, every shard takes every shardCount-th sample.
+            const uint64_t globalIndex{sampleIndex * context.shardCount + context.shardIndex};
+            const uint32_t low{static_cast<uint32_t>(globalIndex)};
+            const uint32_t high{static_cast<uint32_t>(globalIndex >> 32)};
+            uint32_t seed = low ^ IntHash(high ^ IntHash(context.randomSeed));
+            const Coordinate randomX = Hash1<Coordinate>(seed, seed);
+            seed = (seed ^ (IntHash(high + 0x9e3779b9U)));
+            const Coordinate randomY = Hash1<Coordinate>(seed, seed);
+            const Coordinate sampleX = randomX * Coordinate(4.025f) - Coordinate(2.875f);
+            const Coordinate sampleY = randomY * Coordinate(1.8f);
+
+            //the cardioid and the circles are those of the exponent 2 set.
+            if(exponent == 2 && IsInMainCardioid(sampleX, sampleY))
+            {
+                ++totals.rejectedByMainCardioid;
+                return;
+            }
+            if(exponent == 2 && IsInKnownCircle(sampleX, sampleY))
+            {
+                ++totals.rejectedByKnownCircle;
+                return;
+            }
+
+            const Scalar offsetX{sampleX};
+            const Scalar offsetY{sampleY};
+            Scalar x{0};
+            Scalar y{0};
+            uint32_t escapeIteration{0};
+            for(uint32_t i = 0; i < context.totalIterations && escapeIteration == 0; ++i)
+            {
+                Iterate(x, y, offsetX, offsetY, exponent);
+                if(x*x + y*y > Scalar(4))
+                    escapeIteration = i + 1;
+            }
+            totals.escapeCheckIterations += escapeIteration != 0 ? escapeIteration : context.totalIterations;
+            if(escapeIteration == 0)
+            {
+                ++totals.rejectedNotEscaping;
+                return;
+            }
+            if(Skip && escapeIteration <= context.orbitLengthSkip)
+            {
+                ++totals.rejectedTooShort;
+                return;
+            }
+
+            ++totals.acceptedOrbits;
+            x = Scalar(0);
+            y = Scalar(0);
+            for(uint32_t i = 0; i < context.totalIterations; ++i)
+            {
+                ++totals.drawIterations;
+                Iterate(x, y, offsetX, offsetY, exponent);
+                if(x*x + y*y > Scalar(20))
+                    break;
+                const Coordinate pointX{static_cast<Coordinate>(x)};
+                const Coordinate pointY{static_cast<Coordinate>(y)};
+                if(!(pointX > Coordinate(-2.875f) && pointX < Coordinate(1.15f) && pointY > Coordinate(-1.15f) && pointY < Coordinate(1.15f)))
+                    continue;
+                ++totals.histogramWrites;
+                const Coordinate u = std::min(Coordinate(1), std::max(Coordinate(0), (pointX + Coordinate(2.875f))/Coordinate(4.025f)));
+                const Coordinate v = std::min(Coordinate(1), std::max(Coordinate(0), std::fabs(pointY/Coordinate(1.15f))));
+                //the shader relies on the viewport check to stay inside the buffer. Rounding could still hit the far edge, which is clamped here.
+                const unsigned int cellX = std::min(static_cast<unsigned int>(context.width * u), context.width - 1);
+                const unsigned int cellY = std::min(static_cast<unsigned int>(context.bufferHeight * v), context.bufferHeight - 1);
+                std::atomic<uint32_t> * cell = context.histogram + channels*(cellX + static_cast<size_t>(cellY)*context.width);
+                if(channels == 1)
+                {
+                    cell[0].fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                if(i < context.orbitLengthRed)
+                    cell[0].fetch_add(1, std::memory_order_relaxed);
+                if(i < context.orbitLengthGreen)
+                    cell[1].fetch_add(1, std::memory_order_relaxed);
+                if(i < context.orbitLengthBlue)
+                    cell[2].fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        using Kernel = void (*)(const KernelContext&, uint64_t, KernelTotals&);
+
+        struct KernelEntry
+        {
+            std::string precision;
+            unsigned int channels;
+            unsigned int exponent;
+            bool skip;
+            Kernel kernel;
+        };
+
+        template<typename Scalar> const char * PrecisionName();
+        template<> const char * PrecisionName<float>() { return "float"; }
+        template<> const char * PrecisionName<double>() { return "double"; }
+        template<> const char * PrecisionName<DoubleDouble>() { return "doubledouble"; }
+
+        template<typename Scalar, unsigned int Channels, unsigned int Exponent>
+        void AddKernels(std::vector<KernelEntry>& table)
+        {
+            table.push_back({PrecisionName<Scalar>(), Channels, Exponent, false, &ProcessSample<Scalar, Channels, Exponent, false>});
+            table.push_back({PrecisionName<Scalar>(), Channels, Exponent, true, &ProcessSample<Scalar, Channels, Exponent, true>});
+        }
+
+        template<typename Scalar>
+        void AddKernels(std::vector<KernelEntry>& table)
+        {
+            AddKernels<Scalar, 1, 2>(table);
+            AddKernels<Scalar, 3, 2>(table);
+            AddKernels<Scalar, 1, 3>(table);
+            AddKernels<Scalar, 3, 3>(table);
+            AddKernels<Scalar, 1, 4>(table);
+            AddKernels<Scalar, 3, 4>(table);
+        }
+
+        /** The specialized kernels, for exponents 2 to 4 in all combinations of the other parameters. */
+        const std::vector<KernelEntry>& GetKernelTable()
+        {
+            static const std::vector<KernelEntry> table = []{
+                std::vector<KernelEntry> kernels;
+                AddKernels<float>(kernels);
+                AddKernels<double>(kernels);
+                AddKernels<DoubleDouble>(kernels);
+                return kernels;
+            }();
+            return table;
+        }
+
+        Kernel GetGenericKernel(const std::string& precision)
+        {
+            if(precision == "doubledouble")
+                return &ProcessSample<DoubleDouble, 0, 0, true>;
+            return precision == "double" ? &ProcessSample<double, 0, 0, true> : &ProcessSample<float, 0, 0, true>;
+        }
+
+        class CpuEngine : public Engine
+        {
+        public:
+            explicit CpuEngine(unsigned int threads) : threadCount(threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency())) {}
+
+            bool Configure(const RenderSettings& newSettings) override
+            {
+                settings = newSettings;
+                if(settings.imageHeight%2 != 0)
+                {
+                    std::cerr << "Image height has to be an even number." << std::endl;
+                    return false;
+                }
+                context.width = settings.imageWidth;
+                context.bufferHeight = settings.imageHeight/2;
+                context.channels = (settings.orbitLengthRed == settings.orbitLengthGreen && settings.orbitLengthRed == settings.orbitLengthBlue) ? 1 : 3;
+                context.orbitLengthRed = settings.orbitLengthRed;
+                context.orbitLengthGreen = settings.orbitLengthGreen;
+                context.orbitLengthBlue = settings.orbitLengthBlue;
+                context.orbitLengthSkip = settings.orbitLengthSkip;
+                context.totalIterations = std::max(std::max(settings.orbitLengthRed, settings.orbitLengthGreen), settings.orbitLengthBlue);
+                context.exponent = settings.exponent;
+                context.shardIndex = settings.shardIndex;
+                context.shardCount = settings.shardCount;
+                context.randomSeed = settings.randomSeed;
+
+                kernel = SelectKernel();
+                //value initialization zeroes the counts.
+                histogram.reset(new std::atomic<uint32_t>[context.channels*static_cast<size_t>(context.width)*context.bufferHeight]());
+                context.histogram = histogram.get();
+                expandedCounts.clear();
+                progress = EngineProgress{0, 0, 0, 0};
+                totals = KernelTotals{};
+                return true;
+            }
+
+            bool RunSamples(uint64_t sampleCount) override
+            {
+                const uint64_t firstSample{progress.samples};
+                const uint64_t sampleLimit{firstSample + sampleCount};
+                std::atomic<uint64_t> nextChunk{0};
+                std::mutex totalsMutex;
+                std::vector<std::thread> threads;
+                for(unsigned int i = 0; i < threadCount; ++i)
+                {
+                    threads.emplace_back([&]{
+                        KernelTotals threadTotals{};
+                        for(uint64_t chunkStart = firstSample + SamplesPerChunk * nextChunk++; chunkStart < sampleLimit; chunkStart = firstSample + SamplesPerChunk * nextChunk++)
+                        {
+                            const uint64_t chunkEnd{std::min<uint64_t>(chunkStart + SamplesPerChunk, sampleLimit)};
+                            for(uint64_t sample = chunkStart; sample < chunkEnd; ++sample)
+                                kernel(context, sample, threadTotals);
+                        }
+                        std::lock_guard<std::mutex> lock(totalsMutex);
+                        AddTotals(totals, threadTotals);
+                    });
+                }
+                for(auto& thread : threads)
+                    thread.join();
+                progress.samples = sampleLimit;
+                progress.acceptedOrbits = totals.acceptedOrbits;
+                //starting a sample counts as one iteration, as in the pipeline counters.
+                progress.iterations = progress.samples + totals.escapeCheckIterations + totals.drawIterations;
+                progress.histogramWrites = totals.histogramWrites;
+                expandedCounts.clear();
+                return true;
+            }
+
+            bool GetPipelineCounters(PipelineCounters& counters) const override
+            {
+                counters = PipelineCounters{};
+                counters.values[StartedSamples] = progress.samples;
+                counters.values[RejectedByMainCardioid] = totals.rejectedByMainCardioid;
+                counters.values[RejectedByKnownCircle] = totals.rejectedByKnownCircle;
+                counters.values[RejectedNotEscaping] = totals.rejectedNotEscaping;
+                counters.values[RejectedTooShort] = totals.rejectedTooShort;
+                counters.values[DrawnOrbits] = totals.acceptedOrbits;
+                counters.values[EscapeCheckIterations] = totals.escapeCheckIterations;
+                counters.values[DrawIterations] = totals.drawIterations;
+                counters.values[HistogramWrites] = totals.histogramWrites;
+                return true;
+            }
+
+            EngineProgress GetProgress() const override
+            {
+                return progress;
+            }
+
+            HistogramView Snapshot() override
+            {
+                static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "The histogram is handed out as plain counts");
+                const uint32_t * counts = reinterpret_cast<const uint32_t *>(histogram.get());
+                if(context.channels == 3)
+                    return HistogramView{counts, context.width, context.bufferHeight};
+                //monochrome renders have a count per cell instead of one per color, this is the only case a snapshot is a copy.
+                if(expandedCounts.empty())
+                {
+                    const size_t cellCount{static_cast<size_t>(context.width)*context.bufferHeight};
+                    expandedCounts.resize(3*cellCount);
+                    for(size_t cell = 0; cell < cellCount; ++cell)
+                        std::fill_n(expandedCounts.begin() + 3*cell, 3, counts[cell]);
+                }
+                return HistogramView{expandedCounts.data(), context.width, context.bufferHeight};
+            }
+        private:
+            Kernel SelectKernel() const
+            {
+                const bool skip{settings.orbitLengthSkip != 0};
+                if(settings.cpuKernel != "generic")
+                {
+                    for(const KernelEntry& entry : GetKernelTable())
+                    {
+                        if(entry.precision == settings.precision && entry.channels == context.channels && entry.exponent == context.exponent && entry.skip == skip)
+                        {
+                            if(settings.printDebugOutput != 0)
+                                std::cout << "CPU kernel: " << entry.precision << ", " << entry.channels << " channel(s), exponent " << entry.exponent << (entry.skip ? ", with" : ", without") << " orbit length skip." << std::endl;
+                            return entry.kernel;
+                        }
+                    }
+                }
+                if(settings.printDebugOutput != 0)
+                    std::cout << "CPU kernel: generic, " << settings.precision << "." << std::endl;
+                return GetGenericKernel(settings.precision);
+            }
+
+            const unsigned int threadCount;
+            std::unique_ptr<std::atomic<uint32_t>[]> histogram;
+            std::vector<uint32_t> expandedCounts;
+            KernelContext context{};
+            Kernel kernel{nullptr};
+            EngineProgress progress{0, 0, 0, 0};
+            KernelTotals totals{};
+        };
+    }
+
+    std::unique_ptr<Engine> CreateCpuEngine(unsigned int threadCount)
+    {
+        return std::unique_ptr<Engine>(new CpuEngine(threadCount));
+    }
+}
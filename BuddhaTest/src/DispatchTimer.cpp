@@ -0,0 +1,98 @@
+#include "DispatchTimer.h"
+#include <algorithm>
+#include <cmath>
+
+namespace Helpers
+{
+    DispatchTimer::DispatchTimer(unsigned int maxQueriesInFlight) : allQueries(maxQueriesInFlight)
+    {
+        glGenQueries(maxQueriesInFlight, allQueries.data());
+        freeQueries = allQueries;
+    }
+
+    DispatchTimer::~DispatchTimer()
+    {
+        glDeleteQueries(static_cast<GLsizei>(allQueries.size()), allQueries.data());
+    }
+
+    bool DispatchTimer::Begin()
+    {
+        if(freeQueries.empty())
+            return false;
+        glBeginQuery(GL_TIME_ELAPSED, freeQueries.back());
+        return true;
+    }
+
+    void DispatchTimer::End(uint32_t iterations, double predictedNanoseconds)
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        pendingQueries.push_back({freeQueries.back(), {iterations, predictedNanoseconds, 0.0}});
+        freeQueries.pop_back();
+    }
+
+    bool DispatchTimer::TryGetResult(DispatchMeasurement &result)
+    {
+        if(pendingQueries.empty())
+            return false;
+        PendingQuery& oldest = pendingQueries.front();
+        GLuint available{GL_FALSE};
+        glGetQueryObjectuiv(oldest.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if(available == GL_FALSE)
+            return false;
+        GLuint64 nanoseconds{0};
+        glGetQueryObjectui64v(oldest.query, GL_QUERY_RESULT, &nanoseconds);
+        result = oldest.measurement;
+        result.measuredNanoseconds = static_cast<double>(nanoseconds);
+        freeQueries.push_back(oldest.query);
+        pendingQueries.pop_front();
+        return true;
+    }
+
+    void ThroughputModel::AddMeasurement(uint32_t iterations, double nanoseconds)
+    {
+        //each measurement weighs about as much as the last 10 together.
+        const double fade{0.9};
+        const double x{static_cast<double>(iterations)};
+        weightSum = weightSum * fade + 1.0;
+        iterationSum = iterationSum * fade + x;
+        timeSum = timeSum * fade + nanoseconds;
+        iterationSquaredSum = iterationSquaredSum * fade + x * x;
+        iterationTimeSum = iterationTimeSum * fade + x * nanoseconds;
+    }
+
+    bool ThroughputModel::HasEstimate() const
+    {
+        return iterationSum > 0.0 && timeSum > 0.0;
+    }
+
+    void ThroughputModel::GetCoefficients(double &overhead, double &timePerIteration) const
+    {
+        const double determinant{weightSum * iterationSquaredSum - iterationSum * iterationSum};
+        overhead = 0.0;
+        //if the iteration count barely changed, the overhead cannot be told apart from the per iteration cost.
+        if(determinant > 1e-6 * weightSum * iterationSquaredSum)
+            overhead = std::max(0.0, (iterationSquaredSum * timeSum - iterationSum * iterationTimeSum) / determinant);
+        timePerIteration = std::max((timeSum - overhead * weightSum) / iterationSum, 0.0);
+        if(timePerIteration == 0.0)
+        {
+            overhead = 0.0;
+            timePerIteration = timeSum / iterationSum;
+        }
+    }
+
+    double ThroughputModel::PredictNanoseconds(uint32_t iterations) const
+    {
+        double overhead, timePerIteration;
+        GetCoefficients(overhead, timePerIteration);
+        return overhead + timePerIteration * iterations;
+    }
+
+    uint32_t ThroughputModel::IterationsFor(double nanoseconds, uint32_t currentIterations) const
+    {
+        double overhead, timePerIteration;
+        GetCoefficients(overhead, timePerIteration);
+        const double iterations{std::floor((nanoseconds - overhead) / timePerIteration)};
+        const double maxIterations{std::min(2.0 * std::max(currentIterations, 1u), 1073741824.0)};
+        return static_cast<uint32_t>(std::max(1.0, std::min(iterations, maxIterations)));
+    }
+}
@@ -0,0 +1,43 @@
+#include "Engine.h"
+#include "HistogramFile.h"
+#include <iostream>
+
+namespace Helpers
+{
+    bool Engine::Export()
+    {
+        const HistogramView view = Snapshot();
+        if(view.counts == nullptr)
+            return false;
+        const EngineProgress progress = GetProgress();
+        bool success{true};
+        if(!settings.histogramFilename.empty())
+        {
+            HistogramFile file;
+            file.header = MakeHistogramFileHeader(view.width, view.bufferHeight, settings.orbitLengthSkip, settings.orbitLengthRed, settings.orbitLengthGreen, settings.orbitLengthBlue, settings.shardIndex, settings.shardCount, settings.randomSeed, settings.exponent, settings.precision);
+            file.header.sampleCount = progress.samples;
+            file.header.claimedSampleCount = progress.samples;
+            file.header.iterationCount = progress.iterations;
+            file.header.acceptedOrbitCount = progress.acceptedOrbits;
+            file.counts.assign(view.counts, view.counts + 3*static_cast<size_t>(view.width)*view.bufferHeight);
+            success = WriteHistogramFile(settings.histogramFilename, file, false) && success;
+        }
+        if(!settings.pngFilename.empty())
+            success = WriteHistogramPNG(settings.pngFilename, view.counts, view.width, view.bufferHeight, settings.pngGamma, settings.pngColorScale, settings.pngBitDepth) && success;
+        return success;
+    }
+
+    bool Engine::GetPipelineCounters(PipelineCounters &) const
+    {
+        return false;
+    }
+
+    std::unique_ptr<Engine> CreateEngine(const std::string &name, unsigned int threadCount)
+    {
+        if(name == "gl")
+            return CreateGlEngine();
+        if(name == "cpu")
+            return CreateCpuEngine(threadCount);
+        return nullptr;
+    }
+}
@@ -0,0 +1,1061 @@
+#include "GlEngine.h"
+#include "HistogramFile.h"
+#include "BufferReadback.h"
+#include "DispatchTimer.h"
+#include "ProgramCache.h"
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <chrono>
+#include <iomanip>
+#include <algorithm>
+#include <iterator>
+#include <future>
+#include <limits>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+
+namespace Helpers
+{
+    namespace
+    {
+        /** Reads everything a histogram file consists of from the GPU without stalling the rendering. The copies of all buffers are queued
+            right after each other, so they show the same state. The statistics of the histogram are computed and read back along with it.
+            Instead of or in addition to the raw counts, the image tone mapped by the GPU can be read. */
+        class HistogramCapture
+        {
+        public:
+            HistogramCapture(const RenderSettings& settings, HistogramReduction& reduction, GpuToneMapper& toneMapper, GLuint drawBuffer, GLuint stateBuffer, GLuint sampleQueueBuffer, unsigned int pixelCount, uint32_t workerCount, uint32_t queuedStateCount, uint64_t sampleIndexBase, uint32_t samplesPerChunk, uint64_t sampleLimit)
+                : settings(settings), reduction(reduction), toneMapper(toneMapper), drawBuffer(drawBuffer), stateBuffer(stateBuffer), sampleQueueBuffer(sampleQueueBuffer), pixelCount(pixelCount),
+                  workerCount(workerCount), queuedStateCount(queuedStateCount), sampleIndexBase(sampleIndexBase), samplesPerChunk(samplesPerChunk), sampleLimit(sampleLimit)
+            {}
+
+            bool IsPending() const
+            {
+                return sampleQueueReadback.IsPending();
+            }
+
+            /** The header and the worker states are always read. Without counts the HistogramFile only holds those. */
+            void Start(uint64_t iterationsPerWorkerAtStart, bool readCounts = true, bool readImage = false)
+            {
+                iterationsPerWorker = iterationsPerWorkerAtStart;
+                withCounts = readCounts;
+                withImage = readImage;
+                reduction.Run(drawBuffer, pixelCount);
+                statisticsReadback.Start(reduction.GetBuffer(), sizeof(HistogramStatistics));
+                if(withImage)
+                {
+                    toneMapper.Run(settings.pngGamma, settings.pngColorScale);
+                    imageReadback.Start(toneMapper.GetBuffer(), toneMapper.GetImageSize());
+                }
+                if(withCounts)
+                    countReadback.Start(drawBuffer, 4 * 3 * pixelCount);
+                stateReadback.Start(stateBuffer, sizeof(WorkerState) * workerCount);
+                sampleQueueReadback.Start(sampleQueueBuffer, sizeof(SampleQueueHeader) + sizeof(WorkerState) * queuedStateCount);
+            }
+
+            bool TryFinish(HistogramFile& file)
+            {
+                //fences are signaled in order, so once the last copy is done, the others are as well.
+                PrepareTargets(file);
+                if(!sampleQueueReadback.TryFinish(sampleQueueData.data()))
+                    return false;
+                statisticsReadback.Finish(&statistics);
+                if(withImage)
+                    imageReadback.Finish(image.data());
+                if(withCounts)
+                    countReadback.Finish(file.counts.data());
+                stateReadback.Finish(workerStates.data());
+                BuildFile(file);
+                return true;
+            }
+
+            void Finish(HistogramFile& file)
+            {
+                PrepareTargets(file);
+                sampleQueueReadback.Finish(sampleQueueData.data());
+                statisticsReadback.Finish(&statistics);
+                if(withImage)
+                    imageReadback.Finish(image.data());
+                if(withCounts)
+                    countReadback.Finish(file.counts.data());
+                stateReadback.Finish(workerStates.data());
+                BuildFile(file);
+            }
+
+            std::chrono::microseconds GetLastAvoidedStall() const
+            {
+                return sampleQueueReadback.GetLastAvoidedStall();
+            }
+
+            /** The statistics of the histogram read by the last finished capture. */
+            const HistogramStatistics& GetStatistics() const
+            {
+                return statistics;
+            }
+
+            /** The tone mapped image read by the last finished capture, if it was requested. May be moved from. */
+            std::vector<uint8_t>& GetImage()
+            {
+                return image;
+            }
+
+        private:
+            void PrepareTargets(HistogramFile& file)
+            {
+                if(withCounts)
+                    file.counts.resize(3*pixelCount);
+                else
+                    file.counts.clear();
+                if(withImage)
+                    image.resize(toneMapper.GetImageSize());
+                workerStates.resize(workerCount);
+                sampleQueueData.resize(sizeof(SampleQueueHeader) + sizeof(WorkerState) * queuedStateCount);
+            }
+
+            void BuildFile(HistogramFile& file)
+            {
+                file.header = MakeHistogramFileHeader(settings.imageWidth, settings.imageHeight/2, settings.orbitLengthSkip, settings.orbitLengthRed, settings.orbitLengthGreen, settings.orbitLengthBlue, settings.shardIndex, settings.shardCount, settings.randomSeed, settings.exponent, settings.precision);
+                SampleQueueHeader sampleQueue;
+                memcpy(&sampleQueue, sampleQueueData.data(), sizeof(sampleQueue));
+                if(sampleQueue.nextPendingState < sampleQueue.pendingStateCount)
+                {
+                    //states restored from an earlier checkpoint that no worker has picked up yet.
+                    const auto firstPending = workerStates.size();
+                    workerStates.resize(firstPending + sampleQueue.pendingStateCount - sampleQueue.nextPendingState);
+                    memcpy(workerStates.data() + firstPending, sampleQueueData.data() + sizeof(sampleQueue) + sizeof(WorkerState) * sampleQueue.nextPendingState, sizeof(WorkerState) * (workerStates.size() - firstPending));
+                }
+
+                //Workers that went idle because the accepted orbit budget was used up may still hold samples. Those restart from the escape check,
+                //so a larger budget can continue them. Workers that went idle because no samples were left hold none.
+                for(auto& state : workerStates)
+                {
+                    if(state.phase == 3)
+                    {
+                        state.phase = 0;
+                        state.doneIterations = 0;
+                        state.lastPositionX = 0.0f;
+                        state.lastPositionY = 0.0f;
+                    }
+                }
+                //only states with unfinished work need to be stored.
+                file.workerStates.clear();
+                std::copy_if(workerStates.begin(), workerStates.end(), std::back_inserter(file.workerStates), [](const WorkerState& state){ return state.phase != 0 || state.sampleIndex != state.sampleEnd; });
+
+                //chunks claimed past the sample limit were never handed out.
+                file.header.claimedSampleCount = std::min(sampleIndexBase + static_cast<uint64_t>(sampleQueue.claimedChunks) * samplesPerChunk, std::max(sampleLimit, sampleIndexBase));
+                file.header.sampleCount = sampleQueue.finishedSamples;
+                file.header.acceptedOrbitCount = sampleQueue.drawnOrbits;
+                file.header.iterationCount = iterationsPerWorker * workerCount;
+            }
+
+            const RenderSettings& settings;
+            HistogramReduction& reduction;
+            GpuToneMapper& toneMapper;
+            const GLuint drawBuffer;
+            const GLuint stateBuffer;
+            const GLuint sampleQueueBuffer;
+            const unsigned int pixelCount;
+            const uint32_t workerCount;
+            const uint32_t queuedStateCount;
+            const uint64_t sampleIndexBase;
+            const uint32_t samplesPerChunk;
+            const uint64_t sampleLimit;
+            uint64_t iterationsPerWorker{0};
+            bool withCounts{true};
+            bool withImage{false};
+
+            AsyncBufferReadback statisticsReadback;
+            AsyncBufferReadback imageReadback;
+            AsyncBufferReadback countReadback;
+            AsyncBufferReadback stateReadback;
+            AsyncBufferReadback sampleQueueReadback;
+            std::vector<WorkerState> workerStates;
+            std::vector<char> sampleQueueData;
+            HistogramStatistics statistics{};
+            std::vector<uint8_t> image;
+        };
+
+        bool RestoreCheckpoint(const RenderSettings& settings, GLuint drawBuffer, unsigned int pixelCount, uint32_t workerCount, std::vector<WorkerState>& pendingStates, uint64_t& sampleIndexBase, uint64_t& iterationsPerWorker, SampleQueueHeader& counters, uint64_t& acceptedOrbitCount)
+        {
+            HistogramFile checkpoint;
+            if(!ReadHistogramFile(settings.resumeFilename, checkpoint))
+                return false;
+            const auto& header = checkpoint.header;
+            if(header.width != settings.imageWidth || header.bufferHeight != settings.imageHeight/2 ||
+                    header.orbitLengthSkip != settings.orbitLengthSkip || header.orbitLengthRed != settings.orbitLengthRed ||
+                    header.orbitLengthGreen != settings.orbitLengthGreen || header.orbitLengthBlue != settings.orbitLengthBlue ||
+                    header.shardIndex != settings.shardIndex || header.shardCount != settings.shardCount || header.randomSeed != settings.randomSeed || header.exponent != settings.exponent)
+            {
+                std::cerr << "The checkpoint " << settings.resumeFilename << " was rendered with a different image size, different orbit lengths, a different seed, a different shard or a different exponent." << std::endl;
+                return false;
+            }
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawBuffer);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, 4 * 3 * pixelCount, checkpoint.counts.data());
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+            //the unfinished states get continued by whichever workers need work first, and all new samples start after the claimed ones.
+            pendingStates = std::move(checkpoint.workerStates);
+            sampleIndexBase = header.claimedSampleCount;
+            iterationsPerWorker = header.iterationCount / workerCount;
+            //orbits that are still being drawn have already passed the accepted orbit budget check.
+            counters.finishedSamples = header.sampleCount;
+            counters.drawnOrbits = header.acceptedOrbitCount;
+            acceptedOrbitCount = header.acceptedOrbitCount + std::count_if(pendingStates.begin(), pendingStates.end(), [](const WorkerState& state){ return state.phase == 2; });
+            counters.acceptedOrbits = static_cast<uint32_t>(acceptedOrbitCount);
+            return true;
+        }
+
+        /** Samples are handed out in chunks, so the 32 bit chunk counter in the shader suffices for 2^48 samples. With a limited number of
+            samples the chunks get smaller, so the last ones are spread over all workers instead of leaving most of them idle. */
+        uint32_t GetSamplesPerChunk(uint64_t sampleCount, uint32_t workerCount)
+        {
+            return static_cast<uint32_t>(std::max<uint64_t>(1, std::min<uint64_t>(1 << 16, sampleCount / (16 * static_cast<uint64_t>(workerCount)))));
+        }
+
+        void ReportAvoidedStall(const RenderSettings& settings, const char * what, std::chrono::microseconds avoidedStall)
+        {
+            if(settings.printDebugOutput != 0)
+                std::cout << what << " read back while rendering continued. A synchronous read would have stalled for at least " << avoidedStall.count() / 1000.0 << " ms." << std::endl;
+        }
+    }
+
+    ReusableBuffer::~ReusableBuffer()
+    {
+        if(buffer != 0)
+            glDeleteBuffers(1, &buffer);
+    }
+
+    GLuint ReusableBuffer::Reserve(GLsizeiptr size)
+    {
+        if(buffer == 0)
+            glGenBuffers(1, &buffer);
+        if(size > capacity)
+        {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, size, nullptr, GL_DYNAMIC_COPY);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+            capacity = size;
+        }
+        return buffer;
+    }
+
+    GLuint ReusableBuffer::Get() const
+    {
+        return buffer;
+    }
+
+    struct GlEngine::RenderState
+    {
+        RenderState(const RenderSettings& settings, HistogramReduction& reduction, GpuToneMapper& toneMapper, GLuint drawBuffer, GLuint stateBuffer, GLuint sampleQueueBuffer, unsigned int pixelCount, uint32_t workerCount, uint32_t queuedStateCount, uint64_t sampleIndexBase, uint32_t samplesPerChunk, uint64_t sampleLimit)
+            : histogramCapture(settings, reduction, toneMapper, drawBuffer, stateBuffer, sampleQueueBuffer, pixelCount, workerCount, queuedStateCount, sampleIndexBase, samplesPerChunk, sampleLimit),
+              snapshotCapture(settings, reduction, toneMapper, drawBuffer, stateBuffer, sampleQueueBuffer, pixelCount, workerCount, queuedStateCount, sampleIndexBase, samplesPerChunk, sampleLimit)
+        {}
+        ~RenderState()
+        {
+            if(previousDispatchFence != nullptr)
+                glDeleteSync(previousDispatchFence);
+        }
+
+        bool IsBudgetUsedUp() const
+        {
+            return (hasSampleBudget && progress.finishedSamples >= sampleLimit) || (hasAcceptedOrbitBudget && progress.drawnOrbits >= acceptedOrbitLimit);
+        }
+
+        unsigned int pixelCount{0};
+        uint32_t workerCount{0};
+        uint32_t maxOrbitLength{0};
+        bool collectPipelineCounters{false};
+        GLint iterationsPerDispatchHandle{-1};
+        GLint sampleIndexBaseHandle{-1};
+        GLint samplesPerChunkHandle{-1};
+        GLint sampleLimitHandle{-1};
+        GLint acceptedOrbitBaseHandle{-1};
+        GLint acceptedOrbitLimitHandle{-1};
+
+        bool hasSampleBudget{false};
+        bool hasAcceptedOrbitBudget{false};
+        uint64_t sampleLimit{UINT64_MAX};
+        uint64_t acceptedOrbitLimit{UINT64_MAX};
+        uint64_t budgetTotal{0};
+        uint64_t budgetDoneAtStart{0};
+        //the shader counts accepted orbits in 32 bits. Knowing the full count at the time the counter had a given value, the limit is
+        //rebased on that value. Capping the remainder at 2^31 keeps it unambiguous while the counter wraps between two readbacks.
+        uint64_t acceptedOrbitCount{0};
+        uint32_t acceptedOrbitCounter{0};
+        //iterations dispatched per worker.
+        uint64_t totalIterationCount{0};
+        SampleQueueHeader sampleQueueAtStart{};
+        //set by Configure() when resuming, so the first RunSamples() continues the restored queue instead of resetting it.
+        bool keepRestoredQueue{false};
+        uint64_t restoredSampleIndexBase{0};
+
+        //The iteration count per dispatch is sized from the GPU time the dispatches actually took. Until the first measurement arrives
+        //the count doubles every frame.
+        uint32_t iterationsPerFrame{1};
+        DispatchTimer dispatchTimer;
+        ThroughputModel throughputModel;
+        double targetDispatchNanoseconds{0.0};
+        std::ofstream dispatchLog;
+        //Some drivers (Mesa's llvmpipe for instance) run compute on the CPU and report next to no GPU time. No real dispatch over all
+        //workers finishes within a microsecond, so if the queries keep saying that, the frame time is measured instead.
+        unsigned int implausibleMeasurements{0};
+        bool useFrameTime{false};
+        uint64_t measuredDispatches{0};
+        double predictionErrorSum{0.0};
+        double measuredNanosecondsSum{0.0};
+        uint64_t lastMessage{0};
+        //A frame lasts from its dispatch until the next Step(), so the frame time includes whatever the caller did in between.
+        bool dispatchPending{false};
+        double framePrediction{0.0};
+        std::chrono::high_resolution_clock::time_point frameStart;
+        //The preview is only drawn every so often, so most frames are just a dispatch. Without buffer swaps nothing limits how far the CPU
+        //runs ahead of the GPU. At most two dispatches are kept in flight, so the GPU never runs dry, but the CPU does not queue up work.
+        GLsync previousDispatchFence{nullptr};
+
+        AsyncHistogramWriter checkpointWriter;
+        HistogramCapture histogramCapture;
+        HistogramFile pendingCheckpoint;
+        //snapshots of the output get their own capture and writer, so they neither wait for nor delay checkpoints.
+        AsyncHistogramWriter snapshotWriter;
+        HistogramCapture snapshotCapture;
+        HistogramFile pendingSnapshot;
+
+        //The progress counters are read back every frame, to know when a budget is used up. They arrive a frame or two late,
+        //during which workers that are out of work just idle.
+        AsyncBufferReadback progressReadback;
+        SampleQueueHeader progress{};
+
+        //The pipeline counters are read back every few seconds, without waiting for them.
+        AsyncBufferReadback pipelineCountersReadback;
+        PipelineCounters pipelineCounters{};
+
+        //For --targetNoise snapshots of the histogram are copied on the GPU and only read once the copy is done. The estimate is computed
+        //on another thread, so neither step holds up the next dispatch.
+        AsyncBufferReadback snapshotReadback;
+        std::vector<uint32_t> previousSnapshot;
+        std::vector<uint32_t> currentSnapshot;
+        std::future<double> noiseEstimate;
+        bool converged{false};
+
+        std::chrono::high_resolution_clock::time_point startTime;
+        std::chrono::high_resolution_clock::time_point frameStop;
+        std::chrono::high_resolution_clock::time_point lastCheckpoint;
+        std::chrono::high_resolution_clock::time_point lastProgressMessage;
+        std::chrono::high_resolution_clock::time_point lastSnapshot;
+        std::chrono::high_resolution_clock::time_point lastOutputSnapshot;
+        std::chrono::high_resolution_clock::time_point lastPipelineCounters;
+        //the counters are reset once the --benchmarkWarmup is over.
+        std::chrono::high_resolution_clock::time_point pipelineCountersStart;
+        bool warmingUp{false};
+        //--benchmark measures with the counters of the sample queue and the dispatched iterations, so it runs the same shader as a render.
+        //Without a budget no worker runs out of samples, so every dispatched iteration is a computed one.
+        SampleQueueHeader sampleQueueAtBenchmarkStart{};
+        uint64_t iterationCountAtBenchmarkStart{0};
+    };
+
+    GlEngine::GlEngine(bool withPreview)
+        : withPreview(withPreview)
+    {}
+
+    GlEngine::~GlEngine()
+    {
+        Unmap();
+        render.reset();
+        for(const auto& program : computePrograms)
+            glDeleteProgram(program.second);
+        if(vertexAndFragmentShaders != 0)
+            glDeleteProgram(vertexAndFragmentShaders);
+        if(vertexBuffer != 0)
+            glDeleteBuffers(1, &vertexBuffer);
+        if(vertexArray != 0)
+            glDeleteVertexArrays(1, &vertexArray);
+    }
+
+    bool GlEngine::Init(const RenderSettings &initSettings)
+    {
+        if(initialized)
+            return true;
+        // Create and compile our GLSL program from the shaders. They are built into the executable, unless --shaderDirectory says otherwise.
+        const std::string vertexShaderName("BuddhaVertex.glsl");
+        const std::string fragmentShaderName("BuddhaFragment.glsl");
+        const std::string reductionShaderName("BuddhaReduce.glsl");
+        const std::string toneMapShaderName("BuddhaToneMap.glsl");
+        const std::string previewShaderName("BuddhaPreview.glsl");
+        if(withPreview)
+        {
+            vertexAndFragmentShaders = LoadShaders(vertexShaderName, fragmentShaderName);
+            if(vertexAndFragmentShaders == 0 || !previewDownsampler.Init(previewShaderName, initSettings.imageWidth, initSettings.imageHeight/2) || !previewReduction.Init(reductionShaderName))
+                return false;
+            //the size of the preview data is only known once the window size is, so the uniforms get set when drawing.
+            previewWidthHandle = glGetUniformLocation(vertexAndFragmentShaders, "width");
+            previewHeightHandle = glGetUniformLocation(vertexAndFragmentShaders, "height");
+            glClearColor(0.0f, 0.0f, 0.4f, 0.0f);
+
+            glGenVertexArrays(1, &vertexArray);
+            glBindVertexArray(vertexArray);
+
+            const GLfloat g_vertex_buffer_data[] = {
+                -1.0f, -1.0f, 0.0f,
+                1.0f, -1.0f, 0.0f,
+                -1.0f,  1.0f, 0.0f,
+                1.0f, 1.0f, 0.0f
+            };
+
+            glGenBuffers(1, &vertexBuffer);
+            glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+            glBufferData(GL_ARRAY_BUFFER, sizeof(g_vertex_buffer_data), g_vertex_buffer_data, GL_STATIC_DRAW);
+        }
+        if(!histogramReduction.Init(reductionShaderName) || !toneMapper.Init(toneMapShaderName, initSettings.imageWidth, initSettings.imageHeight/2, initSettings.pngBitDepth))
+            return false;
+        initialized = true;
+        return true;
+    }
+
+    bool GlEngine::Configure(const RenderSettings &newSettings)
+    {
+        Unmap();
+        //waits for the writes of the previous render.
+        render.reset();
+        settings = newSettings;
+
+        //we have a context. Let's check if input is sane.
+        if(!settings.CheckValidity())
+            return false;
+        if(!Init(settings))
+        {
+            std::cerr << "Something went wrong with loading the shaders. Abort." << std::endl;
+            return false;
+        }
+
+        const auto shaderLoadStart{std::chrono::high_resolution_clock::now()};
+        const auto cacheStatisticsAtStart = GetProgramCacheStatistics();
+        const bool collectPipelineCounters{!settings.pipelineCountersFilename.empty()};
+        computeProgram = GetComputeProgram((collectPipelineCounters ? PipelineCountersDefine : std::string()) + GetPrecisionPreamble(settings) + (settings.specializeShader != 0 ? GetRenderConstantsPreamble(settings) : std::string()));
+        if(computeProgram == 0)
+        {
+            std::cerr << "Something went wrong with loading the shaders. Abort." << std::endl;
+            if(settings.precision == "double")
+                std::cerr << "Not every driver supports double precision in shaders, --precision float might work." << std::endl;
+            return false;
+        }
+        if(settings.printDebugOutput != 0)
+        {
+            const auto cacheStatistics = GetProgramCacheStatistics();
+            const unsigned int hits{cacheStatistics.hits - cacheStatisticsAtStart.hits};
+            const unsigned int misses{cacheStatistics.misses - cacheStatisticsAtStart.misses};
+            std::cout << "Loading the compute shader took " << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - shaderLoadStart).count() << " ms, " <<
+                         (hits + misses == 0 ? "it was already loaded." : (hits != 0 ? "it came from the cache." : "it was compiled.")) << std::endl;
+        }
+
+        const unsigned int bufferHeight = settings.imageHeight/2;
+        const unsigned int pixelCount{(settings.imageWidth * bufferHeight)};
+        const GLuint draw = drawBuffer.Reserve(4 * 3 * static_cast<GLsizeiptr>(pixelCount));
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, draw);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER,GL_R8,GL_RED,GL_UNSIGNED_INT,nullptr);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, draw);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        toneMapper.Resize(settings.imageWidth, bufferHeight, settings.pngBitDepth);
+        if(withPreview)
+            previewDownsampler.SetHistogramSize(settings.imageWidth, bufferHeight);
+
+        //the state buffer uses std430 layout, so it can be read back for checkpoints. WorkerState mirrors one entry in single precision.
+        const uint32_t workerCount = settings.globalWorkGroupSizeX*settings.globalWorkGroupSizeY*settings.globalWorkGroupSizeZ*settings.localWorkgroupSizeX*settings.localWorkgroupSizeY*settings.localWorkgroupSizeZ;
+        const GLuint states = stateBuffer.Reserve(GetWorkerStateSize(settings)*workerCount);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER,states);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER,GL_R8,GL_RED,GL_UNSIGNED_INT,nullptr);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, states);
+
+        uint64_t totalIterationCount{0};
+        uint64_t sampleIndexBase{0};
+        std::vector<WorkerState> pendingStates;
+        SampleQueueHeader sampleQueue{};
+        uint64_t acceptedOrbitCount{0};
+        if(!settings.resumeFilename.empty() && !RestoreCheckpoint(settings, draw, pixelCount, workerCount, pendingStates, sampleIndexBase, totalIterationCount, sampleQueue, acceptedOrbitCount))
+            return false;
+        //pending states always reference samples below the limit they were claimed with, so only chunks need to respect the new limit.
+        const bool hasSampleBudget{settings.sampleBudget != 0};
+        const bool hasAcceptedOrbitBudget{settings.acceptedOrbitBudget != 0};
+        const uint64_t sampleLimit{hasSampleBudget ? settings.GetShardSampleBudget() : UINT64_MAX};
+        const uint64_t acceptedOrbitLimit{hasAcceptedOrbitBudget ? settings.GetShardAcceptedOrbitBudget() : UINT64_MAX};
+        const uint32_t samplesPerChunk{hasSampleBudget && sampleLimit > sampleIndexBase ? GetSamplesPerChunk(sampleLimit - sampleIndexBase, workerCount) : 1 << 16};
+
+        sampleQueue.pendingStateCount = static_cast<uint32_t>(pendingStates.size());
+        const GLuint queue = sampleQueueBuffer.Reserve(sizeof(sampleQueue) + sizeof(WorkerState)*pendingStates.size());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER,queue);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(sampleQueue), &sampleQueue);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(sampleQueue), sizeof(WorkerState)*pendingStates.size(), pendingStates.data());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, queue);
+
+        if(collectPipelineCounters)
+        {
+            const GLuint counters = pipelineCountersBuffer.Reserve(sizeof(PipelineCounters));
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER,counters);
+            glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, counters);
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        render.reset(new RenderState(settings, histogramReduction, toneMapper, draw, states, queue, pixelCount, workerCount, sampleQueue.pendingStateCount, sampleIndexBase, samplesPerChunk, sampleLimit));
+        RenderState& state = *render;
+        state.pixelCount = pixelCount;
+        state.workerCount = workerCount;
+        state.maxOrbitLength = std::max(std::max(settings.orbitLengthBlue,settings.orbitLengthGreen),settings.orbitLengthRed);
+        state.collectPipelineCounters = collectPipelineCounters;
+        state.hasSampleBudget = hasSampleBudget;
+        state.hasAcceptedOrbitBudget = hasAcceptedOrbitBudget;
+        state.sampleLimit = sampleLimit;
+        state.acceptedOrbitLimit = acceptedOrbitLimit;
+        state.budgetTotal = hasAcceptedOrbitBudget ? acceptedOrbitLimit : sampleLimit;
+        state.budgetDoneAtStart = hasAcceptedOrbitBudget ? sampleQueue.drawnOrbits : sampleQueue.finishedSamples;
+        state.acceptedOrbitCount = acceptedOrbitCount;
+        state.acceptedOrbitCounter = sampleQueue.acceptedOrbits;
+        state.totalIterationCount = totalIterationCount;
+        state.sampleQueueAtStart = sampleQueue;
+        state.keepRestoredQueue = !settings.resumeFilename.empty();
+        state.restoredSampleIndexBase = sampleIndexBase;
+        state.progress = sampleQueue;
+        state.lastMessage = totalIterationCount/state.maxOrbitLength;
+
+        glUseProgram(computeProgram);
+        //with --specializeShader the first four are constants. Their locations are then -1, which glUniform ignores.
+        GLint orbitLengthUniformHandle = glGetUniformLocation(computeProgram, "orbitLength");
+        GLint totalIterationsUniformHandle = glGetUniformLocation(computeProgram, "totalIterations");
+        GLint widthUniformComputeHandle = glGetUniformLocation(computeProgram, "width");
+        GLint heightUniformComputeHandle = glGetUniformLocation(computeProgram, "height");
+        GLint shardIndexUniformHandle = glGetUniformLocation(computeProgram, "shardIndex");
+        GLint shardCountUniformHandle = glGetUniformLocation(computeProgram, "shardCount");
+        GLint randomSeedUniformHandle = glGetUniformLocation(computeProgram, "randomSeed");
+        state.iterationsPerDispatchHandle = glGetUniformLocation(computeProgram, "iterationsPerDispatch");
+        state.sampleIndexBaseHandle = glGetUniformLocation(computeProgram, "sampleIndexBase");
+        state.samplesPerChunkHandle = glGetUniformLocation(computeProgram, "samplesPerChunk");
+        state.sampleLimitHandle = glGetUniformLocation(computeProgram, "sampleLimit");
+        state.acceptedOrbitBaseHandle = glGetUniformLocation(computeProgram, "acceptedOrbitBase");
+        state.acceptedOrbitLimitHandle = glGetUniformLocation(computeProgram, "acceptedOrbitLimit");
+        glUniform4ui(orbitLengthUniformHandle,settings.orbitLengthRed,settings.orbitLengthGreen,settings.orbitLengthBlue,settings.orbitLengthSkip);
+        glUniform1ui(totalIterationsUniformHandle, state.maxOrbitLength);
+        glUniform1ui(widthUniformComputeHandle, settings.imageWidth);
+        glUniform1ui(heightUniformComputeHandle, bufferHeight);
+        glUniform1ui(shardIndexUniformHandle, settings.shardIndex);
+        glUniform1ui(shardCountUniformHandle, settings.shardCount);
+        glUniform1ui(randomSeedUniformHandle, settings.randomSeed);
+        glUniform2ui(state.sampleIndexBaseHandle, static_cast<GLuint>(sampleIndexBase), static_cast<GLuint>(sampleIndexBase >> 32));
+        glUniform1ui(state.samplesPerChunkHandle, samplesPerChunk);
+        glUniform2ui(state.sampleLimitHandle, static_cast<GLuint>(sampleLimit), static_cast<GLuint>(sampleLimit >> 32));
+        RebaseAcceptedOrbitLimit();
+
+        state.targetDispatchNanoseconds = settings.targetDispatchTime > 0.0 ? settings.targetDispatchTime * 1e6 : 1e9 / settings.targetFrameRate;
+        if(!settings.dispatchLogFilename.empty())
+        {
+            state.dispatchLog.open(settings.dispatchLogFilename, std::ios::out | std::ios::trunc);
+            if(!state.dispatchLog.is_open())
+                std::cerr << "Failed to open " << settings.dispatchLogFilename << " for writing. Dispatch times will not be logged." << std::endl;
+            else
+                state.dispatchLog << "iterations,predicted_us,measured_us" << std::endl;
+        }
+
+        state.startTime = std::chrono::high_resolution_clock::now();
+        state.frameStop = state.startTime;
+        state.lastCheckpoint = state.startTime;
+        state.lastProgressMessage = state.startTime;
+        state.lastSnapshot = state.startTime;
+        state.lastOutputSnapshot = state.startTime;
+        state.lastPipelineCounters = state.startTime;
+        state.pipelineCountersStart = state.startTime;
+        state.warmingUp = settings.benchmarkWarmup != 0;
+        state.sampleQueueAtBenchmarkStart = sampleQueue;
+        state.iterationCountAtBenchmarkStart = totalIterationCount;
+        return true;
+    }
+
+    bool GlEngine::RunSamples(uint64_t sampleCount)
+    {
+        Unmap();
+        if(!render)
+            return false;
+        if(sampleCount == 0)
+            return true;
+        RenderState& state = *render;
+        if(state.progressReadback.IsPending())
+            state.progressReadback.Finish(&state.progress);
+        //Every call hands out its samples like a new render with sampleIndexBase at the first of them. Workers that are idle because
+        //the previous range is used up do not look for work again, so all states are reset, which makes them claim a chunk.
+        //Only the first call after resuming a checkpoint keeps the restored queue: its states finish their samples first, and new chunks
+        //start after the claimed ones. Once all of them are finished, as many samples are done as were claimed, so later calls start over.
+        uint64_t sampleIndexBase{state.progress.finishedSamples};
+        uint64_t newSamples{sampleCount};
+        if(state.keepRestoredQueue)
+        {
+            state.keepRestoredQueue = false;
+            sampleIndexBase = state.restoredSampleIndexBase;
+            newSamples = sampleCount - std::min(sampleCount, sampleIndexBase - std::min(sampleIndexBase, state.progress.finishedSamples));
+        }
+        else
+        {
+            state.progress.claimedChunks = 0;
+            state.progress.nextPendingState = 0;
+            state.progress.pendingStateCount = 0;
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, stateBuffer.Get());
+            glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R8, GL_RED, GL_UNSIGNED_INT, nullptr);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, sampleQueueBuffer.Get());
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(state.progress), &state.progress);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        }
+        const uint64_t sampleLimit{sampleIndexBase + newSamples};
+        glProgramUniform2ui(computeProgram, state.sampleIndexBaseHandle, static_cast<GLuint>(sampleIndexBase), static_cast<GLuint>(sampleIndexBase >> 32));
+        glProgramUniform1ui(computeProgram, state.samplesPerChunkHandle, GetSamplesPerChunk(newSamples, state.workerCount));
+        glProgramUniform2ui(computeProgram, state.sampleLimitHandle, static_cast<GLuint>(sampleLimit), static_cast<GLuint>(sampleLimit >> 32));
+        //budgets are up to the caller here.
+        glProgramUniform1ui(computeProgram, state.acceptedOrbitLimitHandle, UINT32_MAX);
+
+        //The counters are read right after every dispatch, which waits for it. A worker finishes every sample within twice the longest
+        //orbit length plus one iteration. If the counters do not move for twice that, the shader does not run at all, for instance
+        //because the context was lost.
+        const uint64_t maxIterationsWithoutProgress{2 * (2 * static_cast<uint64_t>(state.maxOrbitLength) + 1)};
+        uint64_t iterationsWithoutProgress{0};
+        while(state.progress.finishedSamples < sampleLimit)
+        {
+            const uint64_t finishedBefore{state.progress.finishedSamples};
+            const uint32_t iterations{state.iterationsPerFrame};
+            Dispatch();
+            glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, sampleQueueBuffer.Get());
+            glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(state.progress), &state.progress);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+            MeasureDispatch();
+            iterationsWithoutProgress = state.progress.finishedSamples != finishedBefore ? 0 : iterationsWithoutProgress + iterations;
+            const GLenum error{glGetError()};
+            if(error != GL_NO_ERROR || iterationsWithoutProgress > maxIterationsWithoutProgress)
+            {
+                if(error != GL_NO_ERROR)
+                    std::cerr << "OpenGL error 0x" << std::hex << error << std::dec << " while rendering." << std::endl;
+                else
+                    std::cerr << "The compute shader stopped finishing samples." << std::endl;
+                return false;
+            }
+        }
+        if(state.collectPipelineCounters)
+        {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, pipelineCountersBuffer.Get());
+            glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(state.pipelineCounters), &state.pipelineCounters);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        }
+        return true;
+    }
+
+    EngineProgress GlEngine::GetProgress() const
+    {
+        if(!render)
+            return EngineProgress{0, 0, 0, 0};
+        return EngineProgress{render->progress.finishedSamples, render->progress.drawnOrbits, render->totalIterationCount * render->workerCount,
+                              render->collectPipelineCounters ? render->pipelineCounters.values[HistogramWrites] : 0};
+    }
+
+    bool GlEngine::GetPipelineCounters(PipelineCounters &counters) const
+    {
+        if(!render || !render->collectPipelineCounters)
+            return false;
+        counters = render->pipelineCounters;
+        return true;
+    }
+
+    HistogramView GlEngine::Snapshot()
+    {
+        //mapping lets the driver hand out the buffer without another copy where it can. It stays mapped until the engine is used again.
+        if(mappedCounts == nullptr && render)
+        {
+            glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawBuffer.Get());
+            mappedCounts = static_cast<const uint32_t *>(glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, 4 * 3 * static_cast<GLsizeiptr>(render->pixelCount), GL_MAP_READ_BIT));
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+            if(mappedCounts == nullptr)
+                std::cerr << "Failed to map the histogram buffer." << std::endl;
+        }
+        return HistogramView{mappedCounts, settings.imageWidth, settings.imageHeight/2};
+    }
+
+    bool GlEngine::Step()
+    {
+        Unmap();
+        if(render->dispatchPending)
+        {
+            MeasureDispatch();
+            UpdateReadbacks();
+        }
+        if(IsDone())
+            return false;
+        Dispatch();
+        return true;
+    }
+
+    void GlEngine::DrawPreview(unsigned int framebufferWidth, unsigned int framebufferHeight)
+    {
+        Unmap();
+        if(previewDownsampler.Resize(framebufferWidth, framebufferHeight))
+        {
+            glUseProgram(vertexAndFragmentShaders);
+            glUniform1ui(previewWidthHandle, previewDownsampler.GetWidth());
+            glUniform1ui(previewHeightHandle, previewDownsampler.GetBufferHeight());
+        }
+        previewDownsampler.Run();
+        previewReduction.Run(previewDownsampler.GetBuffer(), previewDownsampler.GetPixelCount());
+        /* Render here */
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glUseProgram(vertexAndFragmentShaders);
+        glBindVertexArray(vertexArray);
+
+        glEnableVertexAttribArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+        glVertexAttribPointer(
+                    0,                  // attribute 0. No particular reason for 0, but must match the layout in the shader.
+                    3,                  // size
+                    GL_FLOAT,           // type
+                    GL_FALSE,           // normalized?
+                    0,                  // stride
+                    (void*)0            // array buffer offset
+                    );
+        // Draw the triangle strip!
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4); // Triangle strip with 4 vertices -> quad.
+        glDisableVertexAttribArray(0);
+    }
+
+    bool GlEngine::Finish()
+    {
+        Unmap();
+        RenderState& state = *render;
+        bool success{true};
+        if(state.dispatchPending)
+        {
+            MeasureDispatch();
+            UpdateReadbacks();
+        }
+
+        if(state.collectPipelineCounters)
+        {
+            if(state.pipelineCountersReadback.IsPending())
+                state.pipelineCountersReadback.Finish(&state.pipelineCounters);
+            state.pipelineCountersReadback.Start(pipelineCountersBuffer.Get(), sizeof(state.pipelineCounters));
+            state.pipelineCountersReadback.Finish(&state.pipelineCounters);
+            //the readback waited for all dispatches, so this is the time the counted work took.
+            ReportPipelineCounters(std::chrono::duration<double>(std::chrono::high_resolution_clock::now()-state.pipelineCountersStart).count());
+        }
+
+        if(settings.benchmarkTime != 0)
+        {
+            SampleQueueHeader sampleQueueAtBenchmarkEnd;
+            if(state.progressReadback.IsPending())
+                state.progressReadback.Finish(&state.progress);
+            state.progressReadback.Start(sampleQueueBuffer.Get(), sizeof(sampleQueueAtBenchmarkEnd));
+            state.progressReadback.Finish(&sampleQueueAtBenchmarkEnd);
+            //the readback waited for all dispatches, and the measurement started the same way after the warmup.
+            const double seconds{std::chrono::duration<double>(std::chrono::high_resolution_clock::now()-state.pipelineCountersStart).count()};
+            PipelineThroughput throughput;
+            throughput.candidates = (sampleQueueAtBenchmarkEnd.finishedSamples - state.sampleQueueAtBenchmarkStart.finishedSamples) / seconds;
+            throughput.acceptedOrbits = (sampleQueueAtBenchmarkEnd.drawnOrbits - state.sampleQueueAtBenchmarkStart.drawnOrbits) / seconds;
+            throughput.iterations = static_cast<double>(state.totalIterationCount - state.iterationCountAtBenchmarkStart) * state.workerCount / seconds;
+            throughput.histogramWrites = state.collectPipelineCounters ? GetPipelineThroughput(state.pipelineCounters, seconds).histogramWrites : std::numeric_limits<double>::quiet_NaN();
+            PrintPipelineThroughput(throughput);
+            //a failed write is reported, and whoever reads the file notices.
+            if(!settings.benchmarkOutputFilename.empty())
+                WritePipelineThroughput(settings.benchmarkOutputFilename, throughput);
+        }
+
+        if(!settings.checkpointFilename.empty() || !settings.histogramFilename.empty() || !settings.pngFilename.empty())
+        {
+            //rendering has stopped, so there is nothing left to overlap the final read with. An unfinished checkpoint is superseded by the final one.
+            if(state.histogramCapture.IsPending())
+                state.histogramCapture.Finish(state.pendingCheckpoint);
+            //an unfinished snapshot is outdated anyway, but it must not overwrite the final output.
+            if(state.snapshotCapture.IsPending())
+                state.snapshotCapture.Finish(state.pendingSnapshot);
+            state.snapshotWriter.WaitUntilIdle();
+            HistogramFile finalCheckpoint;
+            //raw counts are only read back if they are written. The png is tone mapped on the GPU.
+            state.histogramCapture.Start(state.totalIterationCount, !settings.histogramFilename.empty() || !settings.checkpointFilename.empty(), !settings.pngFilename.empty());
+            state.histogramCapture.Finish(finalCheckpoint);
+
+            if(settings.printDebugOutput != 0)
+            {
+                const auto& statistics = state.histogramCapture.GetStatistics();
+                for(unsigned int channel = 0; channel < 3; ++channel)
+                {
+                    std::cout << "Channel " << channel << ": max " << statistics.channels[channel].maxCount << ", sum " << statistics.channels[channel].sum << ", non-zero " << statistics.channels[channel].nonZeroCount << ", percentiles";
+                    for(unsigned int i = 0; i < StatisticsPercentileCount; ++i)
+                        std::cout << " " << 100.0 * StatisticsPercentiles[i] << "%: " << statistics.channels[channel].percentiles[i];
+                    std::cout << std::endl;
+                }
+            }
+            if(!settings.pngFilename.empty())
+                success = WritePackedPNG(settings.pngFilename, state.histogramCapture.GetImage(), settings.imageWidth, settings.imageHeight, settings.pngBitDepth) && success;
+
+            if(!settings.histogramFilename.empty())
+                success = WriteHistogramFile(settings.histogramFilename, finalCheckpoint, false) && success;
+            if(!settings.checkpointFilename.empty())
+            {
+                //the final checkpoint is written here instead of by the writer, so a failure can be reported. Its earlier ones must not overtake it.
+                state.checkpointWriter.WaitUntilIdle();
+                const std::string temporaryPath = settings.checkpointFilename + ".tmp";
+                if(!WriteHistogramFile(temporaryPath, finalCheckpoint) || !ReplaceFile(temporaryPath, settings.checkpointFilename))
+                {
+                    std::cerr << "Failed to write the checkpoint " << settings.checkpointFilename << "." << std::endl;
+                    success = false;
+                }
+            }
+        }
+
+        //the counters of the sample queue tell how much this render got done. The buffers are kept for the next one.
+        if(state.progressReadback.IsPending())
+            state.progressReadback.Finish(&state.progress);
+        state.progressReadback.Start(sampleQueueBuffer.Get(), sizeof(state.progress));
+        state.progressReadback.Finish(&state.progress);
+        if(state.previousDispatchFence != nullptr)
+            glDeleteSync(state.previousDispatchFence);
+        state.previousDispatchFence = nullptr;
+        return success;
+    }
+
+    GLuint GlEngine::GetComputeProgram(const std::string &preamble)
+    {
+        //every combination of work group sizes and preamble is only compiled once.
+        const std::string key = std::to_string(settings.localWorkgroupSizeX) + "x" + std::to_string(settings.localWorkgroupSizeY) + "x" + std::to_string(settings.localWorkgroupSizeZ) + "\n" + preamble;
+        const auto existing = computePrograms.find(key);
+        if(existing != computePrograms.end())
+            return existing->second;
+        const GLuint program = LoadComputeShader("BuddhaCompute.glsl", settings.localWorkgroupSizeX, settings.localWorkgroupSizeY, settings.localWorkgroupSizeZ, preamble);
+        if(program != 0)
+            computePrograms.emplace(key, program);
+        return program;
+    }
+
+    void GlEngine::Dispatch()
+    {
+        RenderState& state = *render;
+        state.frameStart = std::chrono::high_resolution_clock::now();
+        state.totalIterationCount += state.iterationsPerFrame;
+        //let the compute shader do something
+        glUseProgram(computeProgram);
+        glUniform1ui(state.iterationsPerDispatchHandle, state.iterationsPerFrame);
+        state.framePrediction = state.throughputModel.HasEstimate() ? state.throughputModel.PredictNanoseconds(state.iterationsPerFrame) : 0.0;
+        const bool timed{state.dispatchTimer.Begin()};
+        glDispatchCompute(settings.globalWorkGroupSizeX, settings.globalWorkGroupSizeY, settings.globalWorkGroupSizeZ);
+        if(timed)
+            state.dispatchTimer.End(state.iterationsPerFrame, state.framePrediction);
+
+        //before reading the values in the ssbo, we need a memory barrier:
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT); //I hope this is the correct (and only required) bit
+
+        GLsync dispatchFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        if(state.previousDispatchFence != nullptr)
+        {
+            glClientWaitSync(state.previousDispatchFence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            glDeleteSync(state.previousDispatchFence);
+        }
+        state.previousDispatchFence = dispatchFence;
+        state.dispatchPending = true;
+    }
+
+    void GlEngine::MeasureDispatch()
+    {
+        RenderState& state = *render;
+        state.dispatchPending = false;
+        state.frameStop = std::chrono::high_resolution_clock::now();
+
+        bool gotMeasurement{false};
+        auto recordMeasurement = [&state, &gotMeasurement](const DispatchMeasurement& measurement){
+            gotMeasurement = true;
+            if(measurement.predictedNanoseconds > 0.0)
+            {
+                ++state.measuredDispatches;
+                state.predictionErrorSum += std::abs(measurement.predictedNanoseconds - measurement.measuredNanoseconds) / measurement.measuredNanoseconds;
+                state.measuredNanosecondsSum += measurement.measuredNanoseconds;
+            }
+            if(state.dispatchLog.is_open())
+                state.dispatchLog << measurement.iterations << "," << measurement.predictedNanoseconds * 1e-3 << "," << measurement.measuredNanoseconds * 1e-3 << "\n";
+            state.throughputModel.AddMeasurement(measurement.iterations, measurement.measuredNanoseconds);
+        };
+        DispatchMeasurement measurement;
+        while(state.dispatchTimer.TryGetResult(measurement))
+        {
+            if(state.useFrameTime)
+                continue;
+            state.implausibleMeasurements = measurement.measuredNanoseconds < 1000.0 ? state.implausibleMeasurements + 1 : 0;
+            if(state.implausibleMeasurements == 8)
+            {
+                std::cerr << "The driver reports implausibly short GPU times for compute dispatches. Falling back to measuring the frame time." << std::endl;
+                state.useFrameTime = true;
+                state.throughputModel = ThroughputModel{};
+                continue;
+            }
+            recordMeasurement(measurement);
+        }
+        if(state.useFrameTime)
+            recordMeasurement({state.iterationsPerFrame, state.framePrediction, std::chrono::duration<double, std::nano>(state.frameStop-state.frameStart).count()});
+        if(state.throughputModel.HasEstimate())
+        {
+            if(gotMeasurement)
+                state.iterationsPerFrame = state.throughputModel.IterationsFor(state.targetDispatchNanoseconds, state.iterationsPerFrame);
+        }
+        else
+            state.iterationsPerFrame = std::min(2 * state.iterationsPerFrame, UINT32_C(1) << 30);
+        if(settings.printDebugOutput != 0 && state.totalIterationCount/state.maxOrbitLength > state.lastMessage)
+        {
+            state.lastMessage = state.totalIterationCount/state.maxOrbitLength;
+            const auto ctime = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+            std::cout << "Iteration count next frame: " << state.iterationsPerFrame << std::endl;
+            if(state.measuredDispatches != 0)
+            {
+                std::cout << "Mean GPU time per dispatch: " << state.measuredNanosecondsSum / state.measuredDispatches * 1e-3 << " us, target: " << state.targetDispatchNanoseconds * 1e-3 <<
+                             " us, mean prediction error: " << 100.0 * state.predictionErrorSum / state.measuredDispatches << "% over " << state.measuredDispatches << " dispatches" << std::endl;
+                state.measuredDispatches = 0;
+                state.predictionErrorSum = 0.0;
+                state.measuredNanosecondsSum = 0.0;
+            }
+            std::cout << std::put_time(std::localtime(&ctime),"%X") << ": Iteration count per worker higher than: " << state.lastMessage*state.maxOrbitLength << std::endl;
+            std::cout << std::put_time(std::localtime(&ctime),"%X") << ": Total iteration count higher than: " << state.lastMessage*state.maxOrbitLength*state.workerCount << std::endl;
+        }
+    }
+
+    void GlEngine::UpdateReadbacks()
+    {
+        RenderState& state = *render;
+        const auto frameStop = state.frameStop;
+        if(state.progressReadback.TryFinish(&state.progress) && state.hasAcceptedOrbitBudget)
+        {
+            state.acceptedOrbitCount += static_cast<uint32_t>(state.progress.acceptedOrbits - state.acceptedOrbitCounter);
+            state.acceptedOrbitCounter = state.progress.acceptedOrbits;
+            RebaseAcceptedOrbitLimit();
+        }
+        if(!state.progressReadback.IsPending())
+            state.progressReadback.Start(sampleQueueBuffer.Get(), sizeof(state.progress));
+        if((state.hasSampleBudget || state.hasAcceptedOrbitBudget) && (std::chrono::duration_cast<std::chrono::seconds>(frameStop-state.lastProgressMessage).count() >= 5 || state.IsBudgetUsedUp()))
+        {
+            state.lastProgressMessage = frameStop;
+            const uint64_t done{std::min(state.hasAcceptedOrbitBudget ? state.progress.drawnOrbits : state.progress.finishedSamples, state.budgetTotal)};
+            const double seconds{std::chrono::duration<double>(frameStop-state.startTime).count()};
+            const double rate{(done - std::min(done, state.budgetDoneAtStart)) / seconds};
+            const auto ctime = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+            std::cout << std::put_time(std::localtime(&ctime),"%X") << ": " << done << "/" << state.budgetTotal << (state.hasAcceptedOrbitBudget ? " accepted orbits" : " samples") <<
+                         " (" << std::fixed << std::setprecision(1) << (state.budgetTotal != 0 ? 100.0 * done / state.budgetTotal : 100.0) << "%), " <<
+                         std::setprecision(0) << rate << " per second";
+            if(rate > 0.0)
+                std::cout << ", ETA " << (state.budgetTotal - done) / rate << " s";
+            std::cout << std::defaultfloat << std::setprecision(6) << std::endl;
+        }
+        if(settings.targetNoise > 0.0)
+        {
+            if(!state.snapshotReadback.IsPending() && !state.noiseEstimate.valid() && std::chrono::duration_cast<std::chrono::seconds>(frameStop-state.lastSnapshot).count() >= settings.noiseCheckInterval)
+            {
+                state.lastSnapshot = frameStop;
+                state.snapshotReadback.Start(drawBuffer.Get(), 4 * 3 * state.pixelCount);
+            }
+            if(state.snapshotReadback.IsPending())
+            {
+                state.currentSnapshot.resize(3 * state.pixelCount);
+                if(state.snapshotReadback.TryFinish(state.currentSnapshot.data()))
+                {
+                    ReportAvoidedStall(settings, "Noise snapshot", state.snapshotReadback.GetLastAvoidedStall());
+                    if(state.previousSnapshot.empty())
+                        state.previousSnapshot = std::move(state.currentSnapshot);
+                    else
+                        state.noiseEstimate = std::async(std::launch::async, [&state]{ return EstimateRelativeNoise(state.previousSnapshot, state.currentSnapshot); });
+                }
+            }
+            if(state.noiseEstimate.valid() && state.noiseEstimate.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+            {
+                const double noise{state.noiseEstimate.get()};
+                std::swap(state.previousSnapshot, state.currentSnapshot);
+                const auto ctime = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+                std::cout << std::put_time(std::localtime(&ctime),"%X") << ": Estimated relative noise: " << noise << ", target: " << settings.targetNoise << std::endl;
+                state.converged = noise <= settings.targetNoise;
+            }
+        }
+        //if the previous checkpoint is still being read back or written, we just try again next frame.
+        if(!settings.checkpointFilename.empty() && std::chrono::duration_cast<std::chrono::seconds>(frameStop-state.lastCheckpoint).count() >= settings.checkpointInterval && !state.histogramCapture.IsPending() && !state.checkpointWriter.IsBusy())
+        {
+            state.lastCheckpoint = frameStop;
+            state.histogramCapture.Start(state.totalIterationCount);
+        }
+        if(state.histogramCapture.IsPending() && state.histogramCapture.TryFinish(state.pendingCheckpoint))
+        {
+            ReportAvoidedStall(settings, "Checkpoint", state.histogramCapture.GetLastAvoidedStall());
+            state.checkpointWriter.Submit(settings.checkpointFilename, std::move(state.pendingCheckpoint));
+        }
+        if(settings.snapshotInterval != 0 && std::chrono::duration_cast<std::chrono::seconds>(frameStop-state.lastOutputSnapshot).count() >= settings.snapshotInterval && !state.snapshotCapture.IsPending() && !state.snapshotWriter.IsBusy())
+        {
+            state.lastOutputSnapshot = frameStop;
+            state.snapshotCapture.Start(state.totalIterationCount, !settings.histogramFilename.empty(), !settings.pngFilename.empty());
+        }
+        if(state.snapshotCapture.IsPending() && state.snapshotCapture.TryFinish(state.pendingSnapshot))
+        {
+            ReportAvoidedStall(settings, "Snapshot", state.snapshotCapture.GetLastAvoidedStall());
+            state.snapshotWriter.SubmitSnapshot(settings.histogramFilename, settings.pngFilename, settings.pngBitDepth, std::move(state.pendingSnapshot), std::move(state.snapshotCapture.GetImage()));
+        }
+        if(state.warmingUp && std::chrono::duration_cast<std::chrono::seconds>(frameStop-state.startTime).count() >= settings.benchmarkWarmup)
+        {
+            //A one time stall, so the measurement starts with an idle GPU and empty counters.
+            state.warmingUp = false;
+            if(state.pipelineCountersReadback.IsPending())
+                state.pipelineCountersReadback.Finish(&state.pipelineCounters);
+            glFinish();
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, sampleQueueBuffer.Get());
+            glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(state.sampleQueueAtBenchmarkStart), &state.sampleQueueAtBenchmarkStart);
+            if(state.collectPipelineCounters)
+            {
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, pipelineCountersBuffer.Get());
+                glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+            }
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+            state.iterationCountAtBenchmarkStart = state.totalIterationCount;
+            state.pipelineCountersStart = std::chrono::high_resolution_clock::now();
+            state.lastPipelineCounters = state.pipelineCountersStart;
+        }
+        if(state.collectPipelineCounters && !state.warmingUp)
+        {
+            if(!state.pipelineCountersReadback.IsPending() && std::chrono::duration_cast<std::chrono::seconds>(frameStop-state.lastPipelineCounters).count() >= 5)
+            {
+                state.lastPipelineCounters = frameStop;
+                state.pipelineCountersReadback.Start(pipelineCountersBuffer.Get(), sizeof(state.pipelineCounters));
+            }
+            if(state.pipelineCountersReadback.IsPending() && state.pipelineCountersReadback.TryFinish(&state.pipelineCounters))
+                ReportPipelineCounters(std::chrono::duration<double>(state.lastPipelineCounters-state.pipelineCountersStart).count());
+        }
+    }
+
+    bool GlEngine::IsDone() const
+    {
+        const RenderState& state = *render;
+        return state.IsBudgetUsedUp() || state.converged ||
+                (settings.benchmarkTime != 0 && std::chrono::duration_cast<std::chrono::seconds>(state.frameStop-state.startTime).count() >= settings.benchmarkTime);
+    }
+
+    void GlEngine::RebaseAcceptedOrbitLimit()
+    {
+        const RenderState& state = *render;
+        glProgramUniform1ui(computeProgram, state.acceptedOrbitBaseHandle, state.acceptedOrbitCounter);
+        glProgramUniform1ui(computeProgram, state.acceptedOrbitLimitHandle, state.hasAcceptedOrbitBudget ?
+                                static_cast<uint32_t>(std::min<uint64_t>(state.acceptedOrbitLimit - std::min(state.acceptedOrbitCount, state.acceptedOrbitLimit), UINT32_C(1) << 31)) : UINT32_MAX);
+    }
+
+    void GlEngine::ReportPipelineCounters(double seconds)
+    {
+        if(settings.printDebugOutput != 0)
+            PrintPipelineCounters(render->pipelineCounters, seconds);
+        WritePipelineCounters(settings.pipelineCountersFilename, render->pipelineCounters, seconds);
+    }
+
+    void GlEngine::Unmap()
+    {
+        if(mappedCounts == nullptr)
+            return;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawBuffer.Get());
+        glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        mappedCounts = nullptr;
+    }
+
+    std::unique_ptr<Engine> CreateGlEngine()
+    {
+        return std::unique_ptr<Engine>(new GlEngine());
+    }
+}
@@ -0,0 +1,73 @@
+#include "GpuToneMapper.h"
+#include "Helpers.h"
+#include <algorithm>
+
+namespace Helpers
+{
+    namespace
+    {
+        //must match TONEMAP_GROUP_SIZE in the shader.
+        const unsigned int ToneMapGroupSize = 256;
+    }
+
+    GpuToneMapper::~GpuToneMapper()
+    {
+        if(imageBuffer != 0)
+            glDeleteBuffers(1, &imageBuffer);
+        if(program != 0)
+            glDeleteProgram(program);
+    }
+
+    bool GpuToneMapper::Init(const std::string &shaderName, unsigned int width, unsigned int bufferHeight, unsigned int bitDepth)
+    {
+        program = LoadComputeShader(shaderName, ToneMapGroupSize, 1, 1);
+        if(program == 0)
+            return false;
+        gammaHandle = glGetUniformLocation(program, "gamma");
+        colorScaleHandle = glGetUniformLocation(program, "colorScale");
+        glGenBuffers(1, &imageBuffer);
+        Resize(width, bufferHeight, bitDepth);
+        return true;
+    }
+
+    void GpuToneMapper::Resize(unsigned int width, unsigned int bufferHeight, unsigned int bitDepth)
+    {
+        imageSize = static_cast<size_t>(3) * width * 2 * bufferHeight * (bitDepth / 8);
+        const size_t wordCount = (imageSize + 3) / 4;
+        //large images are handled by every invocation looping over several words.
+        groupCount = static_cast<GLuint>(std::max<size_t>(1, std::min<size_t>(65535, (wordCount + ToneMapGroupSize - 1) / ToneMapGroupSize)));
+        glUseProgram(program);
+        glUniform1ui(glGetUniformLocation(program, "width"), width);
+        glUniform1ui(glGetUniformLocation(program, "height"), bufferHeight);
+        glUniform1ui(glGetUniformLocation(program, "bitDepth"), bitDepth);
+    }
+
+    void GpuToneMapper::Run(double gamma, double colorScale)
+    {
+        const size_t wordCount = (imageSize + 3) / 4;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, imageBuffer);
+        if(4 * wordCount > bufferCapacity)
+        {
+            bufferCapacity = 4 * wordCount;
+            glBufferData(GL_SHADER_STORAGE_BUFFER, bufferCapacity, nullptr, GL_DYNAMIC_COPY);
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, imageBuffer);
+        glUseProgram(program);
+        glUniform1d(gammaHandle, gamma);
+        glUniform1d(colorScaleHandle, colorScale);
+        glDispatchCompute(groupCount, 1, 1);
+        //the image is read back with a buffer copy.
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    }
+
+    GLuint GpuToneMapper::GetBuffer() const
+    {
+        return imageBuffer;
+    }
+
+    size_t GpuToneMapper::GetImageSize() const
+    {
+        return imageSize;
+    }
+}
@@ -0,0 +1,152 @@
+#include "HeadlessContext.h"
+#include <iostream>
+#include <cstring>
+
+#ifdef BUDDHA_HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+namespace Helpers
+{
+    namespace
+    {
+        bool HasExtension(const char * extensions, const char * name)
+        {
+            if(extensions == nullptr)
+                return false;
+            const size_t length = strlen(name);
+            for(const char * start = strstr(extensions, name); start != nullptr; start = strstr(start + length, name))
+            {
+                if((start == extensions || start[-1] == ' ') && (start[length] == ' ' || start[length] == '\0'))
+                    return true;
+            }
+            return false;
+        }
+
+        EGLDisplay OpenDisplay()
+        {
+            //client extensions can be queried without a display. Older EGL implementations return null here.
+            const char * clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+            auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+            if(getPlatformDisplay != nullptr)
+            {
+                if(HasExtension(clientExtensions, "EGL_MESA_platform_surfaceless"))
+                {
+                    EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+                    if(display != EGL_NO_DISPLAY && eglInitialize(display, nullptr, nullptr))
+                        return display;
+                }
+                auto queryDevices = reinterpret_cast<PFNEGLQUERYDEVICESEXTPROC>(eglGetProcAddress("eglQueryDevicesEXT"));
+                if(HasExtension(clientExtensions, "EGL_EXT_platform_device") && queryDevices != nullptr)
+                {
+                    EGLDeviceEXT device;
+                    EGLint deviceCount{0};
+                    if(queryDevices(1, &device, &deviceCount) && deviceCount > 0)
+                    {
+                        EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, device, nullptr);
+                        if(display != EGL_NO_DISPLAY && eglInitialize(display, nullptr, nullptr))
+                            return display;
+                    }
+                }
+            }
+            EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+            if(display != EGL_NO_DISPLAY && eglInitialize(display, nullptr, nullptr))
+                return display;
+            return EGL_NO_DISPLAY;
+        }
+    }
+
+    HeadlessContext::~HeadlessContext()
+    {
+        if(display == nullptr)
+            return;
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if(surface != nullptr)
+            eglDestroySurface(display, surface);
+        if(context != nullptr)
+            eglDestroyContext(display, context);
+        eglTerminate(display);
+    }
+
+    bool HeadlessContext::Create()
+    {
+        display = OpenDisplay();
+        if(display == EGL_NO_DISPLAY)
+        {
+            std::cerr << "Failed to open an EGL display for headless rendering." << std::endl;
+            display = nullptr;
+            return false;
+        }
+        if(!eglBindAPI(EGL_OPENGL_API))
+        {
+            std::cerr << "The EGL implementation does not support desktop OpenGL." << std::endl;
+            return false;
+        }
+        const bool surfaceless{HasExtension(eglQueryString(display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context")};
+        const EGLint configAttributes[] = {
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+            EGL_NONE
+        };
+        EGLConfig config;
+        EGLint configCount{0};
+        if(!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0)
+        {
+            std::cerr << "No EGL config supports desktop OpenGL." << std::endl;
+            return false;
+        }
+        const EGLint contextAttributes[] = {
+            EGL_CONTEXT_MAJOR_VERSION_KHR, 4,
+            EGL_CONTEXT_MINOR_VERSION_KHR, 3,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+            EGL_NONE
+        };
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+        if(context == EGL_NO_CONTEXT)
+        {
+            std::cerr << "Failed to create OpenGL 4.3 core context. We do not support compatibility contexts." << std::endl;
+            context = nullptr;
+            return false;
+        }
+        if(!surfaceless)
+        {
+            const EGLint surfaceAttributes[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+            surface = eglCreatePbufferSurface(display, config, surfaceAttributes);
+            if(surface == EGL_NO_SURFACE)
+            {
+                std::cerr << "Failed to create a pbuffer for headless rendering." << std::endl;
+                surface = nullptr;
+                return false;
+            }
+        }
+        const EGLSurface drawSurface = surface != nullptr ? surface : EGL_NO_SURFACE;
+        if(!eglMakeCurrent(display, drawSurface, drawSurface, context))
+        {
+            std::cerr << "Failed to make the headless OpenGL context current." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    void * HeadlessContext::GetProcAddress(const char *name)
+    {
+        return reinterpret_cast<void*>(eglGetProcAddress(name));
+    }
+}
+#else
+namespace Helpers
+{
+    HeadlessContext::~HeadlessContext() = default;
+
+    bool HeadlessContext::Create()
+    {
+        std::cerr << "This build does not support headless rendering, as EGL was not found when it was configured." << std::endl;
+        return false;
+    }
+
+    void * HeadlessContext::GetProcAddress(const char *)
+    {
+        return nullptr;
+    }
+}
+#endif
@@ -9,43 +9,42 @@
 #include <unordered_map>
 #include <string>
 #include <algorithm>
+#include <functional>
+#include <limits>
+#include <cstdio>
+#include <cstdlib>
+#include "HistogramFile.h"
+#include "ProgramCache.h"
+#include "EmbeddedShaders.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/wait.h>
+#endif
 
 namespace Helpers
 {
-    GLuint LoadShaders(const std::string& vertex_file_path, const std::string& fragment_file_path) {
+    GLuint LoadShaders(const std::string& vertex_shader_name, const std::string& fragment_shader_name) {
 
 		// Create the shaders
 		GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
 		GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
 
-		// Read the Vertex Shader code from the file
+		// Get the shader code
 		std::string VertexShaderCode;
-		std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-		if (VertexShaderStream.is_open()) {
-			std::stringstream sstr;
-			sstr << VertexShaderStream.rdbuf();
-			VertexShaderCode = sstr.str();
-			VertexShaderStream.close();
-		}
-		else {
-            std::cerr << "Failed to load vertex shader file from " << vertex_file_path << ". Is this installed correctly?" << std::endl;
+		std::string FragmentShaderCode;
+		if (!GetShaderSource(vertex_shader_name, VertexShaderCode) || !GetShaderSource(fragment_shader_name, FragmentShaderCode)) {
+			glDeleteShader(VertexShaderID);
+			glDeleteShader(FragmentShaderID);
 			return 0;
 		}
 
-		// Read the Fragment Shader code from the file
-		std::string FragmentShaderCode;
-		std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-		if (FragmentShaderStream.is_open()) {
-			std::stringstream sstr;
-			sstr << FragmentShaderStream.rdbuf();
-			FragmentShaderCode = sstr.str();
-			FragmentShaderStream.close();
+		const std::vector<std::string> sources{VertexShaderCode, FragmentShaderCode};
+		if (GLuint CachedProgramID = LoadCachedProgram(sources)) {
+			glDeleteShader(VertexShaderID);
+			glDeleteShader(FragmentShaderID);
+			return CachedProgramID;
 		}
-        else
-        {
-            std::cerr << "Failed to load fragment shader file from " << fragment_file_path << ". Is this installed correctly?" << std::endl;
-            return 0;
-        }
 
 		GLint Result = GL_FALSE;
 		int InfoLogLength;
@@ -86,6 +85,7 @@ namespace Helpers
 		GLuint ProgramID = glCreateProgram();
 		glAttachShader(ProgramID, VertexShaderID);
 		glAttachShader(ProgramID, FragmentShaderID);
+		glProgramParameteri(ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 		glLinkProgram(ProgramID);
 
 		// Check the program
@@ -96,6 +96,8 @@ namespace Helpers
 			glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
 			printf("%s\n", &ProgramErrorMessage[0]);
 		}
+		if (Result == GL_TRUE)
+			StoreCachedProgram(sources, ProgramID);
 
 		glDetachShader(ProgramID, VertexShaderID);
 		glDetachShader(ProgramID, FragmentShaderID);
@@ -106,29 +108,32 @@ namespace Helpers
 		return ProgramID;
 	}
 
-    GLuint LoadComputeShader(const std::string& compute_file_path, unsigned int localSizeX, unsigned int localSizeY, unsigned int localSizeZ)
+    GLuint LoadComputeShader(const std::string& compute_shader_name, unsigned int localSizeX, unsigned int localSizeY, unsigned int localSizeZ, const std::string& preamble)
 	{
 		GLuint ComputeShaderID = glCreateShader(GL_COMPUTE_SHADER);
-		// Read the compute shader
+		// Get the compute shader
 		std::string ComputeShaderCode;
 		{
-			std::ifstream ComputeShaderCodeStream(compute_file_path, std::ios::in);
-			if (ComputeShaderCodeStream.is_open()) {
-				std::stringstream sstr;
-                sstr << "#version 430" <<
-                        std::endl <<
-                        "layout (local_size_x = " << localSizeX <<
-                        ", local_size_y = " << localSizeY <<
-                        ", local_size_z = " << localSizeZ << ") in;" << std::endl;
-				sstr << ComputeShaderCodeStream.rdbuf();
-				ComputeShaderCode = sstr.str();
-				ComputeShaderCodeStream.close();
+			std::string ComputeShaderSource;
+			if (!GetShaderSource(compute_shader_name, ComputeShaderSource)) {
+				glDeleteShader(ComputeShaderID);
+				return 0;
 			}
-            else
-            {
-                std::cerr << "Failed to load compute shader file from " << compute_file_path << ". Is this installed correctly?" << std::endl;
-                return 0;
-            }
+			std::stringstream sstr;
+            sstr << "#version 430" <<
+                    std::endl <<
+                    "layout (local_size_x = " << localSizeX <<
+                    ", local_size_y = " << localSizeY <<
+                    ", local_size_z = " << localSizeZ << ") in;" << std::endl;
+            sstr << preamble;
+			sstr << ComputeShaderSource;
+			ComputeShaderCode = sstr.str();
+		}
+
+		const std::vector<std::string> sources{ComputeShaderCode};
+		if (GLuint CachedProgramID = LoadCachedProgram(sources)) {
+			glDeleteShader(ComputeShaderID);
+			return CachedProgramID;
 		}
 
 		GLint Result = GL_FALSE;
@@ -152,6 +157,7 @@ namespace Helpers
 		}
 		GLuint ProgramID = glCreateProgram();
 		glAttachShader(ProgramID, ComputeShaderID);
+		glProgramParameteri(ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 		glLinkProgram(ProgramID);
 
 		// Check the program
@@ -162,76 +168,171 @@ namespace Helpers
 			glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
 			printf("%s\n", &ProgramErrorMessage[0]);
 		}
+		if (Result == GL_TRUE)
+			StoreCachedProgram(sources, ProgramID);
 		glDetachShader(ProgramID, ComputeShaderID);
 		glDeleteShader(ComputeShaderID);
 		return ProgramID;
 	}
 
-    void WriteOutputPNG(const std::string &path, const std::vector<uint32_t>& data, unsigned int width, unsigned int bufferHeight, double gamma, double colorScale)
+    std::string GetRenderConstantsPreamble(const RenderSettings& settings)
     {
-        std::vector<png_byte> pngData(3*width*2*bufferHeight);
-        std::vector<png_byte *> rows{2*bufferHeight};
-        for(unsigned int i = 0; i < 2*bufferHeight ; ++i)
-        {
-            rows[i] = pngData.data()+3*width*i;
-        }
+        std::stringstream sstr;
+        sstr << "#define RENDER_CONSTANTS" << std::endl <<
+                "const uint width = " << settings.imageWidth << "u;" << std::endl <<
+                "const uint height = " << settings.imageHeight/2 << "u;" << std::endl <<
+                "const uvec4 orbitLength = uvec4(" << settings.orbitLengthRed << "u, " << settings.orbitLengthGreen << "u, " << settings.orbitLengthBlue << "u, " << settings.orbitLengthSkip << "u);" << std::endl <<
+                "const uint totalIterations = " << std::max(std::max(settings.orbitLengthRed, settings.orbitLengthGreen), settings.orbitLengthBlue) << "u;" << std::endl;
+        return sstr.str();
+    }
 
-        uint32_t maxValue{UINT32_C(1)};
-        for(unsigned int i = 0; i < data.size();++i)
-        {
-            maxValue = std::max(maxValue,data[i]);
-        }
-        for(unsigned int i = 0; i < data.size();++i)
+    std::string GetPrecisionPreamble(const RenderSettings& settings)
+    {
+        return settings.precision == "double" ? "#define DOUBLE_PRECISION\n" : "";
+    }
+
+    size_t GetWorkerStateSize(const RenderSettings& settings)
+    {
+        //individualData with a dvec2 position: the position is aligned to 16 bytes, and so is the size of the struct.
+        return settings.precision == "double" ? 48 : sizeof(WorkerState);
+    }
+
+    namespace
+    {
+        /** Maps a count to 0..maxOutput. Must match toneMap() in BuddhaToneMap.glsl. */
+        unsigned int ToneMap(uint64_t value, uint64_t maxValue, double gamma, double colorScale, unsigned int maxOutput)
         {
             if(fabs(gamma - 1.0) > 0.0001 || fabs(colorScale - 1.0) > 0.0001)
             {
-                pngData[data.size() + i] = static_cast<png_byte>(255.0 * pow(std::min(1.0,colorScale*static_cast<double>(data[i])/static_cast<double>(maxValue)),gamma));
-            }
-            else
-            {
-                pngData[data.size() + i] = (255*data[i] + (maxValue/2))/maxValue;
+                return static_cast<unsigned int>(maxOutput * pow(std::min(1.0,colorScale*static_cast<double>(value)/static_cast<double>(maxValue)),gamma));
             }
+            return static_cast<unsigned int>((maxOutput*value + (maxValue/2))/maxValue);
         }
-        for(unsigned int i = 0; i < bufferHeight;++i)
+
+        /** Stores a tone mapped value in a png row. 16 bit samples are big endian. */
+        void SetSample(png_byte * row, unsigned int index, unsigned int value, unsigned int bitDepth)
         {
-            for(unsigned int j = 0; j < width*3;++j)
+            if(bitDepth == 16)
             {
-                rows[i][j] =rows[2*bufferHeight-i-1][j];
+                row[2*index] = static_cast<png_byte>(value >> 8);
+                row[2*index+1] = static_cast<png_byte>(value & 0xFF);
             }
+            else
+                row[index] = static_cast<png_byte>(value);
         }
 
-        ScopedCFileDescriptor fd(path.c_str(), "wb");
-        if(!fd.IsValid())
-        {
-            std::cerr << "Failed to open image.png for writing." << std::endl;
-            return;
-        }
-        png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
-        if(!png_ptr)
+        /** The histogram only contains the upper half of the image, the lower half is mirrored. Returns the histogram row shown in the given image row. */
+        unsigned int HistogramRowForImageRow(unsigned int imageRow, unsigned int bufferHeight)
         {
-            return;
+            return imageRow < bufferHeight ? bufferHeight - imageRow - 1 : imageRow - bufferHeight;
         }
-        png_infop info_ptr = png_create_info_struct(png_ptr);
-        if(!info_ptr)
-        {
-            png_destroy_write_struct(&png_ptr, (png_infopp)NULL);
-            return;
-        }
-        if(setjmp(png_jmpbuf(png_ptr)))
+
+        /** Writes an 8 or 16 bit RGB png row by row. fillRow is called once per image row, top to bottom, and has to fill 3*width*bitDepth/8 bytes. */
+        bool WritePNGRows(const std::string &path, unsigned int width, unsigned int height, unsigned int bitDepth, const std::function<void(unsigned int, png_byte *)>& fillRow)
         {
+            std::vector<png_byte> row(3*width*(bitDepth/8));
+
+            ScopedCFileDescriptor fd(path.c_str(), "wb");
+            if(!fd.IsValid())
+            {
+                std::cerr << "Failed to open " << path << " for writing." << std::endl;
+                return false;
+            }
+            png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+            if(!png_ptr)
+            {
+                return false;
+            }
+            png_infop info_ptr = png_create_info_struct(png_ptr);
+            if(!info_ptr)
+            {
+                png_destroy_write_struct(&png_ptr, (png_infopp)NULL);
+                return false;
+            }
+            if(setjmp(png_jmpbuf(png_ptr)))
+            {
+                png_destroy_write_struct(&png_ptr, &info_ptr);
+                std::cerr << "Failed to write " << path << "." << std::endl;
+                return false;
+            }
+            png_init_io(png_ptr, fd.Get());
+            png_set_IHDR(png_ptr, info_ptr, width, height, bitDepth, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+
+            png_write_info(png_ptr, info_ptr);
+            //header written.
+
+            for(unsigned int i = 0; i < height; ++i)
+            {
+                fillRow(i, row.data());
+                png_write_row(png_ptr, row.data());
+            }
+
+            png_write_end(png_ptr, info_ptr);
             png_destroy_write_struct(&png_ptr, &info_ptr);
-            return;
+            //libpng only reports errors of its own. A full disk often shows up when the buffered tail is flushed.
+            if(fflush(fd.Get()) != 0 || ferror(fd.Get()))
+            {
+                std::cerr << "Failed to write " << path << "." << std::endl;
+                return false;
+            }
+            return true;
         }
-        png_init_io(png_ptr, fd.Get());
-        png_set_IHDR(png_ptr, info_ptr, width, 2*bufferHeight, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    }
 
-        png_write_info(png_ptr, info_ptr);
-        //header written.
+    bool WritePackedPNG(const std::string &path, const std::vector<uint8_t>& image, unsigned int width, unsigned int height, unsigned int bitDepth)
+    {
+        const size_t rowSize = 3*width*(bitDepth/8);
+        return WritePNGRows(path, width, height, bitDepth, [&](unsigned int imageRow, png_byte * row)
+        {
+            std::copy(image.begin() + rowSize*imageRow, image.begin() + rowSize*(imageRow+1), row);
+        });
+    }
 
-        png_write_image(png_ptr, rows.data());
+    bool WriteHistogramPNG(const std::string &path, const uint32_t * counts, unsigned int width, unsigned int bufferHeight, double gamma, double colorScale, unsigned int bitDepth)
+    {
+        const uint64_t maxValue = std::max<uint64_t>(*std::max_element(counts, counts + 3*static_cast<size_t>(width)*bufferHeight), 1);
+        const unsigned int maxOutput = (1u << bitDepth) - 1;
+        return WritePNGRows(path, width, 2*bufferHeight, bitDepth, [&](unsigned int imageRow, png_byte * row)
+        {
+            const uint32_t * histogramRow = counts + 3*static_cast<size_t>(width)*HistogramRowForImageRow(imageRow, bufferHeight);
+            for(unsigned int j = 0; j < width*3;++j)
+            {
+                SetSample(row, j, ToneMap(histogramRow[j], maxValue, gamma, colorScale, maxOutput), bitDepth);
+            }
+        });
+    }
 
-        png_write_end(png_ptr, info_ptr);
-        png_destroy_write_struct(&png_ptr, &info_ptr);
+    bool WriteOutputPNG(const std::string &path, const std::string &histogramPath, uint64_t maxValue, double gamma, double colorScale, unsigned int bitDepth)
+    {
+        HistogramFileReader reader;
+        if(!reader.Open(histogramPath))
+            return false;
+        const unsigned int width = reader.GetHeader().width;
+        const unsigned int bufferHeight = reader.GetHeader().bufferHeight;
+        if(maxValue == 0)
+        {
+            std::vector<uint64_t> histogramRow(3*width);
+            for(unsigned int i = 0; i < bufferHeight; ++i)
+            {
+                if(!reader.ReadCounts(3*static_cast<uint64_t>(width)*i, histogramRow.size(), histogramRow.data()))
+                    return false;
+                for(auto value : histogramRow)
+                    maxValue = std::max(maxValue, value);
+            }
+            maxValue = std::max(maxValue, UINT64_C(1));
+        }
+        bool success{true};
+        std::vector<uint64_t> histogramRow(3*width);
+        const unsigned int maxOutput = (1u << bitDepth) - 1;
+        const bool written = WritePNGRows(path, width, 2*bufferHeight, bitDepth, [&](unsigned int imageRow, png_byte * row)
+        {
+            success = reader.ReadCounts(3*static_cast<uint64_t>(width)*HistogramRowForImageRow(imageRow, bufferHeight), histogramRow.size(), histogramRow.data()) && success;
+            for(unsigned int j = 0; j < width*3;++j)
+            {
+                SetSample(row, j, ToneMap(histogramRow[j], maxValue, gamma, colorScale, maxOutput), bitDepth);
+            }
+        });
+        return written && success;
     }
 
     ScopedCFileDescriptor::ScopedCFileDescriptor(const char *path, const char *mode)
@@ -307,14 +408,17 @@ namespace Helpers
         struct SettingsPointer
         {
         public:
-            SettingsPointer(unsigned int * ptr) : intPtr(ptr), dblPtr(nullptr), stringPtr(nullptr) {}
-            SettingsPointer(double * ptr) : intPtr(nullptr), dblPtr(ptr), stringPtr(nullptr) {}
-            SettingsPointer(std::string * ptr) : intPtr(nullptr), dblPtr(nullptr), stringPtr(ptr) {}
+            SettingsPointer(unsigned int * ptr) : intPtr(ptr) {}
+            SettingsPointer(uint64_t * ptr) : longPtr(ptr) {}
+            SettingsPointer(double * ptr) : dblPtr(ptr) {}
+            SettingsPointer(std::string * ptr) : stringPtr(ptr) {}
             unsigned int * GetIntPtr() const { return intPtr; }
+            uint64_t * GetLongPtr() const { return longPtr; }
             double * GetDblPtr() const { return dblPtr;}
             std::string * GetStringPtr() const { return stringPtr;}
         private:
             unsigned int * intPtr = nullptr;
+            uint64_t * longPtr = nullptr;
             double * dblPtr = nullptr;
             std::string * stringPtr = nullptr;
         };
@@ -334,12 +438,46 @@ namespace Helpers
             {"--globalWorkgroupSizeY", &globalWorkGroupSizeY},
             {"--globalWorkgroupSizeZ", &globalWorkGroupSizeZ},
             {"--targetFrameRate", &targetFrameRate},
+            {"--previewRate", &previewRate},
+            {"--targetDispatchTime", &targetDispatchTime},
+            {"--dispatchLog", &dispatchLogFilename},
+            {"--headless", &headless},
             {"--imageGamma",&pngGamma},
             {"--imageColorScale",&pngColorScale},
+            {"--imageBitDepth",&pngBitDepth},
             {"--output", &pngFilename},
+            {"--histogramOutput", &histogramFilename},
             {"--ignoreMaxBufferSize", &ignoreMaxBufferSize},
             {"--printDebugOutput", &printDebugOutput},
-            {"--benchmark", &benchmarkTime}
+            {"--benchmark", &benchmarkTime},
+            {"--benchmarkWarmup", &benchmarkWarmup},
+            {"--benchmarkOutput", &benchmarkOutputFilename},
+            {"--sampleBudget", &sampleBudget},
+            {"--acceptedOrbitBudget", &acceptedOrbitBudget},
+            {"--targetNoise", &targetNoise},
+            {"--noiseCheckInterval", &noiseCheckInterval},
+            {"--shard", &shard},
+            {"--localShards", &localShards},
+            {"--seed", &randomSeed},
+            {"--checkpoint", &checkpointFilename},
+            {"--checkpointInterval", &checkpointInterval},
+            {"--resume", &resumeFilename},
+            {"--snapshotInterval", &snapshotInterval},
+            {"--pipelineCounters", &pipelineCountersFilename},
+            {"--autotune", &autotuneTime},
+            {"--workgroupCache", &workgroupCacheFilename},
+            {"--specializeShader", &specializeShader},
+            {"--shaderDirectory", &shaderDirectory},
+            {"--programCache", &programCache},
+            {"--programCacheDirectory", &programCacheDirectory},
+            {"--batch", &batchFilename},
+            {"--daemon", &daemonSocket},
+            {"--daemonQueueLimit", &daemonQueueLimit},
+            {"--engine", &engine},
+            {"--threads", &threadCount},
+            {"--exponent", &exponent},
+            {"--precision", &precision},
+            {"--cpuKernel", &cpuKernel}
         };
 
         for(int i=1; i < argc;++i)
@@ -350,10 +488,12 @@ namespace Helpers
                 std::cout << "Draws a buddhabrot and iterates until the user closes the window. If a --output filename is given, a png file will afterwards be written there." <<std::endl <<
                              "Supported options are:" << std::endl << std::endl <<
                              "--output [path] : File to write output to. Empty by default, meaning no output is written." << std::endl <<
+                             "--histogramOutput [path] : File to write the raw histogram to, for instance to combine several renders with buddha-merge. Empty by default." << std::endl <<
                              "--imageWidth [integer] : Width of the to be written image. 1024 by default. If no --output is given, this still detrmines the buffer size for rendering." << std::endl <<
                              "--imageHeight [integer] : Height of the to be written image. 576 by default. If no --output is given, this still detrmines the buffer size for rendering." << std::endl <<
                              "--imageGamma [float] : Gamma to use when writing the image. 1.0 by default. Ignored if no --output is given." << std::endl <<
                              "--imageColorScale [float] : Image brightness is scaled by the brightest pixel. The result is multiplied by this value. 2.0 by default, as 1.0 leaves very little dynamic range." << std::endl <<
+                             "--imageBitDepth [8,16] : Bits per color channel of the written image. 8 by default. The image is tone mapped on the GPU, so only the finished image is read back." << std::endl <<
                              "--windowWidth [integer] : Width of the preview window. 1024 by default." << std::endl <<
                              "--windowHeight [integer] : Height of the preview window. 576 by default." << std::endl <<
                              "--orbitLengthSkip [integer] : Minimum lengths for escaping orbits to be drawn at all. Default 0." << std::endl <<
@@ -363,13 +503,45 @@ namespace Helpers
                              "--localWorkgroupSizeX [integer] : How \"parallel\" the computation should be. Maximum possible and optimal value depends on GPU and drivers. The default is 16. Values up to 1024 are guaranteed to work." << std::endl <<
                              "--localWorkgroupSizeY [integer] : How \"parallel\" the computation should be. Maximum possible and optimal value depends on GPU and drivers. The default is 16. Values up to 1024 are guaranteed to work." << std::endl <<
                              "--localWorkgroupSizeZ [integer] : How \"parallel\" the computation should be. Maximum possible and optimal value depends on GPU and drivers. The default of 1. Values up to 64 are guaranteed to work." << std::endl <<
-                             "\tNOTE: There's also a limit on the product of the three local workgroup sizes, for which a number smaller or equal to 1024 is guaranteed to work. Higher numbers might work and run faster. Feel free to experiment." << std::endl <<
+                             "\tNOTE: There's also a limit on the product of the three local workgroup sizes, for which a number smaller or equal to 1024 is guaranteed to work. Higher numbers might work and run faster. Feel free to experiment, or let --autotune do so." << std::endl <<
                              "--globalWorkgroupSizeX [integer] : How often the local work group should be invoked per frame. Values up to 65535 are guaranteed to work. Default is 64." << std::endl <<
                              "--globalWorkgroupSizeY [integer] : How often the local work group should be invoked per frame. Values up to 65535 are guaranteed to work. Default is 64." << std::endl <<
                              "--globalWorkgroupSizeZ [integer] : How often the local work group should be invoked per frame. Values up to 65535 are guaranteed to work. Default is 1." << std::endl <<
-                             "--targetFrameRate [integer] : The number of iterations per frame will dynamically adjust to approximately reach this framerate. Default: 60." << std::endl <<
+                             "--autotune [integer] : Instead of rendering, benchmark a range of local and global work group sizes for this many seconds each, and store the fastest for this GPU and driver in the --workgroupCache. Later runs use them unless any work group size is given on the command line. All other options, image size and orbit lengths for instance, are used for the benchmarks. 0 by default." << std::endl <<
+                             "--workgroupCache [path] : File the work group sizes found by --autotune are stored in. ~/.buddhashader-workgroups by default, on Windows in %APPDATA%." << std::endl <<
+                             "--specializeShader [0,1] : If set to 1, image size and orbit lengths are compiled into the compute shader as constants, which lets the compiler simplify the index computations and loops. Every combination of them is compiled separately, but stored in the --programCache. Default 1." << std::endl <<
+                             "--shaderDirectory [path] : Load the shaders from the .glsl files in this directory instead of the ones built into the executable, to try out changes without rebuilding. Empty by default." << std::endl <<
+                             "--programCache [0,1] : If set to 1, compiled shaders are stored, so later launches with the same shaders, work group sizes and driver do not need to compile them again. Default 1." << std::endl <<
+                             "--programCacheDirectory [path] : Where compiled shaders are stored. $XDG_CACHE_HOME/BuddhaShader or ~/.cache/BuddhaShader by default, on Windows in %LOCALAPPDATA%." << std::endl <<
+                             "--targetFrameRate [integer] : Number of compute dispatches per second. The number of iterations per dispatch will dynamically adjust to approximately reach this rate, based on the GPU time the dispatches take. Default: 60." << std::endl <<
+                             "--previewRate [integer] : How often per second the preview window is redrawn. Dispatches in between only compute, and input is still handled after every dispatch. 0 redraws after every dispatch. Default: 10." << std::endl <<
+                             "--targetDispatchTime [float] : GPU time in milliseconds each compute dispatch should take. Overrides the one derived from --targetFrameRate. 0 by default." << std::endl <<
+                             "--dispatchLog [path] : Write the iteration count, predicted and measured GPU time of every timed dispatch to this csv file, to check the throughput model. Empty by default." << std::endl <<
+                             "--headless [0,1] : If set to 1, no window is opened and no preview is drawn. The OpenGL context is created through EGL, which also works without a display server. Rendering stops after --benchmark, a budget, --targetNoise or on SIGINT/SIGTERM. Default 0." << std::endl <<
                              "--printDebugOutput [0,1] : If set to 1, every orbitLength a message will be printed to stdout. Default 0." << std::endl <<
-                             "--benchmark [integer] : Run the application for this many seconds, and then print the maximum non-normalized color value. 0 by default, meaning no benchmark." << std::endl <<
+                             "--benchmark [integer] : Run the application for this many seconds, and then print how many candidate samples, accepted orbits, iterations and, if they are counted, histogram writes were processed per second. 0 by default, meaning no benchmark. See buddha-bench for comparing configurations." << std::endl <<
+                             "--benchmarkWarmup [integer] : Seconds at the start of --benchmark that are not measured, so the dispatch size can settle. Counts towards the --benchmark time. 0 by default." << std::endl <<
+                             "--benchmarkOutput [path] : JSON file to write the throughput measured by --benchmark to, for instance for buddha-bench. Histogram writes are only measured with --pipelineCounters or --engine cpu, and are null otherwise. Empty by default." << std::endl <<
+                             "--sampleBudget [integer] : Stop after exactly this many candidate orbits have been processed, and write the output. The result does not depend on the work group sizes. 0 by default, meaning no limit." << std::endl <<
+                             "--acceptedOrbitBudget [integer] : Stop after this many orbits have passed the escape check and have been drawn, and write the output. 0 by default, meaning no limit." << std::endl <<
+                             "--targetNoise [float] : Stop once the estimated relative noise of the image drops below this value, for instance 0.01 for 1%. The estimate compares snapshots of the histogram, which are taken without stalling the rendering. 0 by default, meaning no limit." << std::endl <<
+                             "--noiseCheckInterval [integer] : Seconds between two snapshots for --targetNoise. 10 by default." << std::endl <<
+                             "--shard [i/N] : Render only the i-th of N disjoint parts of the sample space (i counts from 0). Renders of all N shards can be combined with buddha-merge, without any sample being drawn twice. Default 0/1." << std::endl <<
+                             "--localShards [integer] : Start this many shards as separate processes on this machine, wait for them, and merge their results into --output and/or --histogramOutput. All other options are passed on to the shards. 0 by default." << std::endl <<
+                             "--batch [path] : Render the jobs in this file one after the other, reusing the context, the shaders and the buffers. Each line holds the options of one job in the same form as on the command line, and overrides the options given there. Empty lines and lines starting with # are skipped. Options that concern the context, the window for instance, can only be given on the command line. Empty by default." << std::endl <<
+                             "--daemon [path] : Keep running, and render the jobs submitted as JSON on a Unix domain socket at this path one after another, reusing the context, the shaders and the buffers. Jobs have a priority, can be cancelled, and their progress, throughput and remaining time can be queried. See the README for the requests. Empty by default." << std::endl <<
+                             "--daemonQueueLimit [integer] : Submissions to the --daemon are refused while this many jobs are waiting. 16 by default." << std::endl <<
+                             "--engine [gl,cpu] : Render through the engine interface of the library instead of the interactive renderer, with the compute shader or on the CPU. There is no preview, and only --sampleBudget, --benchmark and SIGINT/SIGTERM stop the render. The cpu engine does not need a GPU at all. Empty by default, meaning the interactive renderer." << std::endl <<
+                             "--threads [integer] : Number of threads of --engine cpu. 0 by default, meaning one per core." << std::endl <<
+                             "--exponent [integer] : Draw the orbits of z = z^exponent + c instead of z^2 + c. Only --engine cpu supports exponents other than 2. The viewport stays the same. Histogram files store the exponent, and buddha-merge refuses to combine renders of different exponents. Default 2." << std::endl <<
+                             "--precision [float,double,doubledouble] : Arithmetic of the orbits. Single precision is enough for the full view, but long orbits get escape decisions and positions wrong. double uses dvec2 in the compute shader, which GPUs run at a fraction of the single precision rate, and native doubles on the CPU. doubledouble represents every number as the unevaluated sum of two doubles for about 32 significant digits, and is only supported by --engine cpu. Renders in double or doubledouble cannot write or resume checkpoints. Histogram files store the precision, and buddha-merge refuses to combine renders of different precisions. Default float." << std::endl <<
+                             "--cpuKernel [specialized,generic] : With specialized, --engine cpu uses a kernel compiled for the precision, the exponent (2 to 4), whether all orbit lengths are equal and whether --orbitLengthSkip is set, without runtime checks for these. Other exponents and generic use one kernel that checks all of them at runtime, which is only useful for comparison. Default specialized." << std::endl <<
+                             "--seed [integer] : Selects the sequence of random samples. For a given seed and shard the samples are the same regardless of the work group sizes. Default 0." << std::endl <<
+                             "--checkpoint [path] : Periodically save the histogram and the state of all workers to this file, and once more on exit. The file is written in the background. Empty by default, meaning no checkpoints." << std::endl <<
+                             "--checkpointInterval [integer] : Seconds between two checkpoints. 600 by default." << std::endl <<
+                             "--resume [path] : Continue rendering from a checkpoint. Image size, orbit lengths, seed and shard must match the ones the checkpoint was written with. Work group sizes may differ." << std::endl <<
+                             "--snapshotInterval [integer] : Every this many seconds, update --output and/or --histogramOutput with the current state of the render, so it can be looked at while still running. The snapshots are read back and written in the background. 0 by default, meaning only the final result is written." << std::endl <<
+                             "--pipelineCounters [path] : Count how many samples are rejected at which stage and how many iterations each stage takes, and write the totals to this JSON file every few seconds and on exit. With --printDebugOutput 1 they are printed as well. Counting costs a little performance, so the compute shader only counts with this option. Empty by default." << std::endl <<
                              "--ignoreMaxBufferSize [0,1] : If set to 1, a failed maximum buffer size check is not treated as error. Some graphics drivers report lower values than their absolute limit. Do this on your own risk, though." << std::endl;
                 return false;
             }
@@ -390,11 +562,17 @@ namespace Helpers
                 std::cerr << "Unknown option: " << argAsString << std::endl;
                 return false;
             }
+            if(argAsString.find("WorkgroupSize") != std::string::npos)
+                workgroupSizesGiven = true;
             const SettingsPointer& ptr = setting->second;
             if(auto intProp = ptr.GetIntPtr())
             {
                 *intProp = std::stoi(valueAsString);
             }
+            else if(auto longProp = ptr.GetLongPtr())
+            {
+                *longProp = std::stoull(valueAsString);
+            }
             else if(auto dblProp = ptr.GetDblPtr())
             {
                 *dblProp = std::stod(valueAsString);
@@ -410,21 +588,231 @@ namespace Helpers
             }
         }
 
+        if(!shard.empty())
+        {
+            const auto separator = shard.find('/');
+            if(separator == std::string::npos)
+            {
+                std::cerr << "Invalid shard " << shard << ". Expected index/count, for instance 0/4." << std::endl;
+                return false;
+            }
+            shardIndex = std::stoi(shard.substr(0, separator));
+            shardCount = std::stoi(shard.substr(separator + 1));
+            if(shardCount == 0 || shardIndex >= shardCount)
+            {
+                std::cerr << "Invalid shard " << shard << ". The index has to be smaller than the shard count." << std::endl;
+                return false;
+            }
+        }
+        if(pngBitDepth != 8 && pngBitDepth != 16)
+        {
+            std::cerr << "Invalid image bit depth " << pngBitDepth << ". Only 8 and 16 are supported." << std::endl;
+            return false;
+        }
+        if(benchmarkWarmup != 0 && benchmarkWarmup >= benchmarkTime)
+        {
+            std::cerr << "--benchmarkWarmup has to be shorter than --benchmark." << std::endl;
+            return false;
+        }
+        if(snapshotInterval != 0 && pngFilename.empty() && histogramFilename.empty())
+        {
+            std::cerr << "--snapshotInterval needs --output and/or --histogramOutput to write the snapshots to." << std::endl;
+            return false;
+        }
+        if(localShards != 0 && autotuneTime != 0)
+        {
+            std::cerr << "--localShards and --autotune cannot be combined. The shards use the tuned work group sizes anyhow." << std::endl;
+            return false;
+        }
+        if(!batchFilename.empty() && (localShards != 0 || autotuneTime != 0))
+        {
+            std::cerr << "--batch cannot be combined with --localShards or --autotune." << std::endl;
+            return false;
+        }
+        if(!daemonSocket.empty() && (localShards != 0 || autotuneTime != 0 || !batchFilename.empty()))
+        {
+            std::cerr << "--daemon cannot be combined with --localShards, --autotune or --batch." << std::endl;
+            return false;
+        }
+        if(!engine.empty() && engine != "gl" && engine != "cpu")
+        {
+            std::cerr << "Unknown engine " << engine << ". Supported are gl and cpu." << std::endl;
+            return false;
+        }
+        if(exponent < 2 || (exponent != 2 && engine != "cpu"))
+        {
+            std::cerr << "--exponent has to be at least 2, and only --engine cpu supports exponents other than 2." << std::endl;
+            return false;
+        }
+        if(precision != "float" && precision != "double" && precision != "doubledouble")
+        {
+            std::cerr << "Unknown precision " << precision << ". Supported are float, double and doubledouble." << std::endl;
+            return false;
+        }
+        if(precision == "doubledouble" && engine != "cpu")
+        {
+            std::cerr << "Only --engine cpu supports --precision doubledouble." << std::endl;
+            return false;
+        }
+        if(precision != "float" && (!checkpointFilename.empty() || !resumeFilename.empty()))
+        {
+            std::cerr << "Checkpoints only store worker states of single precision renders, so --precision " << precision << " cannot be combined with --checkpoint or --resume." << std::endl;
+            return false;
+        }
+        if(cpuKernel != "specialized" && cpuKernel != "generic")
+        {
+            std::cerr << "Unknown CPU kernel " << cpuKernel << ". Supported are specialized and generic." << std::endl;
+            return false;
+        }
+        if(!engine.empty() && (acceptedOrbitBudget != 0 || targetNoise != 0.0 || !checkpointFilename.empty() || !resumeFilename.empty() || snapshotInterval != 0 || !batchFilename.empty() || !daemonSocket.empty() || autotuneTime != 0))
+        {
+            std::cerr << "--engine only supports --sampleBudget and --benchmark as stop conditions, and no checkpoints, snapshots, batches, daemon or autotuning." << std::endl;
+            return false;
+        }
+        if(localShards != 0 && shardCount != 1)
+        {
+            std::cerr << "--localShards and --shard cannot be combined." << std::endl;
+            return false;
+        }
+
         return true;
     }
 
-    bool DoesFileExist(const std::string &path)
+    uint64_t RenderSettings::GetShardSampleBudget() const
+    {
+        //shard i renders the global samples i, i+N, i+2N,... so this is the number of those below the budget.
+        return sampleBudget > shardIndex ? (sampleBudget - shardIndex + shardCount - 1) / shardCount : 0;
+    }
+
+    uint64_t RenderSettings::GetShardAcceptedOrbitBudget() const
+    {
+        return acceptedOrbitBudget > shardIndex ? (acceptedOrbitBudget - shardIndex + shardCount - 1) / shardCount : 0;
+    }
+
+    namespace
+    {
+        std::string shaderOverrideDirectory;
+    }
+
+    void SetShaderDirectory(const std::string &directory)
+    {
+        shaderOverrideDirectory = directory;
+    }
+
+    bool GetShaderSource(const std::string &name, std::string &source)
     {
-        std::ifstream f(path);
-        return f.good();
+        if(!shaderOverrideDirectory.empty())
+        {
+#if defined _WIN32 || defined __CYGWIN__
+            const std::string path = shaderOverrideDirectory + "\\" + name;
+#else
+            const std::string path = shaderOverrideDirectory + "/" + name;
+#endif
+            std::ifstream stream(path, std::ios::in);
+            if(!stream.is_open())
+            {
+                std::cerr << "Failed to load shader file from " << path << "." << std::endl;
+                return false;
+            }
+            std::stringstream sstr;
+            sstr << stream.rdbuf();
+            source = sstr.str();
+            return true;
+        }
+        for(unsigned int i = 0; i < EmbeddedShaderCount; ++i)
+        {
+            if(name == EmbeddedShaders[i].name)
+            {
+                source = EmbeddedShaders[i].source;
+                return true;
+            }
+        }
+        std::cerr << "There is no shader named " << name << " in this executable. This is a bug." << std::endl;
+        return false;
     }
 
-    void PrintBenchmarkScore(const std::vector<uint32_t> &data)
+    std::string QuoteShellArgument(const std::string &argument)
     {
-        uint32_t maxValue{0};
-        for(auto entry : data)
-            maxValue = std::max(maxValue,entry);
-        std::cout << "Benchmark Score (can only be compared for same parameters): " << maxValue << std::endl;
+#if defined _WIN32 || defined __CYGWIN__
+        std::string quoted("\"");
+        for(char c : argument)
+        {
+            if(c == '"')
+                quoted += "\\\"";
+            else
+                quoted += c;
+        }
+        return quoted + "\"";
+#else
+        std::string quoted("'");
+        for(char c : argument)
+        {
+            if(c == '\'')
+                quoted += "'\\''";
+            else
+                quoted += c;
+        }
+        return quoted + "'";
+#endif
+    }
+
+    int RunChildProcess(const std::string &command)
+    {
+#if defined _WIN32 || defined __CYGWIN__
+        //cmd.exe strips the first and last quote of the whole command line.
+        return std::system(("\"" + command + "\"").c_str());
+#else
+        //std::system returns a wait status, not the exit status of the command.
+        const int status = std::system(command.c_str());
+        if(status == -1)
+            return -1;
+        if(WIFEXITED(status))
+            return WEXITSTATUS(status);
+        return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : status;
+#endif
+    }
+
+    bool ReplaceFile(const std::string &temporaryPath, const std::string &path)
+    {
+#ifdef _WIN32
+        //rename does not overwrite existing files here.
+        return MoveFileExA(temporaryPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        return std::rename(temporaryPath.c_str(), path.c_str()) == 0;
+#endif
+    }
+
+    double EstimateRelativeNoise(const std::vector<uint32_t> &previous, const std::vector<uint32_t> &current)
+    {
+        //Both histograms are normalized by their sum. The earlier one is contained in the later one, so the variance of their difference
+        //is the variance of the earlier one minus the variance of the later one. With noise shrinking as one over the square root of the
+        //number of samples this gives noise(current)^2 = difference^2 * previousSum / (currentSum - previousSum).
+        double worstChannel{0.0};
+        for(unsigned int channel = 0; channel < 3; ++channel)
+        {
+            double previousSum{0.0};
+            double currentSum{0.0};
+            for(size_t i = channel; i < current.size(); i += 3)
+            {
+                previousSum += previous[i];
+                currentSum += current[i];
+            }
+            if(currentSum == 0.0)
+                continue; //a channel can stay empty, for instance if orbitLengthSkip exceeds its orbit length.
+            if(previousSum == 0.0 || currentSum <= previousSum)
+                return std::numeric_limits<double>::infinity();
+            double differenceSquared{0.0};
+            double currentSquared{0.0};
+            for(size_t i = channel; i < current.size(); i += 3)
+            {
+                const double normalizedCurrent{current[i] / currentSum};
+                const double difference{normalizedCurrent - previous[i] / previousSum};
+                differenceSquared += difference * difference;
+                currentSquared += normalizedCurrent * normalizedCurrent;
+            }
+            worstChannel = std::max(worstChannel, differenceSquared / currentSquared * previousSum / (currentSum - previousSum));
+        }
+        return std::sqrt(worstChannel);
     }
 
 }
@@ -0,0 +1,367 @@
+#include "HistogramFile.h"
+#include "Helpers.h"
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <atomic>
+#include <algorithm>
+
+namespace Helpers
+{
+    namespace
+    {
+        const char HistogramFileMagic[8] = {'B','U','D','D','H','A','H','I'};
+        const uint32_t HistogramFileVersion = 5;
+        const size_t MergeChunkSize = 1 << 18; //counts per chunk. Each thread keeps one chunk per input in memory.
+
+        bool ReadAndCheckHeader(std::istream& stream, const std::string& path, HistogramFileHeader& header)
+        {
+            stream.read(reinterpret_cast<char *>(&header), sizeof(header));
+            if(!stream.good() || memcmp(header.magic, HistogramFileMagic, sizeof(HistogramFileMagic)) != 0)
+            {
+                std::cerr << path << " is not a histogram file." << std::endl;
+                return false;
+            }
+            if(header.version != HistogramFileVersion || (header.bytesPerCount != sizeof(uint32_t) && header.bytesPerCount != sizeof(uint64_t)))
+            {
+                std::cerr << path << " has an unsupported histogram file version." << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+        bool AreHistogramsCompatible(const HistogramFileHeader& a, const HistogramFileHeader& b)
+        {
+            return a.width == b.width && a.bufferHeight == b.bufferHeight &&
+                    a.orbitLengthSkip == b.orbitLengthSkip && a.orbitLengthRed == b.orbitLengthRed &&
+                    a.orbitLengthGreen == b.orbitLengthGreen && a.orbitLengthBlue == b.orbitLengthBlue && a.exponent == b.exponent && a.precision == b.precision &&
+                    a.viewportRealMin == b.viewportRealMin && a.viewportRealMax == b.viewportRealMax && a.viewportImagMax == b.viewportImagMax;
+        }
+    }
+
+    HistogramFileHeader MakeHistogramFileHeader(unsigned int width, unsigned int bufferHeight, unsigned int orbitLengthSkip, unsigned int orbitLengthRed, unsigned int orbitLengthGreen, unsigned int orbitLengthBlue, unsigned int shardIndex, unsigned int shardCount, unsigned int randomSeed, unsigned int exponent, const std::string& precision)
+    {
+        HistogramFileHeader header{};
+        memcpy(header.magic, HistogramFileMagic, sizeof(header.magic));
+        header.version = HistogramFileVersion;
+        header.bytesPerCount = sizeof(uint32_t);
+        header.width = width;
+        header.bufferHeight = bufferHeight;
+        header.orbitLengthSkip = orbitLengthSkip;
+        header.orbitLengthRed = orbitLengthRed;
+        header.orbitLengthGreen = orbitLengthGreen;
+        header.orbitLengthBlue = orbitLengthBlue;
+        header.shardIndex = shardIndex;
+        header.shardCount = shardCount;
+        header.randomSeed = randomSeed;
+        header.exponent = exponent;
+        header.precision = precision == "doubledouble" ? 2 : (precision == "double" ? 1 : 0);
+        header.viewportRealMin = ViewportRealMin;
+        header.viewportRealMax = ViewportRealMax;
+        header.viewportImagMax = ViewportImagMax;
+        return header;
+    }
+
+    bool WriteHistogramFile(const std::string &path, const HistogramFile &file, bool withWorkerStates)
+    {
+        std::ofstream stream(path, std::ios::out | std::ios::binary | std::ios::trunc);
+        if(!stream.is_open())
+        {
+            std::cerr << "Failed to open " << path << " for writing." << std::endl;
+            return false;
+        }
+        HistogramFileHeader header = file.header;
+        header.workerCount = withWorkerStates ? static_cast<uint32_t>(file.workerStates.size()) : 0;
+        stream.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        stream.write(reinterpret_cast<const char *>(file.counts.data()), file.counts.size() * sizeof(uint32_t));
+        stream.write(reinterpret_cast<const char *>(file.workerStates.data()), header.workerCount * sizeof(WorkerState));
+        stream.flush();
+        if(!stream.good())
+        {
+            std::cerr << "Failed to write " << path << "." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool ReadHistogramFile(const std::string &path, HistogramFile &file)
+    {
+        std::ifstream stream(path, std::ios::in | std::ios::binary);
+        if(!stream.is_open())
+        {
+            std::cerr << "Failed to open " << path << " for reading." << std::endl;
+            return false;
+        }
+        if(!ReadAndCheckHeader(stream, path, file.header))
+            return false;
+        if(file.header.bytesPerCount != sizeof(uint32_t))
+        {
+            std::cerr << path << " contains 64 bit counts, which cannot be loaded onto the GPU." << std::endl;
+            return false;
+        }
+        file.counts.resize(3 * static_cast<size_t>(file.header.width) * file.header.bufferHeight);
+        file.workerStates.resize(file.header.workerCount);
+        stream.read(reinterpret_cast<char *>(file.counts.data()), file.counts.size() * sizeof(uint32_t));
+        stream.read(reinterpret_cast<char *>(file.workerStates.data()), file.workerStates.size() * sizeof(WorkerState));
+        if(!stream.good())
+        {
+            std::cerr << path << " is truncated." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool HistogramFileReader::Open(const std::string &filePath)
+    {
+        path = filePath;
+        stream.open(path, std::ios::in | std::ios::binary);
+        if(!stream.is_open())
+        {
+            std::cerr << "Failed to open " << path << " for reading." << std::endl;
+            return false;
+        }
+        return ReadAndCheckHeader(stream, path, header);
+    }
+
+    const HistogramFileHeader &HistogramFileReader::GetHeader() const
+    {
+        return header;
+    }
+
+    uint64_t HistogramFileReader::GetCountNumber() const
+    {
+        return 3 * static_cast<uint64_t>(header.width) * header.bufferHeight;
+    }
+
+    bool HistogramFileReader::ReadCounts(uint64_t firstCount, size_t countNumber, uint64_t *target)
+    {
+        readBuffer.resize(countNumber * header.bytesPerCount);
+        stream.seekg(sizeof(HistogramFileHeader) + firstCount * header.bytesPerCount);
+        stream.read(readBuffer.data(), readBuffer.size());
+        if(!stream.good())
+        {
+            std::cerr << path << " is truncated." << std::endl;
+            return false;
+        }
+        if(header.bytesPerCount == sizeof(uint64_t))
+        {
+            memcpy(target, readBuffer.data(), readBuffer.size());
+        }
+        else
+        {
+            const uint32_t * source = reinterpret_cast<const uint32_t *>(readBuffer.data());
+            std::copy(source, source + countNumber, target);
+        }
+        return true;
+    }
+
+    bool MergeHistogramFiles(const std::vector<std::string> &inputPaths, const std::string &outputPath, unsigned int threadCount, uint64_t &maxValue)
+    {
+        if(inputPaths.empty())
+        {
+            std::cerr << "No histograms to merge." << std::endl;
+            return false;
+        }
+        if(std::find(inputPaths.begin(), inputPaths.end(), outputPath) != inputPaths.end())
+        {
+            std::cerr << "The merged histogram " << outputPath << " must not be one of the inputs." << std::endl;
+            return false;
+        }
+        std::vector<HistogramFileHeader> headers(inputPaths.size());
+        for(size_t i = 0; i < inputPaths.size(); ++i)
+        {
+            HistogramFileReader reader;
+            if(!reader.Open(inputPaths[i]))
+                return false;
+            headers[i] = reader.GetHeader();
+            if(!AreHistogramsCompatible(headers[0], headers[i]))
+            {
+                std::cerr << inputPaths[i] << " does not match the image size, viewport, orbit lengths, exponent or precision of " << inputPaths[0] << "." << std::endl;
+                return false;
+            }
+            for(size_t j = 0; j < i; ++j)
+            {
+                //not an error, but hardly what the user wants.
+                if(headers[i].shardCount != 0 && headers[j].shardCount == headers[i].shardCount && headers[j].shardIndex == headers[i].shardIndex && headers[j].randomSeed == headers[i].randomSeed)
+                    std::cerr << "Warning: " << inputPaths[j] << " and " << inputPaths[i] << " were rendered from the same sample stream (shard " << headers[i].shardIndex << "/" << headers[i].shardCount << "), so their samples are identical." << std::endl;
+            }
+        }
+        HistogramFileHeader mergedHeader = headers[0];
+        mergedHeader.bytesPerCount = sizeof(uint64_t);
+        mergedHeader.workerCount = 0;
+        mergedHeader.shardIndex = 0;
+        mergedHeader.shardCount = 0;
+        mergedHeader.sampleCount = 0;
+        mergedHeader.iterationCount = 0;
+        mergedHeader.claimedSampleCount = 0;
+        mergedHeader.acceptedOrbitCount = 0;
+        for(const auto& header : headers)
+        {
+            mergedHeader.sampleCount += header.sampleCount;
+            mergedHeader.iterationCount += header.iterationCount;
+            mergedHeader.claimedSampleCount += header.claimedSampleCount;
+            mergedHeader.acceptedOrbitCount += header.acceptedOrbitCount;
+        }
+        const uint64_t countNumber = 3 * static_cast<uint64_t>(mergedHeader.width) * mergedHeader.bufferHeight;
+
+        //the result only replaces outputPath once it is complete, so a failed merge leaves whatever was there before.
+        const std::string temporaryPath = outputPath + ".tmp";
+        {
+            //write the header and give the file its final size, so the threads can write their chunks in any order.
+            std::ofstream output(temporaryPath, std::ios::out | std::ios::binary | std::ios::trunc);
+            output.write(reinterpret_cast<const char *>(&mergedHeader), sizeof(mergedHeader));
+            if(countNumber > 0)
+            {
+                output.seekp(sizeof(mergedHeader) + countNumber * sizeof(uint64_t) - 1);
+                output.put(0);
+            }
+            if(!output.good())
+            {
+                std::cerr << "Failed to write " << temporaryPath << "." << std::endl;
+                output.close();
+                std::remove(temporaryPath.c_str());
+                return false;
+            }
+        }
+
+        const uint64_t chunkCount = (countNumber + MergeChunkSize - 1) / MergeChunkSize;
+        std::atomic<uint64_t> nextChunk{0};
+        std::atomic<bool> failed{false};
+        std::vector<uint64_t> maxValuePerThread(std::max(1u, threadCount), 0);
+        auto mergeChunks = [&](unsigned int threadIndex)
+        {
+            std::vector<HistogramFileReader> readers(inputPaths.size());
+            for(size_t i = 0; i < inputPaths.size(); ++i)
+            {
+                if(!readers[i].Open(inputPaths[i]))
+                {
+                    failed = true;
+                    return;
+                }
+            }
+            std::fstream output(temporaryPath, std::ios::in | std::ios::out | std::ios::binary);
+            std::vector<uint64_t> sum(MergeChunkSize);
+            std::vector<uint64_t> input(MergeChunkSize);
+            for(uint64_t chunk = nextChunk++; chunk < chunkCount && !failed; chunk = nextChunk++)
+            {
+                const uint64_t firstCount = chunk * MergeChunkSize;
+                const size_t chunkLength = static_cast<size_t>(std::min<uint64_t>(MergeChunkSize, countNumber - firstCount));
+                std::fill(sum.begin(), sum.begin() + chunkLength, 0);
+                for(auto& reader : readers)
+                {
+                    if(!reader.ReadCounts(firstCount, chunkLength, input.data()))
+                    {
+                        failed = true;
+                        return;
+                    }
+                    for(size_t i = 0; i < chunkLength; ++i)
+                        sum[i] += input[i];
+                }
+                maxValuePerThread[threadIndex] = std::max(maxValuePerThread[threadIndex], *std::max_element(sum.begin(), sum.begin() + chunkLength));
+                output.seekp(sizeof(HistogramFileHeader) + firstCount * sizeof(uint64_t));
+                output.write(reinterpret_cast<const char *>(sum.data()), chunkLength * sizeof(uint64_t));
+                if(!output.good())
+                {
+                    std::cerr << "Failed to write " << temporaryPath << "." << std::endl;
+                    failed = true;
+                    return;
+                }
+            }
+        };
+        std::vector<std::thread> threads;
+        for(unsigned int i = 1; i < maxValuePerThread.size(); ++i)
+            threads.emplace_back(mergeChunks, i);
+        mergeChunks(0);
+        for(auto& thread : threads)
+            thread.join();
+
+        if(failed)
+        {
+            std::remove(temporaryPath.c_str());
+            return false;
+        }
+        if(!ReplaceFile(temporaryPath, outputPath))
+        {
+            std::cerr << "Failed to move " << temporaryPath << " to " << outputPath << "." << std::endl;
+            std::remove(temporaryPath.c_str());
+            return false;
+        }
+        maxValue = *std::max_element(maxValuePerThread.begin(), maxValuePerThread.end());
+        return true;
+    }
+
+    AsyncHistogramWriter::AsyncHistogramWriter() : worker(&AsyncHistogramWriter::WorkerLoop, this)
+    {
+    }
+
+    AsyncHistogramWriter::~AsyncHistogramWriter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            shutdown = true;
+        }
+        condition.notify_all();
+        worker.join();
+    }
+
+    bool AsyncHistogramWriter::IsBusy()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return hasJob;
+    }
+
+    void AsyncHistogramWriter::Submit(const std::string &path, HistogramFile &&file)
+    {
+        SubmitJob({path, true, "", 0, std::move(file), {}});
+    }
+
+    void AsyncHistogramWriter::SubmitSnapshot(const std::string &histogramPath, const std::string &pngPath, unsigned int bitDepth, HistogramFile &&file, std::vector<uint8_t> &&image)
+    {
+        SubmitJob({histogramPath, false, pngPath, bitDepth, std::move(file), std::move(image)});
+    }
+
+    void AsyncHistogramWriter::SubmitJob(Job &&newJob)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this]{ return !hasJob; });
+            job = std::move(newJob);
+            hasJob = true;
+        }
+        condition.notify_all();
+    }
+
+    void AsyncHistogramWriter::WaitUntilIdle()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this]{ return !hasJob; });
+    }
+
+    void AsyncHistogramWriter::WorkerLoop()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while(true)
+        {
+            condition.wait(lock, [this]{ return hasJob || shutdown; });
+            if(!hasJob)
+                return;
+            //the job data is not touched by Submit while hasJob is set, so we can write without holding the lock.
+            lock.unlock();
+            auto replaceFile = [](const std::string& temporaryPath, const std::string& path)
+            {
+                if(!ReplaceFile(temporaryPath, path))
+                    std::cerr << "Failed to move " << temporaryPath << " to " << path << "." << std::endl;
+            };
+            if(!job.histogramPath.empty() && WriteHistogramFile(job.histogramPath + ".tmp", job.data, job.withWorkerStates))
+                replaceFile(job.histogramPath + ".tmp", job.histogramPath);
+            if(!job.pngPath.empty() && WritePackedPNG(job.pngPath + ".tmp", job.image, job.data.header.width, 2 * job.data.header.bufferHeight, job.bitDepth))
+                replaceFile(job.pngPath + ".tmp", job.pngPath);
+            lock.lock();
+            job.data = HistogramFile();
+            job.image = std::vector<uint8_t>();
+            hasJob = false;
+            condition.notify_all();
+        }
+    }
+}
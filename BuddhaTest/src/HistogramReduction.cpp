@@ -0,0 +1,67 @@
+#include "HistogramReduction.h"
+#include "Helpers.h"
+#include <algorithm>
+
+namespace Helpers
+{
+    namespace
+    {
+        //must match REDUCTION_GROUP_SIZE in the shader.
+        const unsigned int ReductionGroupSize = 256;
+        //every invocation handles at least this many pixels, so the per group overhead of clearing and merging the bins stays small.
+        const unsigned int PixelsPerInvocation = 16;
+    }
+
+    uint32_t HistogramStatistics::GetMaxCount() const
+    {
+        return std::max({channels[0].maxCount, channels[1].maxCount, channels[2].maxCount, UINT32_C(1)});
+    }
+
+    HistogramReduction::~HistogramReduction()
+    {
+        if(statisticsBuffer != 0)
+            glDeleteBuffers(1, &statisticsBuffer);
+        if(program != 0)
+            glDeleteProgram(program);
+    }
+
+    bool HistogramReduction::Init(const std::string &shaderName)
+    {
+        program = LoadComputeShader(shaderName, ReductionGroupSize, 1, 1);
+        if(program == 0)
+            return false;
+        pixelCountHandle = glGetUniformLocation(program, "pixelCount");
+        reductionPassHandle = glGetUniformLocation(program, "reductionPass");
+
+        glGenBuffers(1, &statisticsBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, statisticsBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(HistogramStatistics), nullptr, GL_DYNAMIC_COPY);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        return true;
+    }
+
+    void HistogramReduction::Run(GLuint sourceBuffer, unsigned int pixelCount)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, statisticsBuffer);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, sourceBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, statisticsBuffer);
+        const GLuint groupCount = std::max(1u, std::min(1024u, (pixelCount + ReductionGroupSize * PixelsPerInvocation - 1) / (ReductionGroupSize * PixelsPerInvocation)));
+        glUseProgram(program);
+        glUniform1ui(pixelCountHandle, pixelCount);
+        glUniform1ui(reductionPassHandle, 0);
+        glDispatchCompute(groupCount, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        glUniform1ui(reductionPassHandle, 1);
+        glDispatchCompute(1, 1, 1);
+        //the statistics are read by the preview and by buffer copies.
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    }
+
+    GLuint HistogramReduction::GetBuffer() const
+    {
+        return statisticsBuffer;
+    }
+}
@@ -0,0 +1,94 @@
+#include "LocalShards.h"
+#include "HistogramFile.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <unordered_set>
+#include <cstdlib>
+#include <cstdio>
+#include <algorithm>
+
+namespace Helpers
+{
+    namespace
+    {
+        std::string ShardFilename(const std::string& path, unsigned int shardIndex)
+        {
+            return path + ".shard" + std::to_string(shardIndex);
+        }
+    }
+
+    int RunLocalShards(const RenderSettings &settings, int argc, char *argv[])
+    {
+        if(settings.pngFilename.empty() && settings.histogramFilename.empty())
+        {
+            std::cerr << "--localShards needs --output and/or --histogramOutput, otherwise the result would be thrown away." << std::endl;
+            return 2;
+        }
+        const unsigned int shardCount = settings.localShards;
+        const std::string shardHistogramBase = settings.histogramFilename.empty() ? settings.pngFilename : settings.histogramFilename;
+
+        //everything that is written or read per shard gets replaced, all other options are passed on unchanged.
+        const std::unordered_set<std::string> perShardOptions{"--localShards", "--output", "--histogramOutput", "--checkpoint", "--resume", "--dispatchLog", "--pipelineCounters", "--benchmarkOutput"};
+        std::string commonArguments = QuoteShellArgument(argv[0]);
+        for(int i = 1; i + 1 < argc; i += 2)
+        {
+            if(perShardOptions.count(argv[i]) == 0)
+                commonArguments += " " + QuoteShellArgument(argv[i]) + " " + QuoteShellArgument(argv[i+1]);
+        }
+
+        std::vector<std::string> shardHistograms(shardCount);
+        std::vector<int> exitCodes(shardCount, 0);
+        std::vector<std::thread> shardThreads;
+        for(unsigned int i = 0; i < shardCount; ++i)
+        {
+            shardHistograms[i] = ShardFilename(shardHistogramBase, i);
+            std::string command = commonArguments +
+                    " --shard " + std::to_string(i) + "/" + std::to_string(shardCount) +
+                    " --histogramOutput " + QuoteShellArgument(shardHistograms[i]);
+            if(!settings.checkpointFilename.empty())
+                command += " --checkpoint " + QuoteShellArgument(ShardFilename(settings.checkpointFilename, i));
+            if(!settings.resumeFilename.empty())
+                command += " --resume " + QuoteShellArgument(ShardFilename(settings.resumeFilename, i));
+            if(!settings.dispatchLogFilename.empty())
+                command += " --dispatchLog " + QuoteShellArgument(ShardFilename(settings.dispatchLogFilename, i));
+            if(!settings.pipelineCountersFilename.empty())
+                command += " --pipelineCounters " + QuoteShellArgument(ShardFilename(settings.pipelineCountersFilename, i));
+            if(!settings.benchmarkOutputFilename.empty())
+                command += " --benchmarkOutput " + QuoteShellArgument(ShardFilename(settings.benchmarkOutputFilename, i));
+            if(settings.printDebugOutput != 0)
+                std::cout << "Starting shard " << i << ": " << command << std::endl;
+            shardThreads.emplace_back([&exitCodes, i, command]{ exitCodes[i] = RunChildProcess(command); });
+        }
+        for(auto& thread : shardThreads)
+            thread.join();
+
+        bool allShardsSucceeded{true};
+        for(unsigned int i = 0; i < shardCount; ++i)
+        {
+            if(exitCodes[i] != 0)
+            {
+                std::cerr << "Shard " << i << "/" << shardCount << " failed with exit status " << exitCodes[i] << ". Its histogram is not merged." << std::endl;
+                allShardsSucceeded = false;
+            }
+        }
+        if(!allShardsSucceeded)
+            return 1;
+
+        const bool keepHistogram{!settings.histogramFilename.empty()};
+        const std::string mergedPath = keepHistogram ? settings.histogramFilename : settings.pngFilename + ".histogram.tmp";
+        uint64_t maxValue{0};
+        if(!MergeHistogramFiles(shardHistograms, mergedPath, std::max(1u, std::thread::hardware_concurrency()), maxValue))
+            return 1;
+        for(const auto& shardHistogram : shardHistograms)
+            std::remove(shardHistogram.c_str());
+
+        bool success{true};
+        if(!settings.pngFilename.empty())
+            success = WriteOutputPNG(settings.pngFilename, mergedPath, std::max(maxValue, UINT64_C(1)), settings.pngGamma, settings.pngColorScale, settings.pngBitDepth);
+        if(!keepHistogram)
+            std::remove(mergedPath.c_str());
+        return success ? 0 : 1;
+    }
+}
@@ -0,0 +1,189 @@
+#include "PipelineCounters.h"
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <cmath>
+#include <limits>
+
+namespace Helpers
+{
+    namespace
+    {
+        const char * const CounterNames[PipelineCounterCount] = {
+            "startedSamples",
+            "rejectedByMainCardioid",
+            "rejectedByKnownCircle",
+            "rejectedNotEscaping",
+            "rejectedTooShort",
+            "drawnOrbits",
+            "escapeCheckIterations",
+            "drawIterations",
+            "idleIterations",
+            "histogramWrites"
+        };
+
+        const unsigned int ThroughputCount = 4;
+        const char * const ThroughputNames[ThroughputCount] = {
+            "candidatesPerSecond",
+            "acceptedOrbitsPerSecond",
+            "iterationsPerSecond",
+            "histogramWritesPerSecond"
+        };
+
+        double Fraction(uint64_t part, uint64_t total)
+        {
+            return total != 0 ? 100.0 * static_cast<double>(part) / static_cast<double>(total) : 0.0;
+        }
+    }
+
+    PipelineThroughput GetPipelineThroughput(const PipelineCounters &counters, double seconds)
+    {
+        const uint64_t * values = counters.values;
+        const double computedIterations = static_cast<double>(values[StartedSamples] + values[EscapeCheckIterations] + values[DrawIterations]);
+        return {values[StartedSamples] / seconds, values[DrawnOrbits] / seconds, computedIterations / seconds, values[HistogramWrites] / seconds};
+    }
+
+    void PrintPipelineCounters(const PipelineCounters &counters, double seconds)
+    {
+        const uint64_t * values = counters.values;
+        //starting a sample counts as one iteration.
+        const uint64_t totalIterations = values[StartedSamples] + values[EscapeCheckIterations] + values[DrawIterations] + values[IdleIterations];
+        std::cout << std::fixed << std::setprecision(2) <<
+                     "Samples started: " << values[StartedSamples] << " (" << values[StartedSamples] / seconds << " per second)" << std::endl <<
+                     "  rejected by main cardioid: " << Fraction(values[RejectedByMainCardioid], values[StartedSamples]) << "%" << std::endl <<
+                     "  rejected by known circles: " << Fraction(values[RejectedByKnownCircle], values[StartedSamples]) << "%" << std::endl <<
+                     "  rejected, not escaping: " << Fraction(values[RejectedNotEscaping], values[StartedSamples]) << "%" << std::endl <<
+                     "  rejected, orbit too short: " << Fraction(values[RejectedTooShort], values[StartedSamples]) << "%" << std::endl <<
+                     "  drawn: " << Fraction(values[DrawnOrbits], values[StartedSamples]) << "%" << std::endl <<
+                     "Iterations: " << totalIterations << " (" << totalIterations / seconds << " per second)" << std::endl <<
+                     "  escape check: " << Fraction(values[EscapeCheckIterations], totalIterations) << "%" << std::endl <<
+                     "  drawing: " << Fraction(values[DrawIterations], totalIterations) << "%" << std::endl <<
+                     "  idle: " << Fraction(values[IdleIterations], totalIterations) << "%" << std::endl <<
+                     "Histogram writes: " << values[HistogramWrites] << " (" << values[HistogramWrites] / seconds << " per second)" << std::endl <<
+                     std::defaultfloat << std::setprecision(6);
+    }
+
+    void PrintPipelineThroughput(const PipelineThroughput &throughput)
+    {
+        std::cout << std::fixed << std::setprecision(0) <<
+                     "Benchmark: " << throughput.candidates << " candidates/s, " << throughput.acceptedOrbits << " accepted orbits/s, " << throughput.iterations << " iterations/s";
+        if(!std::isnan(throughput.histogramWrites))
+            std::cout << ", " << throughput.histogramWrites << " histogram writes/s";
+        std::cout << std::endl << std::defaultfloat << std::setprecision(6);
+    }
+
+    bool WritePipelineThroughput(const std::string &path, const PipelineThroughput &throughput)
+    {
+        std::ofstream file(path, std::ios::out | std::ios::trunc);
+        if(!file.is_open())
+        {
+            std::cerr << "Failed to open " << path << " for writing." << std::endl;
+            return false;
+        }
+        const double values[ThroughputCount] = {throughput.candidates, throughput.acceptedOrbits, throughput.iterations, throughput.histogramWrites};
+        file << std::setprecision(10) << "{";
+        for(unsigned int i = 0; i < ThroughputCount; ++i)
+        {
+            file << (i == 0 ? "\n    \"" : ",\n    \"") << ThroughputNames[i] << "\": ";
+            if(std::isnan(values[i]))
+                file << "null";
+            else
+                file << values[i];
+        }
+        file << "\n}\n";
+        return file.good();
+    }
+
+    bool WritePipelineCounters(const std::string &path, const PipelineCounters &counters, double seconds)
+    {
+        std::ofstream file(path, std::ios::out | std::ios::trunc);
+        if(!file.is_open())
+        {
+            std::cerr << "Failed to open " << path << " for writing." << std::endl;
+            return false;
+        }
+        file << "{\n    \"seconds\": " << seconds;
+        for(unsigned int i = 0; i < PipelineCounterCount; ++i)
+            file << ",\n    \"" << CounterNames[i] << "\": " << counters.values[i];
+        file << "\n}\n";
+        return file.good();
+    }
+
+    bool ReadPipelineCounters(const std::string &path, PipelineCounters &counters, double &seconds)
+    {
+        std::ifstream file(path);
+        if(!file.is_open())
+        {
+            std::cerr << "Failed to open " << path << " for reading." << std::endl;
+            return false;
+        }
+        //the files only contain one flat object of numbers, one per line, so there is no need for a real JSON parser.
+        bool found[PipelineCounterCount] = {};
+        bool foundSeconds{false};
+        std::string line;
+        while(std::getline(file, line))
+        {
+            const auto nameStart = line.find('"');
+            const auto nameEnd = line.find('"', nameStart + 1);
+            const auto colon = line.find(':', nameEnd);
+            if(nameStart == std::string::npos || nameEnd == std::string::npos || colon == std::string::npos)
+                continue;
+            const std::string name = line.substr(nameStart + 1, nameEnd - nameStart - 1);
+            std::istringstream value(line.substr(colon + 1));
+            if(name == "seconds")
+                foundSeconds = static_cast<bool>(value >> seconds);
+            for(unsigned int i = 0; i < PipelineCounterCount; ++i)
+            {
+                if(name == CounterNames[i])
+                    found[i] = static_cast<bool>(value >> counters.values[i]);
+            }
+        }
+        for(unsigned int i = 0; i < PipelineCounterCount; ++i)
+            foundSeconds = foundSeconds && found[i];
+        if(!foundSeconds)
+            std::cerr << path << " is not a complete pipeline counter file." << std::endl;
+        return foundSeconds;
+    }
+
+    bool ReadPipelineThroughput(const std::string &path, PipelineThroughput &throughput)
+    {
+        std::ifstream file(path);
+        if(!file.is_open())
+        {
+            std::cerr << "Failed to open " << path << " for reading." << std::endl;
+            return false;
+        }
+        //one flat object of numbers again, see ReadPipelineCounters.
+        double values[ThroughputCount];
+        bool found[ThroughputCount] = {};
+        std::string line;
+        while(std::getline(file, line))
+        {
+            const auto nameStart = line.find('"');
+            const auto nameEnd = line.find('"', nameStart + 1);
+            const auto colon = line.find(':', nameEnd);
+            if(nameStart == std::string::npos || nameEnd == std::string::npos || colon == std::string::npos)
+                continue;
+            const std::string name = line.substr(nameStart + 1, nameEnd - nameStart - 1);
+            std::istringstream value(line.substr(colon + 1));
+            for(unsigned int i = 0; i < ThroughputCount; ++i)
+            {
+                if(name != ThroughputNames[i])
+                    continue;
+                values[i] = std::numeric_limits<double>::quiet_NaN();
+                found[i] = line.find("null", colon) != std::string::npos || static_cast<bool>(value >> values[i]);
+            }
+        }
+        bool complete{true};
+        for(unsigned int i = 0; i < ThroughputCount; ++i)
+            complete = complete && found[i];
+        if(!complete)
+        {
+            std::cerr << path << " is not a complete benchmark result." << std::endl;
+            return false;
+        }
+        throughput = {values[0], values[1], values[2], values[3]};
+        return true;
+    }
+}
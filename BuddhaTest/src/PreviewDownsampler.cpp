@@ -0,0 +1,94 @@
+#include "PreviewDownsampler.h"
+#include "Helpers.h"
+
+namespace Helpers
+{
+    namespace
+    {
+        //must match the local size the shader is loaded with.
+        const unsigned int PreviewGroupSize = 16;
+
+        unsigned int DivideRoundingUp(unsigned int dividend, unsigned int divisor)
+        {
+            return (dividend + divisor - 1) / divisor;
+        }
+    }
+
+    PreviewDownsampler::~PreviewDownsampler()
+    {
+        if(previewBuffer != 0)
+            glDeleteBuffers(1, &previewBuffer);
+        if(program != 0)
+            glDeleteProgram(program);
+    }
+
+    bool PreviewDownsampler::Init(const std::string &shaderName, unsigned int histogramWidthToFilter, unsigned int histogramBufferHeightToFilter)
+    {
+        program = LoadComputeShader(shaderName, PreviewGroupSize, PreviewGroupSize, 1);
+        if(program == 0)
+            return false;
+        previewSizeHandle = glGetUniformLocation(program, "previewSize");
+        largestBoxAreaHandle = glGetUniformLocation(program, "largestBoxArea");
+        glGenBuffers(1, &previewBuffer);
+        SetHistogramSize(histogramWidthToFilter, histogramBufferHeightToFilter);
+        return true;
+    }
+
+    void PreviewDownsampler::SetHistogramSize(unsigned int histogramWidthToFilter, unsigned int histogramBufferHeightToFilter)
+    {
+        histogramWidth = histogramWidthToFilter;
+        histogramBufferHeight = histogramBufferHeightToFilter;
+        glUseProgram(program);
+        glUniform2ui(glGetUniformLocation(program, "histogramSize"), histogramWidth, histogramBufferHeight);
+        //the box sizes depend on the histogram size as well.
+        width = 0;
+        bufferHeight = 0;
+    }
+
+    bool PreviewDownsampler::Resize(unsigned int windowWidth, unsigned int windowHeight)
+    {
+        //the lower half of the window is mirrored, an odd middle row belongs to the upper half.
+        const unsigned int newBufferHeight = DivideRoundingUp(windowHeight, 2);
+        if(windowWidth == width && newBufferHeight == bufferHeight)
+            return false;
+        width = windowWidth;
+        bufferHeight = newBufferHeight;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, previewBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, 4 * 3 * static_cast<GLsizeiptr>(GetPixelCount()), nullptr, GL_DYNAMIC_COPY);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, previewBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glUseProgram(program);
+        glUniform2ui(previewSizeHandle, width, bufferHeight);
+        glUniform1f(largestBoxAreaHandle, static_cast<float>(DivideRoundingUp(histogramWidth, width) * DivideRoundingUp(histogramBufferHeight, bufferHeight)));
+        return true;
+    }
+
+    void PreviewDownsampler::Run()
+    {
+        if(GetPixelCount() == 0)
+            return;
+        glUseProgram(program);
+        glDispatchCompute(DivideRoundingUp(width, PreviewGroupSize), DivideRoundingUp(bufferHeight, PreviewGroupSize), 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+
+    GLuint PreviewDownsampler::GetBuffer() const
+    {
+        return previewBuffer;
+    }
+
+    unsigned int PreviewDownsampler::GetWidth() const
+    {
+        return width;
+    }
+
+    unsigned int PreviewDownsampler::GetBufferHeight() const
+    {
+        return bufferHeight;
+    }
+
+    unsigned int PreviewDownsampler::GetPixelCount() const
+    {
+        return width * bufferHeight;
+    }
+}
@@ -0,0 +1,183 @@
+#include "ProgramCache.h"
+#include "Helpers.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <random>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#if defined _WIN32 || defined __CYGWIN__
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+namespace Helpers
+{
+    namespace
+    {
+        const char ProgramCacheMagic[4] = {'B', 'S', 'P', 'B'};
+        const uint64_t FileNameOffsetBasis = UINT64_C(14695981039346656037);
+        const uint64_t CheckOffsetBasis = UINT64_C(0x84222325cbf29ce4);
+
+#if defined _WIN32 || defined __CYGWIN__
+        const char PathSeparator = '\\';
+#else
+        const char PathSeparator = '/';
+#endif
+
+        std::string cacheDirectory;
+        ProgramCacheStatistics statistics{0, 0};
+
+        /** FNV-1a. Two different offset bases give the file name and a check value stored in the file, so a collision of the former is detected. */
+        uint64_t HashKey(const std::vector<std::string>& sources, uint64_t offsetBasis)
+        {
+            std::string key;
+            for(const auto& source : sources)
+                key.append(source).push_back('\0');
+            for(GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION})
+                key.append(reinterpret_cast<const char *>(glGetString(name))).push_back('\0');
+            uint64_t hash{offsetBasis};
+            for(unsigned char c : key)
+            {
+                hash ^= c;
+                hash *= UINT64_C(1099511628211);
+            }
+            return hash;
+        }
+
+        std::string GetEntryPath(uint64_t hash)
+        {
+            std::ostringstream name;
+            name << cacheDirectory << PathSeparator << std::hex << std::setw(16) << std::setfill('0') << hash << ".program";
+            return name.str();
+        }
+
+        /** Creates the directory and all of its parents. Existing ones are fine. */
+        void CreateDirectories(const std::string& path)
+        {
+            for(size_t end = path.find_first_of("/\\", 1); ; end = path.find_first_of("/\\", end + 1))
+            {
+                const std::string directory = path.substr(0, end);
+#if defined _WIN32 || defined __CYGWIN__
+                _mkdir(directory.c_str());
+#else
+                mkdir(directory.c_str(), 0755);
+#endif
+                if(end == std::string::npos)
+                    return;
+            }
+        }
+
+        GLuint ReadCachedProgram(const std::vector<std::string> &sources)
+        {
+            std::ifstream file(GetEntryPath(HashKey(sources, FileNameOffsetBasis)), std::ios::in | std::ios::binary);
+            if(!file.is_open())
+                return 0;
+            char magic[4];
+            uint64_t check;
+            GLenum format;
+            uint32_t length;
+            file.read(magic, sizeof(magic));
+            file.read(reinterpret_cast<char *>(&check), sizeof(check));
+            file.read(reinterpret_cast<char *>(&format), sizeof(format));
+            file.read(reinterpret_cast<char *>(&length), sizeof(length));
+            if(!file || memcmp(magic, ProgramCacheMagic, sizeof(magic)) != 0 || check != HashKey(sources, CheckOffsetBasis))
+                return 0;
+            std::vector<char> binary(length);
+            if(!file.read(binary.data(), length))
+                return 0;
+
+            GLuint program = glCreateProgram();
+            glProgramBinary(program, format, binary.data(), static_cast<GLsizei>(length));
+            GLint linked{GL_FALSE};
+            glGetProgramiv(program, GL_LINK_STATUS, &linked);
+            if(linked != GL_TRUE)
+            {
+                //for instance after a driver update that kept the version string.
+                glDeleteProgram(program);
+                return 0;
+            }
+            return program;
+        }
+    }
+
+    void SetProgramCacheDirectory(const std::string &directory)
+    {
+        GLint formatCount{0};
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+        cacheDirectory = formatCount > 0 ? directory : std::string();
+        if(!cacheDirectory.empty())
+            CreateDirectories(cacheDirectory);
+    }
+
+    std::string GetDefaultProgramCacheDirectory()
+    {
+#if defined _WIN32 || defined __CYGWIN__
+        if(const char * localAppData = std::getenv("LOCALAPPDATA"))
+            return std::string(localAppData) + "\\BuddhaShader";
+#else
+        if(const char * cacheHome = std::getenv("XDG_CACHE_HOME"))
+            return std::string(cacheHome) + "/BuddhaShader";
+        if(const char * home = std::getenv("HOME"))
+            return std::string(home) + "/.cache/BuddhaShader";
+#endif
+        return std::string();
+    }
+
+    GLuint LoadCachedProgram(const std::vector<std::string> &sources)
+    {
+        if(cacheDirectory.empty())
+            return 0;
+        const GLuint program = ReadCachedProgram(sources);
+        if(program != 0)
+            ++statistics.hits;
+        else
+            ++statistics.misses;
+        return program;
+    }
+
+    void StoreCachedProgram(const std::vector<std::string> &sources, GLuint program)
+    {
+        if(cacheDirectory.empty())
+            return;
+        GLint length{0};
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if(length <= 0)
+            return;
+        std::vector<char> binary(length);
+        GLenum format;
+        glGetProgramBinary(program, length, &length, &format, binary.data());
+
+        //Several processes, shards for instance, may store the same entry at once. Each writes its own file, and the last rename wins.
+        const std::string path = GetEntryPath(HashKey(sources, FileNameOffsetBasis));
+        const std::string temporaryPath = path + "." + std::to_string(std::random_device{}()) + ".tmp";
+        {
+            std::ofstream file(temporaryPath, std::ios::out | std::ios::binary | std::ios::trunc);
+            const uint64_t check = HashKey(sources, CheckOffsetBasis);
+            const uint32_t binaryLength = static_cast<uint32_t>(length);
+            file.write(ProgramCacheMagic, sizeof(ProgramCacheMagic));
+            file.write(reinterpret_cast<const char *>(&check), sizeof(check));
+            file.write(reinterpret_cast<const char *>(&format), sizeof(format));
+            file.write(reinterpret_cast<const char *>(&binaryLength), sizeof(binaryLength));
+            file.write(binary.data(), length);
+            if(!file.good())
+            {
+                //a cache that cannot be written only costs startup time.
+                file.close();
+                std::remove(temporaryPath.c_str());
+                return;
+            }
+        }
+        if(!ReplaceFile(temporaryPath, path))
+            std::remove(temporaryPath.c_str());
+    }
+
+    ProgramCacheStatistics GetProgramCacheStatistics()
+    {
+        return statistics;
+    }
+}
@@ -0,0 +1,489 @@
+#include "RenderDaemon.h"
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <cctype>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+namespace Helpers
+{
+    namespace
+    {
+        const unsigned int MaxRequestLength = 65536;
+        //a client that connects but does not send its request, or sends it a byte at a time, must not block the others for long.
+        const std::chrono::milliseconds RequestTimeout{2000};
+        //status only reports the most recent finished, failed and cancelled jobs, so a long running daemon does not grow without bound.
+        const unsigned int KeptEndedJobs = 256;
+
+        struct JsonValue
+        {
+            std::string text;
+            bool isString;
+        };
+
+        /** Parses a single flat JSON object of strings, numbers and booleans, which is all requests consist of. null members are left out. */
+        bool ParseFlatJsonObject(const std::string& json, std::map<std::string, JsonValue>& members)
+        {
+            size_t position{0};
+            auto skipWhitespace = [&]{
+                while(position < json.size() && std::isspace(static_cast<unsigned char>(json[position])))
+                    ++position;
+            };
+            auto parseString = [&](std::string& result){
+                if(position >= json.size() || json[position] != '"')
+                    return false;
+                for(++position; position < json.size() && json[position] != '"'; ++position)
+                {
+                    if(json[position] != '\\')
+                    {
+                        result.push_back(json[position]);
+                        continue;
+                    }
+                    if(++position >= json.size())
+                        return false;
+                    switch(json[position])
+                    {
+                    case 'n': result.push_back('\n'); break;
+                    case 't': result.push_back('\t'); break;
+                    case 'r': result.push_back('\r'); break;
+                    case 'b': result.push_back('\b'); break;
+                    case 'f': result.push_back('\f'); break;
+                    case 'u':
+                    {
+                        //paths and options are ASCII in practice, so other code points are not worth an UTF-8 encoder.
+                        if(position + 4 >= json.size())
+                            return false;
+                        const unsigned long codePoint = std::strtoul(json.substr(position + 1, 4).c_str(), nullptr, 16);
+                        if(codePoint == 0 || codePoint > 0x7f)
+                            return false;
+                        result.push_back(static_cast<char>(codePoint));
+                        position += 4;
+                        break;
+                    }
+                    default: result.push_back(json[position]); break;
+                    }
+                }
+                if(position >= json.size())
+                    return false;
+                ++position;
+                return true;
+            };
+
+            skipWhitespace();
+            if(position >= json.size() || json[position++] != '{')
+                return false;
+            skipWhitespace();
+            if(position < json.size() && json[position] == '}')
+                ++position;
+            else
+            {
+                while(true)
+                {
+                    std::string name;
+                    skipWhitespace();
+                    if(!parseString(name))
+                        return false;
+                    skipWhitespace();
+                    if(position >= json.size() || json[position++] != ':')
+                        return false;
+                    skipWhitespace();
+                    JsonValue value{std::string(), position < json.size() && json[position] == '"'};
+                    if(value.isString)
+                    {
+                        if(!parseString(value.text))
+                            return false;
+                    }
+                    else
+                    {
+                        while(position < json.size() && (std::isalnum(static_cast<unsigned char>(json[position])) || json[position] == '-' || json[position] == '+' || json[position] == '.'))
+                            value.text.push_back(json[position++]);
+                        if(value.text == "true")
+                            value.text = "1";
+                        else if(value.text == "false")
+                            value.text = "0";
+                        else if(value.text.empty() || (value.text != "null" && !std::isdigit(static_cast<unsigned char>(value.text.back()))))
+                            return false;
+                    }
+                    if(value.isString || value.text != "null")
+                        members[name] = value;
+                    skipWhitespace();
+                    if(position >= json.size())
+                        return false;
+                    if(json[position] == '}')
+                    {
+                        ++position;
+                        break;
+                    }
+                    if(json[position++] != ',')
+                        return false;
+                }
+            }
+            skipWhitespace();
+            return position == json.size();
+        }
+
+        std::string QuoteJson(const std::string& text)
+        {
+            std::ostringstream quoted;
+            quoted << '"';
+            for(char c : text)
+            {
+                if(c == '"' || c == '\\')
+                    quoted << '\\' << c;
+                else if(static_cast<unsigned char>(c) < 0x20)
+                    quoted << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec;
+                else
+                    quoted << c;
+            }
+            quoted << '"';
+            return quoted.str();
+        }
+
+        std::string ErrorResponse(const std::string& message)
+        {
+            return "{\"error\": " + QuoteJson(message) + "}";
+        }
+
+        const char * JobStateName(JobState state)
+        {
+            switch(state)
+            {
+            case JobState::Queued: return "queued";
+            case JobState::Running: return "running";
+            case JobState::Finished: return "finished";
+            case JobState::Failed: return "failed";
+            case JobState::Cancelled: return "cancelled";
+            }
+            return "unknown";
+        }
+
+        bool ParseJobId(const std::map<std::string, JsonValue>& members, unsigned int& id)
+        {
+            const auto member = members.find("job");
+            if(member == members.end() || member->second.isString)
+                return false;
+            char * end{nullptr};
+            const unsigned long value = std::strtoul(member->second.text.c_str(), &end, 10);
+            id = static_cast<unsigned int>(value);
+            return *end == '\0';
+        }
+    }
+
+    RenderDaemon::~RenderDaemon()
+    {
+        stopServer = true;
+        if(serverThread.joinable())
+            serverThread.join();
+#ifndef _WIN32
+        if(listenSocket >= 0)
+        {
+            close(listenSocket);
+            unlink(socketPath.c_str());
+        }
+#endif
+    }
+
+    bool RenderDaemon::Start(const std::string &path, unsigned int limit, JobValidator jobValidator)
+    {
+#ifdef _WIN32
+        (void)path;
+        (void)limit;
+        (void)jobValidator;
+        std::cerr << "--daemon needs Unix domain sockets, which are not supported on this platform." << std::endl;
+        return false;
+#else
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if(path.size() >= sizeof(address.sun_path))
+        {
+            std::cerr << "The socket path " << path << " is too long." << std::endl;
+            return false;
+        }
+        std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+        //a socket file that nobody listens on is left over from a daemon that did not exit cleanly, and may be replaced.
+        const int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(probe >= 0)
+        {
+            const bool inUse{connect(probe, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) == 0};
+            close(probe);
+            if(inUse)
+            {
+                std::cerr << "Another daemon is already listening on " << path << std::endl;
+                return false;
+            }
+            unlink(path.c_str());
+        }
+
+        //jobs name arbitrary output files, so only the owner may submit them. The permissions are set before anyone can connect.
+        listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(listenSocket < 0 || bind(listenSocket, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0 ||
+                chmod(path.c_str(), S_IRUSR | S_IWUSR) != 0 || listen(listenSocket, 16) != 0)
+        {
+            std::cerr << "Failed to listen on " << path << ": " << std::strerror(errno) << std::endl;
+            if(listenSocket >= 0)
+            {
+                close(listenSocket);
+                unlink(path.c_str());
+            }
+            listenSocket = -1;
+            return false;
+        }
+        socketPath = path;
+        queueLimit = limit;
+        validator = std::move(jobValidator);
+        serverThread = std::thread(&RenderDaemon::Serve, this);
+        return true;
+#endif
+    }
+
+    void RenderDaemon::Serve()
+    {
+#ifndef _WIN32
+        while(!stopServer)
+        {
+            //polling with a timeout, so the destructor does not have to wait for another client to connect.
+            pollfd listening{listenSocket, POLLIN, 0};
+            if(poll(&listening, 1, 200) <= 0)
+                continue;
+            const int client = accept(listenSocket, nullptr, nullptr);
+            if(client < 0)
+                continue;
+            const auto deadline = std::chrono::steady_clock::now() + RequestTimeout;
+            auto waitForClient = [&](short events){
+                const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+                pollfd connection{client, events, 0};
+                return remaining > 0 && poll(&connection, 1, static_cast<int>(remaining)) > 0;
+            };
+
+            std::string request;
+            char buffer[4096];
+            bool complete{false};
+            while(!complete && request.size() < MaxRequestLength && waitForClient(POLLIN))
+            {
+                const ssize_t received = recv(client, buffer, sizeof(buffer), 0);
+                if(received <= 0)
+                {
+                    //clients that close their end without a newline have sent everything too.
+                    complete = received == 0;
+                    break;
+                }
+                request.append(buffer, static_cast<size_t>(received));
+                const auto newline = request.find('\n');
+                if(newline != std::string::npos)
+                {
+                    request.resize(newline);
+                    complete = true;
+                }
+            }
+            const std::string response = (complete ? HandleRequest(request) : ErrorResponse("incomplete request")) + "\n";
+#ifdef MSG_NOSIGNAL
+            const int sendFlags{MSG_NOSIGNAL};
+#else
+            const int sendFlags{0};
+#endif
+            for(size_t sent = 0; sent < response.size() && waitForClient(POLLOUT);)
+            {
+                const ssize_t written = send(client, response.data() + sent, response.size() - sent, sendFlags | MSG_DONTWAIT);
+                if(written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    continue;
+                if(written <= 0)
+                    break;
+                sent += static_cast<size_t>(written);
+            }
+            close(client);
+        }
+#endif
+    }
+
+    std::string RenderDaemon::HandleRequest(const std::string &request)
+    {
+        std::map<std::string, JsonValue> members;
+        if(!ParseFlatJsonObject(request, members))
+            return ErrorResponse("requests have to be a single JSON object of strings, numbers and booleans");
+        const auto commandMember = members.find("command");
+        if(commandMember == members.end())
+            return ErrorResponse("missing command");
+        const std::string command = commandMember->second.text;
+
+        if(command == "submit")
+        {
+            int priority{0};
+            const auto priorityMember = members.find("priority");
+            if(priorityMember != members.end())
+            {
+                char * end{nullptr};
+                priority = static_cast<int>(std::strtol(priorityMember->second.text.c_str(), &end, 10));
+                if(priorityMember->second.isString || *end != '\0')
+                    return ErrorResponse("priority has to be an integer");
+            }
+            std::vector<std::string> arguments;
+            for(const auto& member : members)
+            {
+                if(member.first == "command" || member.first == "priority")
+                    continue;
+                arguments.push_back("--" + member.first);
+                arguments.push_back(member.second.text);
+            }
+            if(validator && !validator(arguments))
+                return ErrorResponse("invalid options, see the output of the daemon");
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if(shutdownRequested)
+                return ErrorResponse("the daemon is shutting down");
+            unsigned int queued{0};
+            for(const auto& job : jobs)
+                queued += job.second.state == JobState::Queued ? 1 : 0;
+            if(queued >= queueLimit)
+                return "{\"error\": \"queue full\", \"queued\": " + std::to_string(queued) + "}";
+            const unsigned int id{nextJobId++};
+            jobs[id] = JobRecord{DaemonJob{id, priority, arguments}, JobState::Queued, JobProgress{0.0, 0, 0, 0, 0}, false};
+            jobQueued.notify_one();
+            return "{\"job\": " + std::to_string(id) + ", \"queued\": " + std::to_string(queued + 1) + "}";
+        }
+        if(command == "status")
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(members.count("job") == 0)
+            {
+                std::string response{"{\"jobs\": ["};
+                for(const auto& job : jobs)
+                    response += (job.first == jobs.begin()->first ? "" : ", ") + DescribeJob(job.second);
+                return response + "]}";
+            }
+            unsigned int id;
+            if(!ParseJobId(members, id))
+                return ErrorResponse("job has to be a job number");
+            const auto job = jobs.find(id);
+            return job == jobs.end() ? ErrorResponse("no such job") : DescribeJob(job->second);
+        }
+        if(command == "cancel")
+        {
+            unsigned int id;
+            if(!ParseJobId(members, id))
+                return ErrorResponse("job has to be a job number");
+            std::lock_guard<std::mutex> lock(mutex);
+            const auto job = jobs.find(id);
+            if(job == jobs.end())
+                return ErrorResponse("no such job");
+            JobRecord& record = job->second;
+            if(record.state == JobState::Queued)
+                record.state = JobState::Cancelled;
+            //the render loop notices this with its next progress report.
+            else if(record.state == JobState::Running)
+                record.cancelRequested = true;
+            else
+                return ErrorResponse(std::string("the job is already ") + JobStateName(record.state));
+            const std::string description = DescribeJob(record);
+            PruneEndedJobs();
+            return description;
+        }
+        if(command == "shutdown")
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            shutdownRequested = true;
+            for(auto& job : jobs)
+            {
+                if(job.second.state == JobState::Queued)
+                    job.second.state = JobState::Cancelled;
+            }
+            PruneEndedJobs();
+            jobQueued.notify_all();
+            return "{\"shutdown\": true}";
+        }
+        return ErrorResponse("unknown command " + command);
+    }
+
+    std::string RenderDaemon::DescribeJob(const JobRecord &record) const
+    {
+        const JobProgress& progress = record.progress;
+        std::ostringstream description;
+        description << std::setprecision(10) << "{\"job\": " << record.job.id << ", \"state\": \"" << JobStateName(record.state) << "\", \"priority\": " << record.job.priority;
+        if(record.state != JobState::Queued && progress.seconds > 0.0)
+        {
+            description << ", \"seconds\": " << progress.seconds << ", \"samples\": " << progress.samples << ", \"acceptedOrbits\": " << progress.acceptedOrbits <<
+                           ", \"samplesPerSecond\": " << progress.samples / progress.seconds << ", \"acceptedOrbitsPerSecond\": " << progress.acceptedOrbits / progress.seconds;
+            if(progress.budgetTotal != 0)
+            {
+                description << ", \"progress\": " << static_cast<double>(progress.budgetDone) / progress.budgetTotal;
+                const double rate{progress.budgetDone / progress.seconds};
+                if(record.state == JobState::Running && rate > 0.0)
+                    description << ", \"eta\": " << (progress.budgetTotal - progress.budgetDone) / rate;
+            }
+        }
+        description << "}";
+        return description.str();
+    }
+
+    bool RenderDaemon::WaitForJob(DaemonJob &job, std::chrono::milliseconds timeout)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        JobRecord * next{nullptr};
+        jobQueued.wait_for(lock, timeout, [&]{
+            next = nullptr;
+            for(auto& candidate : jobs)
+            {
+                if(candidate.second.state == JobState::Queued && (next == nullptr || candidate.second.job.priority > next->job.priority))
+                    next = &candidate.second;
+            }
+            return next != nullptr || shutdownRequested;
+        });
+        if(next == nullptr || shutdownRequested)
+            return false;
+        next->state = JobState::Running;
+        job = next->job;
+        return true;
+    }
+
+    bool RenderDaemon::ReportProgress(unsigned int id, const JobProgress &progress)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        JobRecord& record = jobs.at(id);
+        record.progress = progress;
+        return !record.cancelRequested;
+    }
+
+    JobState RenderDaemon::FinishJob(unsigned int id, bool succeeded)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        JobRecord& record = jobs.at(id);
+        //a cancelled job still writes its outputs, so failing to write them makes it fail as well.
+        record.state = !succeeded ? JobState::Failed : (record.cancelRequested ? JobState::Cancelled : JobState::Finished);
+        const JobState state{record.state};
+        PruneEndedJobs();
+        return state;
+    }
+
+    void RenderDaemon::PruneEndedJobs()
+    {
+        unsigned int ended{0};
+        for(const auto& job : jobs)
+            ended += (job.second.state != JobState::Queued && job.second.state != JobState::Running) ? 1 : 0;
+        //ids grow with every submission, so the oldest jobs come first.
+        for(auto job = jobs.begin(); job != jobs.end() && ended > KeptEndedJobs;)
+        {
+            if(job->second.state == JobState::Queued || job->second.state == JobState::Running)
+                ++job;
+            else
+            {
+                job = jobs.erase(job);
+                --ended;
+            }
+        }
+    }
+
+    bool RenderDaemon::IsShutdownRequested() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return shutdownRequested;
+    }
+}
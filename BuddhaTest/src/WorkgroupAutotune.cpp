@@ -0,0 +1,269 @@
+#include "WorkgroupAutotune.h"
+#include "PipelineCounters.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+
+namespace Helpers
+{
+    namespace
+    {
+        //seconds every candidate renders before it is measured, so the dispatch size can settle.
+        const unsigned int AutotuneWarmup = 2;
+
+        struct DeviceLimits
+        {
+            unsigned int maxLocalSize[3];
+            unsigned int maxInvocations;
+            unsigned int maxGroupCount[3];
+            uint64_t maxWorkers;
+        };
+
+        DeviceLimits QueryDeviceLimits(const RenderSettings& settings)
+        {
+            DeviceLimits limits;
+            GLint value;
+            for(GLuint i = 0; i < 3; ++i)
+            {
+                glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, i, &value);
+                limits.maxLocalSize[i] = static_cast<unsigned int>(value);
+                glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, i, &value);
+                limits.maxGroupCount[i] = static_cast<unsigned int>(value);
+            }
+            glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &value);
+            limits.maxInvocations = static_cast<unsigned int>(value);
+            //every worker has an entry in the state buffer.
+            glGetIntegerv(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &value);
+            limits.maxWorkers = static_cast<uint64_t>(static_cast<unsigned int>(value)) / GetWorkerStateSize(settings);
+            return limits;
+        }
+
+        uint64_t GetWorkerCount(const WorkgroupSizes& sizes)
+        {
+            return static_cast<uint64_t>(sizes.localX) * sizes.localY * sizes.localZ * sizes.globalX * sizes.globalY * sizes.globalZ;
+        }
+
+        bool IsValid(const WorkgroupSizes& sizes, const DeviceLimits& limits)
+        {
+            return sizes.localX <= limits.maxLocalSize[0] && sizes.localY <= limits.maxLocalSize[1] && sizes.localZ <= limits.maxLocalSize[2] &&
+                    static_cast<uint64_t>(sizes.localX) * sizes.localY * sizes.localZ <= limits.maxInvocations &&
+                    sizes.globalX <= limits.maxGroupCount[0] && sizes.globalY <= limits.maxGroupCount[1] && sizes.globalZ <= limits.maxGroupCount[2] &&
+                    GetWorkerCount(sizes) <= limits.maxWorkers;
+        }
+
+        /** Spreads about workerCount workers over a two dimensional grid of groups of the given local size. */
+        WorkgroupSizes WithWorkerCount(unsigned int localX, unsigned int localY, uint64_t workerCount)
+        {
+            const uint64_t groupCount = std::max<uint64_t>(1, workerCount / (static_cast<uint64_t>(localX) * localY));
+            const uint64_t globalX = static_cast<uint64_t>(std::ceil(std::sqrt(static_cast<double>(groupCount))));
+            const uint64_t globalY = (groupCount + globalX - 1) / globalX;
+            return {localX, localY, 1, static_cast<unsigned int>(globalX), static_cast<unsigned int>(globalY), 1};
+        }
+
+        std::string Describe(const WorkgroupSizes& sizes)
+        {
+            return "local " + std::to_string(sizes.localX) + "x" + std::to_string(sizes.localY) + "x" + std::to_string(sizes.localZ) +
+                    ", global " + std::to_string(sizes.globalX) + "x" + std::to_string(sizes.globalY) + "x" + std::to_string(sizes.globalZ);
+        }
+
+        /** Renders a benchmark with the given sizes and returns the candidates per second, or 0 if the run failed. */
+        double Measure(const std::string& commonArguments, const WorkgroupSizes& sizes, unsigned int seconds, const std::string& resultPath)
+        {
+            const std::string command = commonArguments +
+                    " --benchmark " + std::to_string(AutotuneWarmup + seconds) +
+                    " --benchmarkWarmup " + std::to_string(AutotuneWarmup) +
+                    " --benchmarkOutput " + QuoteShellArgument(resultPath) +
+                    " --localWorkgroupSizeX " + std::to_string(sizes.localX) +
+                    " --localWorkgroupSizeY " + std::to_string(sizes.localY) +
+                    " --localWorkgroupSizeZ " + std::to_string(sizes.localZ) +
+                    " --globalWorkgroupSizeX " + std::to_string(sizes.globalX) +
+                    " --globalWorkgroupSizeY " + std::to_string(sizes.globalY) +
+                    " --globalWorkgroupSizeZ " + std::to_string(sizes.globalZ);
+            std::remove(resultPath.c_str());
+            const int exitCode = RunChildProcess(command);
+            PipelineThroughput throughput;
+            if(exitCode != 0 || !ReadPipelineThroughput(resultPath, throughput))
+            {
+                std::cerr << "Benchmark with " << Describe(sizes) << " failed with exit status " << exitCode << "." << std::endl;
+                return 0.0;
+            }
+            std::remove(resultPath.c_str());
+            return throughput.candidates;
+        }
+    }
+
+    std::string GetDeviceIdentifier()
+    {
+        std::string identifier = std::string(reinterpret_cast<const char *>(glGetString(GL_VENDOR))) + " / " +
+                reinterpret_cast<const char *>(glGetString(GL_RENDERER)) + " / " +
+                reinterpret_cast<const char *>(glGetString(GL_VERSION));
+        //the cache stores one device per line, separated from its sizes by a tab.
+        std::replace_if(identifier.begin(), identifier.end(), [](char c){ return c == '\t' || c == '\n' || c == '\r'; }, ' ');
+        return identifier;
+    }
+
+    std::string GetWorkgroupCachePath(const RenderSettings& settings)
+    {
+        if(!settings.workgroupCacheFilename.empty())
+            return settings.workgroupCacheFilename;
+#if defined _WIN32 || defined __CYGWIN__
+        const char * directory = std::getenv("APPDATA");
+        const std::string separator("\\");
+#else
+        const char * directory = std::getenv("HOME");
+        const std::string separator("/");
+#endif
+        return (directory != nullptr ? std::string(directory) + separator : std::string()) + ".buddhashader-workgroups";
+    }
+
+    bool ReadCachedWorkgroupSizes(const std::string& path, const std::string& device, WorkgroupSizes& sizes)
+    {
+        std::ifstream file(path);
+        std::string line;
+        while(std::getline(file, line))
+        {
+            const auto separator = line.find('\t');
+            if(separator == std::string::npos || line.substr(0, separator) != device)
+                continue;
+            std::istringstream values(line.substr(separator + 1));
+            WorkgroupSizes cached;
+            if(values >> cached.localX >> cached.localY >> cached.localZ >> cached.globalX >> cached.globalY >> cached.globalZ)
+            {
+                sizes = cached;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool WriteCachedWorkgroupSizes(const std::string& path, const std::string& device, const WorkgroupSizes& sizes)
+    {
+        std::vector<std::string> otherDevices;
+        {
+            std::ifstream file(path);
+            std::string line;
+            while(std::getline(file, line))
+            {
+                if(!line.empty() && line.substr(0, line.find('\t')) != device)
+                    otherDevices.push_back(line);
+            }
+        }
+        //every render reads the cache, so it is replaced in one step instead of being rewritten in place.
+        const std::string temporaryPath = path + ".tmp";
+        {
+            std::ofstream file(temporaryPath, std::ios::out | std::ios::trunc);
+            if(!file.is_open())
+            {
+                std::cerr << "Failed to open " << temporaryPath << " for writing." << std::endl;
+                return false;
+            }
+            for(const auto& line : otherDevices)
+                file << line << "\n";
+            file << device << "\t" << sizes.localX << " " << sizes.localY << " " << sizes.localZ << " " << sizes.globalX << " " << sizes.globalY << " " << sizes.globalZ << "\n";
+            file.close();
+            if(!file)
+            {
+                std::cerr << "Failed to write " << temporaryPath << "." << std::endl;
+                std::remove(temporaryPath.c_str());
+                return false;
+            }
+        }
+        if(!ReplaceFile(temporaryPath, path))
+        {
+            std::cerr << "Failed to move " << temporaryPath << " to " << path << "." << std::endl;
+            std::remove(temporaryPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    void ApplyCachedWorkgroupSizes(RenderSettings& settings)
+    {
+        if(settings.workgroupSizesGiven)
+            return;
+        WorkgroupSizes sizes;
+        if(!ReadCachedWorkgroupSizes(GetWorkgroupCachePath(settings), GetDeviceIdentifier(), sizes))
+            return;
+        settings.localWorkgroupSizeX = sizes.localX;
+        settings.localWorkgroupSizeY = sizes.localY;
+        settings.localWorkgroupSizeZ = sizes.localZ;
+        settings.globalWorkGroupSizeX = sizes.globalX;
+        settings.globalWorkGroupSizeY = sizes.globalY;
+        settings.globalWorkGroupSizeZ = sizes.globalZ;
+        if(settings.printDebugOutput != 0)
+            std::cout << "Using the work group sizes found by --autotune: " << Describe(sizes) << std::endl;
+    }
+
+    int RunWorkgroupAutotune(const RenderSettings& settings, int argc, char * argv[])
+    {
+        const std::string cachePath = GetWorkgroupCachePath(settings);
+        const std::string device = GetDeviceIdentifier();
+        const DeviceLimits limits = QueryDeviceLimits(settings);
+
+        //the benchmarks render the same image as the actual render would, but write nothing, open no window and stop on their own.
+        const std::unordered_set<std::string> replacedOptions{"--autotune", "--workgroupCache", "--localWorkgroupSizeX", "--localWorkgroupSizeY", "--localWorkgroupSizeZ",
+                                                              "--globalWorkgroupSizeX", "--globalWorkgroupSizeY", "--globalWorkgroupSizeZ", "--output", "--histogramOutput",
+                                                              "--checkpoint", "--resume", "--snapshotInterval", "--dispatchLog", "--pipelineCounters", "--benchmark",
+                                                              "--benchmarkWarmup", "--benchmarkOutput", "--sampleBudget", "--acceptedOrbitBudget", "--targetNoise", "--printDebugOutput",
+                                                              "--headless"};
+        std::string commonArguments = QuoteShellArgument(argv[0]) + " --headless 1";
+        for(int i = 1; i + 1 < argc; i += 2)
+        {
+            if(replacedOptions.count(argv[i]) == 0)
+                commonArguments += " " + QuoteShellArgument(argv[i]) + " " + QuoteShellArgument(argv[i+1]);
+        }
+        const std::string resultPath = cachePath + ".result.tmp";
+
+        std::cout << "Tuning work group sizes for " << device << ", " << settings.autotuneTime << " s per candidate." << std::endl;
+        WorkgroupSizes best{};
+        double bestRate{0.0};
+        auto tryCandidate = [&](const WorkgroupSizes& candidate){
+            if(!IsValid(candidate, limits))
+                return;
+            const double rate = Measure(commonArguments, candidate, settings.autotuneTime, resultPath);
+            if(rate > 0.0)
+                std::cout << Describe(candidate) << ": " << static_cast<uint64_t>(rate) << " candidates/s" << std::endl;
+            if(rate > bestRate)
+            {
+                bestRate = rate;
+                best = candidate;
+            }
+        };
+
+        //Local sizes are powers of two, once as a row and once as a square-ish tile, with as many workers as the current settings have.
+        const uint64_t workerCount = std::min(static_cast<uint64_t>(settings.localWorkgroupSizeX) * settings.localWorkgroupSizeY * settings.localWorkgroupSizeZ *
+                                              settings.globalWorkGroupSizeX * settings.globalWorkGroupSizeY * settings.globalWorkGroupSizeZ, limits.maxWorkers);
+        for(unsigned int invocations = 32; invocations <= std::min(1024u, limits.maxInvocations); invocations *= 2)
+        {
+            tryCandidate(WithWorkerCount(invocations, 1, workerCount));
+            unsigned int tileX{1};
+            while(tileX * tileX < invocations)
+                tileX *= 2;
+            tryCandidate(WithWorkerCount(tileX, invocations / tileX, workerCount));
+        }
+        if(bestRate == 0.0)
+        {
+            std::cerr << "No work group size could be measured." << std::endl;
+            return 1;
+        }
+        //More workers hide latency better, but every worker needs memory, and the samples of the last chunks are spread thinner.
+        const WorkgroupSizes bestLocal = best;
+        for(uint64_t factor : {UINT64_C(16), UINT64_C(4)})
+            tryCandidate(WithWorkerCount(bestLocal.localX, bestLocal.localY, workerCount / factor));
+        for(uint64_t factor : {UINT64_C(4), UINT64_C(16)})
+            tryCandidate(WithWorkerCount(bestLocal.localX, bestLocal.localY, workerCount * factor));
+
+        std::cout << "Fastest: " << Describe(best) << " with " << static_cast<uint64_t>(bestRate) << " candidates/s." << std::endl;
+        if(!WriteCachedWorkgroupSizes(cachePath, device, best))
+            return 1;
+        std::cout << "Stored in " << cachePath << ". It is used whenever no work group size is given on the command line." << std::endl;
+        return 0;
+    }
+}
@@ -7,15 +7,15 @@
     APIs: gl=4.3
     Profile: core
     Extensions:
-        
+        GL_ARB_buffer_storage
     Loader: False
     Local files: False
     Omit khrplatform: False
 
     Commandline:
-        --profile="core" --api="gl=4.3" --generator="c" --spec="gl" --no-loader --extensions=""
+        --profile="core" --api="gl=4.3" --generator="c" --spec="gl" --no-loader --extensions="GL_ARB_buffer_storage"
     Online:
-        http://glad.dav1d.de/#profile=core&language=c&specification=gl&api=gl%3D4.3
+        http://glad.dav1d.de/#profile=core&language=c&specification=gl&api=gl%3D4.3&extensions=GL_ARB_buffer_storage
 */
 
 #include <stdio.h>
@@ -705,6 +705,8 @@ PFNGLFRONTFACEPROC glad_glFrontFace;
 PFNGLTEXBUFFERRANGEPROC glad_glTexBufferRange;
 PFNGLDRAWARRAYSINSTANCEDBASEINSTANCEPROC glad_glDrawArraysInstancedBaseInstance;
 PFNGLDELETEPROGRAMPIPELINESPROC glad_glDeleteProgramPipelines;
+int GLAD_GL_ARB_buffer_storage;
+PFNGLBUFFERSTORAGEPROC glad_glBufferStorage;
 static void load_GL_VERSION_1_0(GLADloadproc load) {
 	if(!GLAD_GL_VERSION_1_0) return;
 	glad_glCullFace = (PFNGLCULLFACEPROC)load("glCullFace");
@@ -1320,9 +1322,13 @@ static void load_GL_VERSION_4_3(GLADloadproc load) {
 	glad_glObjectPtrLabel = (PFNGLOBJECTPTRLABELPROC)load("glObjectPtrLabel");
 	glad_glGetObjectPtrLabel = (PFNGLGETOBJECTPTRLABELPROC)load("glGetObjectPtrLabel");
 }
+static void load_GL_ARB_buffer_storage(GLADloadproc load) {
+	if(!GLAD_GL_ARB_buffer_storage) return;
+	glad_glBufferStorage = (PFNGLBUFFERSTORAGEPROC)load("glBufferStorage");
+}
 static int find_extensionsGL(void) {
 	if (!get_exts()) return 0;
-	(void)&has_ext;
+	GLAD_GL_ARB_buffer_storage = has_ext("GL_ARB_buffer_storage");
 	free_exts();
 	return 1;
 }
@@ -1409,6 +1415,7 @@ int gladLoadGLLoader(GLADloadproc load) {
 	load_GL_VERSION_4_3(load);
 
 	if (!find_extensionsGL()) return 0;
+	load_GL_ARB_buffer_storage(load);
 	return GLVersion.major != 0 || GLVersion.minor != 0;
 }
 